@@ -26,8 +26,10 @@
 #include <redshift/boot/sequence.h>
 #include <redshift/boot/sched.h>
 #include <redshift/boot/tss.h>
+#include <redshift/hal/acpi.h>
 #include <redshift/hal/cpu.h>
 #include <redshift/hal/memory.h>
+#include <redshift/hal/smp.h>
 #include <redshift/kernel/asm.h>
 #include <redshift/kernel/console.h>
 #include <redshift/kernel/initrd.h>
@@ -35,8 +37,11 @@
 #include <redshift/kernel/sleep.h>
 #include <redshift/kernel/symbols.h>
 #include <redshift/kernel/timer.h>
+#include <redshift/mem/frame.h>
 #include <redshift/mem/heap.h>
+#include <redshift/mem/memblock.h>
 #include <redshift/mem/paging.h>
+#include <redshift/mem/slab.h>
 #include <redshift/mem/static.h>
 #include <redshift/sched/process.h>
 
@@ -121,33 +126,34 @@ static void __init(BOOT_SEQUENCE_INIT_INTERRUPT_SYSTEM) init_interrupt_system(vo
     pit_init(TICK_RATE);
 }
 
-static void __init(BOOT_SEQUENCE_INIT_BOOT_MODULES_1) init_boot_modules_1(void)
-{
-    printk(PRINTK_INFO "Discovering boot modules\n");
-    discover_boot_modules(mb_tags);
-}
-
 static void __init(BOOT_SEQUENCE_INIT_HAL) init_hal(void)
 {
     printk(PRINTK_INFO "Initialising hardware abstraction layer\n");
     cpu_init();
     memory_init(mb_tags);
+    acpi_init(mb_tags);
 }
 
 static void __init(BOOT_SEQUENCE_INIT_MEMORY) init_memory(void)
 {
 
     printk(PRINTK_INFO "Initialising memory manager\n");
-    printk(PRINTK_DEBUG "Initialising static allocator\n");
-    static_init();
-    printk(PRINTK_DEBUG "Initialising page allocator\n");
-    paging_init(memory_size_total());
+    printk(PRINTK_DEBUG "Initialising boot memory allocator\n");
+    memblock_init(mb_tags);
     memory_map_init(mb_tags);
+    printk(PRINTK_DEBUG "Initialising page allocator\n");
+    paging_init();
+    tss_init_double_fault();
     printk(PRINTK_DEBUG "Intialising heap allocator\n");
     heap_init();
+    heap_print_stats(__kernel_heap__);
+    paging_print_stats();
+#ifndef NDEBUG
+    paging_benchmark_switch();
+#endif
 }
 
-static void __init(BOOT_SEQUENCE_INIT_BOOT_MODULES_2) init_boot_modules_2(void)
+static void __init(BOOT_SEQUENCE_INIT_BOOT_MODULES) init_boot_modules(void)
 {
     printk(PRINTK_INFO "Processing boot modules\n");
     save_boot_modules(mb_tags);
@@ -183,8 +189,36 @@ static void __init(BOOT_SEQUENCE_INIT_DEVICES) init_devices(void)
 
 static void __init(BOOT_SEQUENCE_START_SCHEDULER) start_scheduler(void)
 {
+    heap_print_stats(__kernel_heap__);
+    kmem_cache_print_stats();
+    frame_release_boot_memory();
     printk(PRINTK_INFO "Starting scheduler\n");
     sched_init();
+    printk(PRINTK_INFO "Starting other CPUs\n");
+    smp_init();
+}
+
+/* Free the memory which is only needed during boot: the boot modules, the multiboot2 tags and the boot code. This
+ * isn't part of the boot sequence since the boot sequence is part of what gets freed.
+ */
+static void free_init_memory(void)
+{
+    initrd_fini();
+    size_t module_size = 0;
+    for (const struct boot_module* module = boot_modules_head(); module != NULL; module = module->next) {
+        module_size += frame_free_boot_range(module->start, module->end);
+    }
+    const uintptr_t tags_end  = (uintptr_t)mb_tags + *(uint32_t*)mb_tags;
+    const size_t    tags_size = frame_free_boot_range((uintptr_t)mb_tags, tags_end);
+    mb_tags = NULL;
+    const size_t    init_size = frame_free_boot_range((uintptr_t)__init_start__, (uintptr_t)__init_end__);
+    printk(
+        PRINTK_INFO "Freed boot memory: <modules=%luK,tags=%luK,init=%luK,total=%luK>\n",
+        module_size/1024,
+        tags_size/1024,
+        init_size/1024,
+        (module_size + tags_size + init_size)/1024
+    );
 }
 
 void boot(void)
@@ -196,13 +230,13 @@ void boot(void)
     check_boot_env();
     init_interrupt_system();
     init_hal();
-    init_boot_modules_1();
     init_memory();
-    init_boot_modules_2();
+    init_boot_modules();
     load_initrd();
     init_symbol_table();
     init_devices();
     start_scheduler();
+    free_init_memory();
     enable_interrupts();
     process_yield();
     UNREACHABLE("%s should not return!", __func__);
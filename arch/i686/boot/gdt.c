@@ -21,11 +21,12 @@
 #include <redshift/kernel.h>
 #include <redshift/boot/gdt.h>
 #include <redshift/boot/tss.h>
+#include <redshift/hal/smp.h>
 
 extern void loadgdt(uint32_t addr); /* loadgdt.asm */
 
 enum {
-    GDT_ENTRIES_MAX = 7
+    GDT_ENTRIES_MAX = 8
 };
 
 static struct gdt_entry {
@@ -35,39 +36,54 @@ static struct gdt_entry {
     uint8_t  access;
     uint8_t  granularity;
     uint8_t  base_high;
-} __packed gdt_entries[GDT_ENTRIES_MAX];
+} __packed gdt_entries[SMP_CPUS_MAX][GDT_ENTRIES_MAX];
 
 static struct gdt_ptr {
     uint16_t limit;
     uint32_t base;
-} __packed pgdt;
+} __packed pgdt[SMP_CPUS_MAX];
 
-static void gdt_entry(uint32_t i, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran)
+static void gdt_entry(unsigned cpu, uint32_t i, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran)
 {
     DEBUG_ASSERT(i < GDT_ENTRIES_MAX);
-    gdt_entries[i].base_low     = (base & 0xFFFF);
-    gdt_entries[i].base_mid     = (base >> 16) & 0xFF;
-    gdt_entries[i].base_high    = (base >> 24) & 0xFF;
-    gdt_entries[i].limit_low    = (limit & 0xFFFF);
-    gdt_entries[i].granularity  = (limit >> 16) & 0x0F;
-    gdt_entries[i].granularity |= gran & 0xF0;
-    gdt_entries[i].access       = access;
+    struct gdt_entry* entry = &(gdt_entries[cpu][i]);
+    entry->base_low     = (base & 0xFFFF);
+    entry->base_mid     = (base >> 16) & 0xFF;
+    entry->base_high    = (base >> 24) & 0xFF;
+    entry->limit_low    = (limit & 0xFFFF);
+    entry->granularity  = (limit >> 16) & 0x0F;
+    entry->granularity |= gran & 0xF0;
+    entry->access       = access;
 }
 
 void gdt_init(void)
 {
     SAVE_INTERRUPT_STATE;
-    const uint32_t tss_base  = get_tss_base();
-    const uint32_t tss_limit = tss_base + get_tss_size();
-    DEBUG_ASSERT(tss_limit > tss_base);
-    pgdt.limit = (sizeof(*gdt_entries)*GDT_ENTRIES_MAX) - 1;
-    pgdt.base = (uint32_t)&gdt_entries;
-    gdt_entry(0, 0x00000000, 0x00000000,  0x00, 0x00); /* Null descriptor.        */
-    gdt_entry(1, 0x00000000, 0xFFFFFFFF,  0x9A, 0xCF); /* Kernel code segment.    */
-    gdt_entry(2, 0x00000000, 0xFFFFFFFF,  0x92, 0xCF); /* Kernel data segment.    */
-    gdt_entry(3, 0x00000000, 0xFFFFFFFF,  0xFA, 0xCF); /* User-mode code segment. */
-    gdt_entry(4, 0x00000000, 0xFFFFFFFF,  0xF2, 0xCF); /* User-mode data segment. */
-    gdt_entry(5, tss_base,   tss_limit,   0x89, 0x40); /* TSS                     */
-    loadgdt((uint32_t)&pgdt);
+    for (unsigned cpu = 0; cpu < SMP_CPUS_MAX; ++cpu) {
+        const uint32_t tss_base    = get_tss_base(cpu);
+        const uint32_t tss_limit   = tss_base + get_tss_size();
+        const uint32_t df_base     = get_double_fault_tss_base(cpu);
+        const uint32_t df_limit    = df_base + get_tss_size();
+        const uint32_t local_base  = (uint32_t)smp_cpu_local(cpu);
+        const uint32_t local_limit = sizeof(struct cpu_local) - 1;
+        DEBUG_ASSERT(tss_limit > tss_base);
+        pgdt[cpu].limit = (sizeof(**gdt_entries)*GDT_ENTRIES_MAX) - 1;
+        pgdt[cpu].base  = (uint32_t)&(gdt_entries[cpu]);
+        gdt_entry(cpu, 0, 0x00000000, 0x00000000,  0x00, 0x00); /* Null descriptor.        */
+        gdt_entry(cpu, 1, 0x00000000, 0xFFFFFFFF,  0x9A, 0xCF); /* Kernel code segment.    */
+        gdt_entry(cpu, 2, 0x00000000, 0xFFFFFFFF,  0x92, 0xCF); /* Kernel data segment.    */
+        gdt_entry(cpu, 3, 0x00000000, 0xFFFFFFFF,  0xFA, 0xCF); /* User-mode code segment. */
+        gdt_entry(cpu, 4, 0x00000000, 0xFFFFFFFF,  0xF2, 0xCF); /* User-mode data segment. */
+        gdt_entry(cpu, 5, tss_base,   tss_limit,   0x89, 0x40); /* TSS                     */
+        gdt_entry(cpu, 6, local_base, local_limit, 0x92, 0x40); /* CPU-local data segment. */
+        gdt_entry(cpu, 7, df_base,    df_limit,    0x89, 0x40); /* Double-fault TSS.       */
+    }
+    loadgdt(gdt_get_pointer(0));
     RESTORE_INTERRUPT_STATE;
 }
+
+uint32_t gdt_get_pointer(unsigned cpu)
+{
+    DEBUG_ASSERT(cpu < SMP_CPUS_MAX);
+    return (uint32_t)&(pgdt[cpu]);
+}
@@ -22,6 +22,7 @@
 #include <libk/kstring.h>
 #include <redshift/kernel.h>
 #include <redshift/boot/idt.h>
+#include <redshift/boot/tss.h>
 #include <redshift/kernel/asm.h>
 
 enum {
@@ -66,7 +67,7 @@ void idt_init(void)
     idt_entry( 5,  (uint32_t)isr5, 0x08, 0x8E);
     idt_entry( 6,  (uint32_t)isr6, 0x08, 0x8E);
     idt_entry( 7,  (uint32_t)isr7, 0x08, 0x8E);
-    idt_entry( 8,  (uint32_t)isr8, 0x08, 0x8E);
+    idt_entry( 8,               0, DOUBLE_FAULT_TSS_SELECTOR, 0x85); /* Task gate, so it has a stack of its own. */
     idt_entry( 9,  (uint32_t)isr9, 0x08, 0x8E);
     idt_entry(10, (uint32_t)isr10, 0x08, 0x8E);
     idt_entry(11, (uint32_t)isr11, 0x08, 0x8E);
@@ -106,6 +107,17 @@ void idt_init(void)
     idt_entry(45, (uint32_t)irq13, 0x08, 0x8E);
     idt_entry(46, (uint32_t)irq14, 0x08, 0x8E);
     idt_entry(47, (uint32_t)irq15, 0x08, 0x8E);
+    idt_entry(48, (uint32_t)irq16, 0x08, 0x8E);
+    idt_entry(49, (uint32_t)irq17, 0x08, 0x8E);
+    idt_entry(50, (uint32_t)irq18, 0x08, 0x8E);
+    idt_entry(255, (uint32_t)isr_spurious, 0x08, 0x8E);
+    loadidt((uint32_t)&pidt);
+    RESTORE_INTERRUPT_STATE;
+}
+
+void idt_load(void)
+{
+    SAVE_INTERRUPT_STATE;
     loadidt((uint32_t)&pidt);
     RESTORE_INTERRUPT_STATE;
 }
@@ -24,6 +24,15 @@
 #include <redshift/kernel/timer.h>
 #include <redshift/sched/process.h>
 
+enum {
+    PIT_FREQUENCY     = 1193180, /* Input clock of the PIT in Hz.                                */
+    PIT_DELAY_MAX     = 50000,   /* Longest wait in microseconds that channel 2's counter holds. */
+    PIT_GATE_ENABLE   = 1 << 0,  /* PIT_GATE: channel 2 counts while this is set.                */
+    PIT_GATE_SPEAKER  = 1 << 1,  /* PIT_GATE: channel 2 drives the speaker.                      */
+    PIT_GATE_OUT      = 1 << 5,  /* PIT_GATE: channel 2's output, set when the count runs out.   */
+    PIT_ONESHOT_2     = 0xB0     /* Command: channel 2, low byte then high byte, mode 0.         */
+};
+
 static void pit_handler(const struct cpu_state* regs)
 {
     process_timer_queue(1000 / TICK_RATE);
@@ -39,12 +48,34 @@ int pit_init(uint32_t freq)
         handler_registered = 1;
     }
     if (!(freq)) {
+        RESTORE_INTERRUPT_STATE;
         return -1;
     }
-    uint32_t div = 1193180 / freq;
+    uint32_t div = PIT_FREQUENCY / freq;
     io_outb(PIT_CMND, 0x36);
     io_outb(PIT_DATA, ((uint8_t)(div & 0xff)));
     io_outb(PIT_DATA, ((uint8_t)((div >> 8) & 0xff)));
     RESTORE_INTERRUPT_STATE;
     return 0;
 }
+
+void pit_delay(uint32_t usec)
+{
+    /* Channel 2 is used so the tick on channel 0 carries on. Its gate is in the speaker control port, and in mode 0 its
+     * output goes high when the count runs out, which is read back from the same port.
+     */
+    const uint8_t gate = io_inb(PIT_GATE);
+    while (usec > 0) {
+        const uint32_t chunk = MIN(usec, PIT_DELAY_MAX);
+        const uint32_t count = MAX(chunk*(PIT_FREQUENCY/1000)/1000, 1);
+        io_outb(PIT_GATE, (gate & ~PIT_GATE_SPEAKER) | PIT_GATE_ENABLE);
+        io_outb(PIT_CMND, PIT_ONESHOT_2);
+        io_outb(PIT_DATA_2, (uint8_t)(count & 0xFF));
+        io_outb(PIT_DATA_2, (uint8_t)((count >> 8) & 0xFF));
+        while (!(TEST_FLAG(io_inb(PIT_GATE), PIT_GATE_OUT))) {
+            asm volatile("pause");
+        }
+        usec -= chunk;
+    }
+    io_outb(PIT_GATE, gate);
+}
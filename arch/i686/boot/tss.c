@@ -20,8 +20,15 @@
  */
 #include <libk/kstring.h>
 #include <libk/kmemory.h>
+#include <redshift/boot/gdt.h>
 #include <redshift/boot/tss.h>
+#include <redshift/hal/smp.h>
 #include <redshift/kernel.h>
+#include <redshift/mem/paging.h>
+
+enum {
+    DOUBLE_FAULT_STACK_SIZE = 0x1000 /* Size of each CPU's double-fault stack. */
+};
 
 static struct tss {
    uint32_t reserved;
@@ -51,14 +58,51 @@ static struct tss {
    uint32_t ldt;
    uint16_t trap;
    uint16_t iobt;
-} __packed tss;
+} __packed tss[SMP_CPUS_MAX], double_fault_tss[SMP_CPUS_MAX];
+
+/* Double faults are handled on a task with its own stack, so that they're still caught when the fault was a push off
+ * the bottom of the kernel stack. */
+static uint8_t double_fault_stacks[SMP_CPUS_MAX][DOUBLE_FAULT_STACK_SIZE] __aligned(16);
+
+extern void double_fault_task(void); /* isr_irq_stub.S */
+
+/* Read CR3. */
+static uint32_t get_cr3(void)
+{
+    uint32_t cr3;
+    asm volatile("mov %%cr3, %0":"=r"(cr3));
+    return cr3;
+}
 
 void tss_init(void)
 {
     kmemory_fill8(&tss, 0, sizeof(tss));
-    tss.esp0 = (uint32_t)__stack_top__;
-    tss.ss0  = 0x10;
-    tss.iobt = sizeof(tss);
+    kmemory_fill8(&double_fault_tss, 0, sizeof(double_fault_tss));
+    for (unsigned cpu = 0; cpu < SMP_CPUS_MAX; ++cpu) {
+        tss[cpu].esp0 = (uint32_t)__stack_top__;
+        tss[cpu].ss0  = 0x10;
+        tss[cpu].iobt = sizeof(*tss);
+        struct tss* task = &(double_fault_tss[cpu]);
+        task->cr3    = get_cr3();
+        task->eip    = (uint32_t)double_fault_task;
+        task->eflags = 0x02;
+        task->esp    = (uint32_t)&(double_fault_stacks[cpu][DOUBLE_FAULT_STACK_SIZE]);
+        task->cs     = 0x08;
+        task->ss     = 0x10;
+        task->ds     = 0x10;
+        task->es     = 0x10;
+        task->fs     = 0x10;
+        task->gs     = CPU_LOCAL_SELECTOR;
+        task->iobt   = sizeof(*task);
+    }
+}
+
+void tss_init_double_fault(void)
+{
+    const uint32_t cr3 = get_cr3();
+    for (unsigned cpu = 0; cpu < SMP_CPUS_MAX; ++cpu) {
+        double_fault_tss[cpu].cr3 = cr3;
+    }
 }
 
 extern void loadtss(void); /* loadtss.asm */
@@ -70,12 +114,36 @@ void tss_load(void)
     RESTORE_INTERRUPT_STATE;
 }
 
-uint32_t get_tss_base(void)
+uint32_t get_tss_base(unsigned cpu)
 {
-    return (uint32_t)&tss;
+    return (uint32_t)&(tss[cpu]);
+}
+
+uint32_t get_double_fault_tss_base(unsigned cpu)
+{
+    return (uint32_t)&(double_fault_tss[cpu]);
 }
 
 size_t get_tss_size(void)
 {
-    return sizeof(tss);
+    return sizeof(*tss);
+}
+
+void tss_set_kernel_stack(uintptr_t esp0)
+{
+    tss[smp_cpu_index()].esp0 = (uint32_t)esp0;
+}
+
+void double_fault_handler(void)
+{
+    /* The task switch saved the faulting state in the CPU's own TSS. CR2 is still set if the double fault came from a
+     * page fault, and a guard page there means the kernel stack overflowed.
+     */
+    uintptr_t address = 0;
+    asm volatile("mov %%cr2, %0":"=r"(address));
+    const uint32_t eip = tss[smp_cpu_index()].eip;
+    if (page_is_guard(address)) {
+        panic("stack overflow: <address=0x%08lX,eip=0x%08lX>", address, eip);
+    }
+    panic("double fault: <address=0x%08lX,eip=0x%08lX>", address, eip);
 }
@@ -0,0 +1,304 @@
+/**
+ * \file hal/acpi.c
+ * ACPI table parsing.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <redshift/boot/multiboot2.h>
+#include <redshift/hal/memory.h>
+#include <libk/kmemory.h>
+#include <redshift/boot/multiboot2.h>
+#include <redshift/hal/acpi.h>
+#include <redshift/hal/smp.h>
+#include <redshift/kernel.h>
+
+enum {
+    BIOS_AREA_START    = 0xE0000,  /* Start of the BIOS area which is searched for the RSDP. */
+    BIOS_AREA_END      = 0x100000, /* End of the BIOS area.                                   */
+    RSDP_ALIGN         = 16,       /* Alignment of the RSDP in the BIOS area.                 */
+    RSDP_V1_SIZE       = 20,       /* Size of the ACPI 1.0 RSDP, which its checksum covers.   */
+    MADT_LAPIC         = 0,        /* MADT entry: processor local APIC.                       */
+    MADT_IOAPIC        = 1,        /* MADT entry: I/O APIC.                                   */
+    MADT_OVERRIDE      = 2,        /* MADT entry: interrupt source override.                  */
+    MADT_LAPIC_ENABLED = 1 << 0,   /* Local APIC flag: the processor can be used.             */
+    MPS_POLARITY_MASK  = 0x3,      /* Override flags: polarity.                               */
+    MPS_POLARITY_LOW   = 0x3,      /* Override flags: active low.                             */
+    MPS_TRIGGER_MASK   = 0xC,      /* Override flags: trigger mode.                           */
+    MPS_TRIGGER_LEVEL  = 0xC       /* Override flags: level-triggered.                        */
+};
+
+/* Root system description pointer. The fields from length on are only there from ACPI 2.0 (revision 2). */
+struct rsdp {
+    char     signature[8];
+    uint8_t  checksum;
+    char     oem_id[6];
+    uint8_t  revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t  extended_checksum;
+    uint8_t  reserved[3];
+} __packed;
+
+/* Header common to every system description table. */
+struct sdt_header {
+    char     signature[4];
+    uint32_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[6];
+    char     oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __packed;
+
+/* Multiple APIC description table. It's followed by variable-length entries which start with a type and a length. */
+struct madt {
+    struct sdt_header header;
+    uint32_t          lapic_address;
+    uint32_t          flags;
+} __packed;
+
+struct madt_entry {
+    uint8_t type;
+    uint8_t length;
+} __packed;
+
+struct madt_lapic {
+    struct madt_entry entry;
+    uint8_t           processor_id;
+    uint8_t           apic_id;
+    uint32_t          flags;
+} __packed;
+
+struct madt_ioapic {
+    struct madt_entry entry;
+    uint8_t           ioapic_id;
+    uint8_t           reserved;
+    uint32_t          address;
+    uint32_t          gsi_base;
+} __packed;
+
+struct madt_override {
+    struct madt_entry entry;
+    uint8_t           bus;
+    uint8_t           source;
+    uint32_t          gsi;
+    uint16_t          flags;
+} __packed;
+
+/* ISA IRQ redirected by an interrupt source override. */
+struct isa_irq {
+    uint32_t         input; /* I/O APIC input. */
+    acpi_irq_flags_t flags; /* Polarity and trigger mode. */
+};
+
+static struct acpi {
+    uint32_t       lapic_address;
+    uint32_t       ioapic_address;
+    uint32_t       ioapic_gsi_base;
+    uint8_t        cpu_apic_ids[SMP_CPUS_MAX];
+    size_t         cpu_count;
+    struct isa_irq isa_irqs[ACPI_ISA_IRQS];
+} acpi;
+
+/* Test whether the bytes of a table add up to zero, as they have to. */
+static bool checksum_ok(const void* table, size_t size)
+{
+    uint8_t sum = 0;
+    for (size_t i = 0; i < size; ++i) {
+        sum += ((const uint8_t*)table)[i];
+    }
+    return sum == 0;
+}
+
+/* Find the RSDP, first in the multiboot2 tags and then in the BIOS area. */
+static const struct rsdp* __init_text find_rsdp(struct multiboot2_tag* mb_tags)
+{
+    const struct rsdp* rsdp = NULL;
+    for (struct multiboot2_tag* tag = (struct multiboot2_tag*)((uint8_t*)mb_tags + 8);
+         tag->type != MULTIBOOT2_TAG_TYPE_END;
+         tag = (struct multiboot2_tag*)((uint8_t*)tag + ((tag->size + 7) & ~7))) {
+        switch (tag->type) {
+            case MULTIBOOT2_TAG_TYPE_ACPI_NEW:
+                /* Prefer the ACPI 2.0 RSDP, which has the XSDT.
+                 */
+                return (const struct rsdp*)((struct multiboot2_tag_acpi*)tag)->rsdp;
+            case MULTIBOOT2_TAG_TYPE_ACPI_OLD:
+                rsdp = (const struct rsdp*)((struct multiboot2_tag_acpi*)tag)->rsdp;
+                break;
+            default:
+                break;
+        }
+    }
+    if (rsdp != NULL) {
+        return rsdp;
+    }
+    for (uintptr_t address = BIOS_AREA_START; address < BIOS_AREA_END; address += RSDP_ALIGN) {
+        rsdp = (const struct rsdp*)address;
+        if (kmemory_compare(rsdp->signature, "RSD PTR ", sizeof(rsdp->signature)) == 0 &&
+            checksum_ok(rsdp, RSDP_V1_SIZE)) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+/* Find a table by its signature through the XSDT if there is one, otherwise the RSDT. */
+static const struct sdt_header* __init_text find_table(const struct rsdp* rsdp, const char* signature)
+{
+    const bool     xsdt    = rsdp->revision >= 2 && rsdp->xsdt_address != 0 && rsdp->xsdt_address < UINTPTR_MAX;
+    const uint64_t address = xsdt ? rsdp->xsdt_address : rsdp->rsdt_address;
+    const size_t   stride  = xsdt ? sizeof(uint64_t) : sizeof(uint32_t);
+    const struct sdt_header* root = (const struct sdt_header*)(uintptr_t)address;
+    if (!(checksum_ok(root, root->length))) {
+        printk(PRINTK_WARNING "ACPI: bad %s checksum\n", xsdt ? "XSDT" : "RSDT");
+        return NULL;
+    }
+    const uint8_t* entries = (const uint8_t*)(root + 1);
+    const size_t   count   = (root->length - sizeof(*root))/stride;
+    for (size_t i = 0; i < count; ++i) {
+        const uint64_t entry = xsdt ? ((const uint64_t*)entries)[i] : ((const uint32_t*)entries)[i];
+        if (entry == 0 || entry >= UINTPTR_MAX) {
+            continue;
+        }
+        const struct sdt_header* table = (const struct sdt_header*)(uintptr_t)entry;
+        if (kmemory_compare(table->signature, signature, sizeof(table->signature)) == 0 &&
+            checksum_ok(table, table->length)) {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+/* Read the local APICs, the first I/O APIC and the ISA interrupt overrides from the MADT. */
+static void __init_text parse_madt(const struct madt* madt)
+{
+    acpi.lapic_address = madt->lapic_address;
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    for (const uint8_t* p = (const uint8_t*)(madt + 1); p < end; p += ((const struct madt_entry*)p)->length) {
+        const struct madt_entry* entry = (const struct madt_entry*)p;
+        if (entry->length == 0) {
+            break;
+        }
+        switch (entry->type) {
+            case MADT_LAPIC: {
+                const struct madt_lapic* lapic = (const struct madt_lapic*)entry;
+                if (!(TEST_FLAG(lapic->flags, MADT_LAPIC_ENABLED))) {
+                    break;
+                }
+                if (acpi.cpu_count == SMP_CPUS_MAX) {
+                    printk(PRINTK_WARNING "ACPI: ignoring CPU with APIC ID %u\n", lapic->apic_id);
+                    break;
+                }
+                acpi.cpu_apic_ids[acpi.cpu_count++] = lapic->apic_id;
+                break;
+            }
+            case MADT_IOAPIC: {
+                const struct madt_ioapic* ioapic = (const struct madt_ioapic*)entry;
+                if (acpi.ioapic_address == 0) {
+                    acpi.ioapic_address  = ioapic->address;
+                    acpi.ioapic_gsi_base = ioapic->gsi_base;
+                }
+                break;
+            }
+            case MADT_OVERRIDE: {
+                const struct madt_override* override = (const struct madt_override*)entry;
+                if (override->bus != 0 || override->source >= ACPI_ISA_IRQS) {
+                    break;
+                }
+                struct isa_irq* irq = &(acpi.isa_irqs[override->source]);
+                irq->input = override->gsi;
+                irq->flags = 0;
+                irq->flags |= (override->flags & MPS_POLARITY_MASK) == MPS_POLARITY_LOW ? ACPI_IRQ_ACTIVE_LOW : 0;
+                irq->flags |= (override->flags & MPS_TRIGGER_MASK) == MPS_TRIGGER_LEVEL ? ACPI_IRQ_LEVEL      : 0;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+void __init_text acpi_init(struct multiboot2_tag* mb_tags)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(mb_tags != NULL);
+    /* ISA IRQs are identity mapped onto the I/O APIC's inputs unless an override says otherwise, and are active high
+     * and edge-triggered.
+     */
+    for (uint8_t i = 0; i < ACPI_ISA_IRQS; ++i) {
+        acpi.isa_irqs[i].input = i;
+        acpi.isa_irqs[i].flags = 0;
+    }
+    const struct rsdp* rsdp = find_rsdp(mb_tags);
+    if (rsdp == NULL) {
+        printk(PRINTK_DEBUG "ACPI: no RSDP\n");
+        RESTORE_INTERRUPT_STATE;
+        return;
+    }
+    const struct madt* madt = (const struct madt*)find_table(rsdp, "APIC");
+    if (madt == NULL) {
+        printk(PRINTK_DEBUG "ACPI: no MADT\n");
+        RESTORE_INTERRUPT_STATE;
+        return;
+    }
+    parse_madt(madt);
+    printk(
+        PRINTK_DEBUG "ACPI: <revision=%u,cpus=%lu,lapic=0x%08lX,ioapic=0x%08lX>\n",
+        rsdp->revision,
+        acpi.cpu_count,
+        acpi.lapic_address,
+        acpi.ioapic_address
+    );
+    RESTORE_INTERRUPT_STATE;
+}
+
+uint32_t acpi_get_lapic_address(void)
+{
+    return acpi.lapic_address;
+}
+
+uint32_t acpi_get_ioapic_address(void)
+{
+    return acpi.ioapic_address;
+}
+
+size_t acpi_get_cpu_count(void)
+{
+    return acpi.cpu_count;
+}
+
+uint8_t acpi_get_cpu_apic_id(size_t i)
+{
+    DEBUG_ASSERT(i < acpi.cpu_count);
+    return acpi.cpu_apic_ids[i];
+}
+
+uint32_t acpi_get_isa_irq_input(uint8_t irq, acpi_irq_flags_t* flags)
+{
+    DEBUG_ASSERT(irq < ACPI_ISA_IRQS);
+    *flags = acpi.isa_irqs[irq].flags;
+    return acpi.isa_irqs[irq].input - acpi.ioapic_gsi_base;
+}
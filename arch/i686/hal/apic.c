@@ -0,0 +1,221 @@
+/**
+ * \file hal/apic.c
+ * Local and I/O APICs.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <redshift/boot/multiboot2.h>
+#include <redshift/hal/memory.h>
+#include <redshift/boot/pit.h>
+#include <redshift/hal/acpi.h>
+#include <redshift/hal/apic.h>
+#include <redshift/hal/cpu.h>
+#include <redshift/kernel.h>
+#include <redshift/kernel/interrupt.h>
+#include <redshift/mem/paging.h>
+
+enum {
+    MSR_APIC_BASE       = 0x1B,     /* APIC base address MSR.                                     */
+    APIC_BASE_ENABLE    = 1 << 11,  /* MSR_APIC_BASE: the local APIC is enabled.                  */
+    LAPIC_ID            = 0x020,    /* Local APIC ID register.                                    */
+    LAPIC_TPR           = 0x080,    /* Task priority register.                                    */
+    LAPIC_EOI           = 0x0B0,    /* End of interrupt register.                                 */
+    LAPIC_SVR           = 0x0F0,    /* Spurious interrupt vector register.                        */
+    LAPIC_ICR_LOW       = 0x300,    /* Interrupt command register, low half.                      */
+    LAPIC_ICR_HIGH      = 0x310,    /* Interrupt command register, high half (destination).       */
+    LAPIC_LVT_TIMER     = 0x320,    /* Local vector table entry for the timer.                    */
+    LAPIC_TIMER_INITIAL = 0x380,    /* Timer initial count register.                              */
+    LAPIC_TIMER_CURRENT = 0x390,    /* Timer current count register.                              */
+    LAPIC_TIMER_DIVIDE  = 0x3E0,    /* Timer divide configuration register.                       */
+    SVR_ENABLE          = 1 << 8,   /* LAPIC_SVR: software enable.                                */
+    ICR_INIT            = 0x5 << 8, /* LAPIC_ICR_LOW: INIT delivery mode.                         */
+    ICR_STARTUP         = 0x6 << 8, /* LAPIC_ICR_LOW: startup delivery mode.                      */
+    ICR_PENDING         = 1 << 12,  /* LAPIC_ICR_LOW: the last IPI hasn't been delivered yet.     */
+    ICR_ASSERT          = 1 << 14,  /* LAPIC_ICR_LOW: level assert.                               */
+    LVT_MASKED          = 1 << 16,  /* Local vector table entry is masked.                        */
+    LVT_TIMER_PERIODIC  = 1 << 17,  /* LAPIC_LVT_TIMER: reload the count when it runs out.        */
+    TIMER_DIVIDE_16     = 0x3,      /* LAPIC_TIMER_DIVIDE: count at a sixteenth of the bus clock. */
+    CALIBRATE_MSEC      = 10,       /* Time the timer is counted against the PIT for.             */
+    IOAPIC_SELECT       = 0,        /* I/O APIC register select, as a word index.                 */
+    IOAPIC_WINDOW       = 4,        /* I/O APIC register window, as a word index.                 */
+    IOAPIC_VERSION      = 0x01,     /* I/O APIC version register, which has the input count.      */
+    IOAPIC_REDIRECTION  = 0x10,     /* First I/O APIC redirection register (two per input).       */
+    REDIRECT_ACTIVE_LOW = 1 << 13,  /* Redirection entry: the input is active low.                */
+    REDIRECT_LEVEL      = 1 << 15,  /* Redirection entry: the input is level-triggered.           */
+    REDIRECT_MASKED     = 1 << 16,  /* Redirection entry: the input is masked.                    */
+    ISA_CASCADE_IRQ     = 2         /* ISA IRQ of the PICs' cascade, which never fires.           */
+};
+
+static volatile uint32_t* lapic;  /* Local APIC registers. Every CPU sees its own at the same address. */
+static volatile uint32_t* ioapic; /* I/O APIC registers.                                              */
+static uint32_t           timer_ticks_per_msec;
+
+/* Read a local APIC register. */
+static uint32_t lapic_read(uint32_t reg)
+{
+    return lapic[reg/sizeof(*lapic)];
+}
+
+/* Write a local APIC register. */
+static void lapic_write(uint32_t reg, uint32_t value)
+{
+    lapic[reg/sizeof(*lapic)] = value;
+}
+
+/* Write an I/O APIC register. */
+static void ioapic_write(uint8_t reg, uint32_t value)
+{
+    ioapic[IOAPIC_SELECT] = reg;
+    ioapic[IOAPIC_WINDOW] = value;
+}
+
+/* Read an I/O APIC register. */
+static uint32_t ioapic_read(uint8_t reg)
+{
+    ioapic[IOAPIC_SELECT] = reg;
+    return ioapic[IOAPIC_WINDOW];
+}
+
+/* Map a page of device registers at its physical address. */
+static volatile uint32_t* map_registers(uint32_t physical_address)
+{
+    map_range(kernel_directory, physical_address, physical_address, PAGE_SIZE,
+              kernel_page_flags(PAGE_FLAGS_PRESENT | PAGE_FLAGS_WRITEABLE | PAGE_FLAGS_UNCACHED));
+    return (volatile uint32_t*)physical_address;
+}
+
+/* Count the local APIC timer against the PIT to find how fast it runs. The bus clock it's driven by is the same for
+ * every CPU, so this only needs doing once.
+ */
+static void lapic_timer_calibrate(void)
+{
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_TIMER_INITIAL, UINT32_MAX);
+    pit_delay(CALIBRATE_MSEC*1000);
+    const uint32_t elapsed = UINT32_MAX - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    timer_ticks_per_msec = elapsed/CALIBRATE_MSEC;
+}
+
+/* Route the ISA IRQs which the PICs had unmasked to the boot CPU, on the same vectors as before. */
+static void ioapic_route_isa_irqs(uint16_t pic_mask)
+{
+    const uint32_t inputs  = ((ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+    const uint32_t apic_id = lapic_get_id();
+    for (uint8_t irq = 0; irq < ACPI_ISA_IRQS; ++irq) {
+        if (irq == ISA_CASCADE_IRQ) {
+            continue;
+        }
+        acpi_irq_flags_t flags;
+        const uint32_t   input = acpi_get_isa_irq_input(irq, &flags);
+        if (input >= inputs) {
+            continue;
+        }
+        uint32_t entry = IRQ0 + irq;
+        entry |= TEST_FLAG(flags, ACPI_IRQ_ACTIVE_LOW) ? REDIRECT_ACTIVE_LOW : 0;
+        entry |= TEST_FLAG(flags, ACPI_IRQ_LEVEL)      ? REDIRECT_LEVEL      : 0;
+        entry |= TEST_BIT(pic_mask, irq)               ? REDIRECT_MASKED     : 0;
+        ioapic_write(IOAPIC_REDIRECTION + 2*input + 1, apic_id << 24);
+        ioapic_write(IOAPIC_REDIRECTION + 2*input,     entry);
+    }
+}
+
+bool apic_init(void)
+{
+    SAVE_INTERRUPT_STATE;
+    if (!(cpu_has_feature(CPU_FEATURE_APIC)) || acpi_get_lapic_address() == 0 || acpi_get_ioapic_address() == 0) {
+        RESTORE_INTERRUPT_STATE;
+        return false;
+    }
+    write_msr(MSR_APIC_BASE, read_msr(MSR_APIC_BASE) | APIC_BASE_ENABLE);
+    lapic  = map_registers(acpi_get_lapic_address());
+    ioapic = map_registers(acpi_get_ioapic_address());
+    lapic_enable();
+    lapic_timer_calibrate();
+    /* Take over the IRQs the PICs were passing on, then mask every PIC input so nothing arrives twice.
+     */
+    const uint16_t pic_mask = io_inb(PIC_MASTER_DATA) | (io_inb(PIC_SLAVE_DATA) << 8);
+    io_outb(PIC_MASTER_DATA, 0xFF);
+    io_outb(PIC_SLAVE_DATA,  0xFF);
+    ioapic_route_isa_irqs(pic_mask);
+    printk(PRINTK_DEBUG "APIC: <lapic_id=%u,timer=%lu/ms>\n", lapic_get_id(), timer_ticks_per_msec);
+    RESTORE_INTERRUPT_STATE;
+    return true;
+}
+
+bool apic_enabled(void)
+{
+    return lapic != NULL;
+}
+
+void lapic_enable(void)
+{
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, SVR_ENABLE | IRQ_SPURIOUS);
+}
+
+uint8_t lapic_get_id(void)
+{
+    return (uint8_t)(lapic_read(LAPIC_ID) >> 24);
+}
+
+void lapic_eoi(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_timer_start(uint32_t msec)
+{
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, IRQ_LAPIC_TIMER | LVT_TIMER_PERIODIC);
+    lapic_write(LAPIC_TIMER_INITIAL, timer_ticks_per_msec*msec);
+}
+
+/* Send an IPI once the previous one has been delivered. */
+static void lapic_send(uint8_t apic_id, uint32_t command)
+{
+    SAVE_INTERRUPT_STATE;
+    while (TEST_FLAG(lapic_read(LAPIC_ICR_LOW), ICR_PENDING)) {
+        asm volatile("pause");
+    }
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW,  command);
+    RESTORE_INTERRUPT_STATE;
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector)
+{
+    lapic_send(apic_id, ICR_ASSERT | vector);
+}
+
+void lapic_send_init(uint8_t apic_id)
+{
+    lapic_send(apic_id, ICR_ASSERT | ICR_INIT);
+}
+
+void lapic_send_startup(uint8_t apic_id, uintptr_t address)
+{
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(address) && address < 0x100000);
+    lapic_send(apic_id, ICR_ASSERT | ICR_STARTUP | (address/PAGE_SIZE));
+}
@@ -24,6 +24,7 @@
  */
 #include <redshift/kernel.h>
 #include <redshift/hal/cpu/cpuid.h>
+#include <redshift/hal/cpu/fpu.h>
 
 static struct cpu {
     struct cpuid info;
@@ -32,6 +33,7 @@ static struct cpu {
 void cpu_init(void)
 {
     cpuid_init(&(__cpu__.info));
+    fpu_init();
 }
 
 bool cpu_has_feature(cpu_feature_t feature)
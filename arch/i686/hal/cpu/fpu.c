@@ -0,0 +1,190 @@
+/**
+ * \file hal/cpu/fpu.c
+ * Lazy FPU state switching.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <redshift/hal/cpu.h>
+#include <redshift/hal/cpu/fpu.h>
+#include <redshift/hal/smp.h>
+#include <redshift/kernel.h>
+#include <redshift/kernel/interrupt.h>
+#include <redshift/kernel/kmalloc.h>
+
+enum {
+    CR0_MP         = 1 << 1,  /* WAIT/FWAIT trap as well when TS is set.                        */
+    CR0_EM         = 1 << 2,  /* Emulate the FPU: every FPU instruction traps.                  */
+    CR0_TS         = 1 << 3,  /* Task switched: the next FPU instruction traps.                 */
+    CR0_NE         = 1 << 5,  /* Report FPU errors with exception 16 rather than an IRQ.        */
+    CR4_OSFXSR     = 1 << 9,  /* The OS uses FXSAVE/FXRSTOR, which also enables SSE.           */
+    CR4_OSXMMEXCPT = 1 << 10  /* The OS handles SIMD floating-point exceptions.                 */
+};
+
+/* Whether the CPU has FXSAVE/FXRSTOR. */
+static bool fxsr;
+
+/* FPU state a process starts with, saved just after FNINIT. */
+static struct fpu_state initial_state;
+
+/* Lazy switching state of each CPU's FPU. */
+struct fpu_cpu {
+    struct fpu_state   boot_state;    /* State of the CPU's boot thread, which owns the FPU until a process uses it. */
+    struct fpu_state*  boot_slot;     /* Slot holding boot_state.                                                    */
+    struct fpu_state** current_slot;  /* FPU state slot of the running process.                                     */
+    struct fpu_state*  owner;         /* The state whose registers are loaded in the FPU, or NULL.                  */
+    bool               task_switched; /* Whether CR0.TS is set. Kept here so switching doesn't have to read CR0.    */
+};
+
+static struct fpu_cpu fpu_cpus[SMP_CPUS_MAX];
+
+/* Get the current CPU's FPU state. */
+static struct fpu_cpu* this_fpu(void)
+{
+    return &(fpu_cpus[smp_cpu_index()]);
+}
+
+/* Save the FPU registers. */
+static void fpu_save(struct fpu_state* state)
+{
+    if (fxsr) {
+        asm volatile("fxsave %0":"=m"(*state));
+    } else {
+        asm volatile("fnsave %0; fwait":"=m"(*state));
+    }
+}
+
+/* Load the FPU registers. */
+static void fpu_restore(const struct fpu_state* state)
+{
+    if (fxsr) {
+        asm volatile("fxrstor %0"::"m"(*state));
+    } else {
+        asm volatile("frstor %0"::"m"(*state));
+    }
+}
+
+/* Set or clear CR0.TS. */
+static void set_task_switched(struct fpu_cpu* fpu, bool set)
+{
+    if (set == fpu->task_switched) {
+        return;
+    }
+    if (set) {
+        uint32_t cr0;
+        asm volatile("mov %%cr0, %0":"=r"(cr0));
+        asm volatile("mov %0, %%cr0"::"r"(cr0 | CR0_TS));
+    } else {
+        asm volatile("clts");
+    }
+    fpu->task_switched = set;
+}
+
+/* The running process used the FPU after a switch: save the previous owner's registers and load its own. */
+static void device_not_available_handler(const struct cpu_state* regs)
+{
+    UNUSED(regs);
+    struct fpu_cpu* fpu = this_fpu();
+    set_task_switched(fpu, false);
+    struct fpu_state* state = *(fpu->current_slot);
+    if (state != NULL && state == fpu->owner) {
+        return;
+    }
+    if (fpu->owner != NULL) {
+        fpu_save(fpu->owner);
+    }
+    if (state == NULL) {
+        /* First use: the process gets a clean FPU, and somewhere to save it.
+         */
+        state = kmalloc_aligned(sizeof(*state), FPU_STATE_ALIGN);
+        if (state == NULL) {
+            panic("%s: failed to allocate FPU state", __func__);
+        }
+        *(fpu->current_slot) = state;
+        fpu_restore(&initial_state);
+    } else {
+        fpu_restore(state);
+    }
+    fpu->owner = state;
+}
+
+/* Enable the current CPU's FPU, and SSE if the CPU has it, and give it to the CPU's boot thread. */
+static void fpu_enable(void)
+{
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0":"=r"(cr0));
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    asm volatile("mov %0, %%cr0"::"r"(cr0));
+    if (fxsr) {
+        uint32_t cr4;
+        asm volatile("mov %%cr4, %0":"=r"(cr4));
+        cr4 |= CR4_OSFXSR;
+        if (cpu_has_feature(CPU_FEATURE_SSE)) {
+            cr4 |= CR4_OSXMMEXCPT;
+        }
+        asm volatile("mov %0, %%cr4"::"r"(cr4));
+    }
+    asm volatile("fninit");
+    struct fpu_cpu* fpu = this_fpu();
+    fpu->boot_slot     = &(fpu->boot_state);
+    fpu->current_slot  = &(fpu->boot_slot);
+    fpu->owner         = &(fpu->boot_state);
+    fpu->task_switched = false;
+}
+
+void fpu_init(void)
+{
+    SAVE_INTERRUPT_STATE;
+    fxsr = cpu_has_feature(CPU_FEATURE_FXSR);
+    fpu_enable();
+    fpu_save(&initial_state);
+    fpu_restore(&initial_state);
+    set_interrupt_handler(ISR_DEVICE_NOT_AVAILABLE, &device_not_available_handler);
+    printk(PRINTK_DEBUG "FPU: <fxsr=%d,sse=%d>\n", fxsr, cpu_has_feature(CPU_FEATURE_SSE));
+    RESTORE_INTERRUPT_STATE;
+}
+
+void fpu_init_ap(void)
+{
+    SAVE_INTERRUPT_STATE;
+    fpu_enable();
+    RESTORE_INTERRUPT_STATE;
+}
+
+void fpu_switch(struct fpu_state** state)
+{
+    struct fpu_cpu* fpu = this_fpu();
+    fpu->current_slot = state;
+    set_task_switched(fpu, *state == NULL || *state != fpu->owner);
+}
+
+bool fpu_loaded(const struct fpu_state* state)
+{
+    if (state == NULL) {
+        return false;
+    }
+    for (unsigned cpu = 0; cpu < SMP_CPUS_MAX; ++cpu) {
+        if (fpu_cpus[cpu].owner == state) {
+            return true;
+        }
+    }
+    return false;
+}
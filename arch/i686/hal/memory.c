@@ -36,7 +36,7 @@ static struct memory {
     size_t             size_map;
 } memory;
 
-void memory_init(struct multiboot2_tag* mb_tags)
+void __init_text memory_init(struct multiboot2_tag* mb_tags)
 {
     SAVE_INTERRUPT_STATE;
     DEBUG_ASSERT(mb_tags != NULL);
@@ -69,7 +69,7 @@ void memory_init(struct multiboot2_tag* mb_tags)
     RESTORE_INTERRUPT_STATE;
 }
 
-void memory_map_init(struct multiboot2_tag* mb_tags)
+void __init_text memory_map_init(struct multiboot2_tag* mb_tags)
 {
     SAVE_INTERRUPT_STATE;
     DEBUG_ASSERT(mb_tags != NULL);
@@ -156,3 +156,14 @@ size_t memory_size_total(void)
 {
     return memory.size_lower + memory.size_upper;
 }
+
+uint64_t memory_size_available(void)
+{
+    uint64_t size = 0;
+    for (const struct memory_map* region = memory.map; region != NULL; region = region->next) {
+        if (region->type == MEMORY_TYPE_AVAILABLE) {
+            size += region->end - region->start + 1;
+        }
+    }
+    return size;
+}
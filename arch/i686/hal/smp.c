@@ -0,0 +1,212 @@
+/**
+ * \file hal/smp.c
+ * Multiprocessor support.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <libk/kmemory.h>
+#include <redshift/boot/gdt.h>
+#include <redshift/boot/idt.h>
+#include <redshift/boot/pit.h>
+#include <redshift/boot/sched.h>
+#include <redshift/boot/tss.h>
+#include <redshift/hal/acpi.h>
+#include <redshift/hal/apic.h>
+#include <redshift/hal/cpu/fpu.h>
+#include <redshift/hal/smp.h>
+#include <redshift/kernel.h>
+#include <redshift/kernel/interrupt.h>
+#include <redshift/mem/paging.h>
+#include <redshift/mem/stack.h>
+#include <redshift/sched/idle.h>
+#include <redshift/sched/process.h>
+
+enum {
+    INIT_DELAY    = 10000, /* Microseconds to wait after INIT before sending STARTUP.          */
+    STARTUP_DELAY = 200,   /* Microseconds to wait after each STARTUP.                         */
+    START_TIMEOUT = 1000   /* Milliseconds to wait for a processor to come up before giving up. */
+};
+
+/* Parameters at the end of the trampoline (boot/ap_trampoline.S), filled in for each processor. */
+struct trampoline_params {
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t gdt;
+    uint32_t stack;
+    uint32_t entry;
+};
+
+extern const uint8_t ap_trampoline[];        /* boot/ap_trampoline.S */
+extern const uint8_t ap_trampoline_params[]; /* boot/ap_trampoline.S */
+extern const uint8_t ap_trampoline_end[];    /* boot/ap_trampoline.S */
+
+static struct cpu_local  cpu_locals[SMP_CPUS_MAX];
+static bool              started;    /* Whether GS is loaded with the CPU's cpu_local segment.   */
+static volatile unsigned online = 1; /* Number of CPUs which are running.                         */
+
+/* Preempt the current process from the local APIC timer or a reschedule IPI. */
+static void reschedule_handler(const struct cpu_state* regs)
+{
+    UNUSED(regs);
+    process_switch();
+}
+
+/* Flush the TLB when another CPU asks, which it acknowledges by waiting for tlb_seen to catch up. */
+static void tlb_flush_handler(const struct cpu_state* regs)
+{
+    UNUSED(regs);
+    page_tlb_sync();
+}
+
+/* Entered from the trampoline on each application processor, with paging enabled and its own GDT and stack. */
+static void __noreturn ap_main(void)
+{
+    idt_load();
+    tss_load();
+    lapic_enable();
+    paging_init_ap();
+    fpu_init_ap();
+    const unsigned cpu = smp_cpu_index();
+    int idle_id = process_spawn(
+        (uintptr_t)idle,
+        kernel_directory,
+        PROCESS_PRIORITY_MIN,
+        0,
+        STACK_SIZE,
+        PROCESS_FLAGS_SUPERVISOR | PROCESS_FLAGS_PINNED
+    );
+    if (idle_id < 0) {
+        panic("unable to spawn idle process for CPU %u", cpu);
+    }
+    __atomic_add_fetch(&online, 1, __ATOMIC_RELEASE);
+    lapic_timer_start(SCHED_PERIOD);
+    /* Like the boot CPU's boot thread, this one is abandoned once the first process runs.
+     */
+    process_switch();
+    UNREACHABLE("%s should not return!", __func__);
+}
+
+/* Start an application processor and wait for it to come up. Returns false if it doesn't. */
+static bool __init_text start_cpu(struct trampoline_params* params, unsigned cpu, uint8_t apic_id)
+{
+    cpu_locals[cpu].index   = cpu;
+    cpu_locals[cpu].apic_id = apic_id;
+    uint8_t* stack = stack_alloc(STACK_SIZE);
+    if (stack == NULL) {
+        return false;
+    }
+    params->stack = (uint32_t)stack + STACK_SIZE;
+    params->gdt   = gdt_get_pointer(cpu);
+    /* INIT, then STARTUP twice as the MultiProcessor Specification says.
+     */
+    lapic_send_init(apic_id);
+    pit_delay(INIT_DELAY);
+    lapic_send_startup(apic_id, AP_TRAMPOLINE_ADDRESS);
+    pit_delay(STARTUP_DELAY);
+    lapic_send_startup(apic_id, AP_TRAMPOLINE_ADDRESS);
+    for (unsigned msec = 0; msec < START_TIMEOUT; ++msec) {
+        if (__atomic_load_n(&online, __ATOMIC_ACQUIRE) > cpu) {
+            return true;
+        }
+        pit_delay(1000);
+    }
+    return false;
+}
+
+void __init_text smp_init(void)
+{
+    if (!(apic_init())) {
+        printk(PRINTK_WARNING "SMP: no APIC, running on the boot CPU only\n");
+        return;
+    }
+    set_interrupt_handler(IRQ_LAPIC_TIMER, &reschedule_handler);
+    set_interrupt_handler(IRQ_RESCHEDULE,  &reschedule_handler);
+    set_interrupt_handler(IRQ_TLB_FLUSH,   &tlb_flush_handler);
+    cpu_locals[0].apic_id = lapic_get_id();
+    started = true;
+    /* Copy the trampoline to low memory, which memblock never hands out, and fill in what every processor shares. The
+     * identity map is read-only, so the page is made writeable until every processor is up.
+     */
+    map_range(kernel_directory, AP_TRAMPOLINE_ADDRESS, AP_TRAMPOLINE_ADDRESS, PAGE_SIZE,
+              kernel_page_flags(PAGE_FLAGS_PRESENT | PAGE_FLAGS_WRITEABLE));
+    kmemory_copy((void*)AP_TRAMPOLINE_ADDRESS, ap_trampoline, (size_t)(ap_trampoline_end - ap_trampoline));
+    struct trampoline_params* params = (struct trampoline_params*)(AP_TRAMPOLINE_ADDRESS +
+                                                                   (ap_trampoline_params - ap_trampoline));
+    uint32_t cr3;
+    uint32_t cr4;
+    asm volatile("mov %%cr3, %0":"=r"(cr3));
+    asm volatile("mov %%cr4, %0":"=r"(cr4));
+    params->cr3   = cr3;
+    params->cr4   = cr4;
+    params->entry = (uint32_t)&ap_main;
+    /* Processors are numbered in the order they come up. If one doesn't, the rest are left alone, since it could still
+     * come up late and take the next one's number.
+     */
+    for (size_t i = 0; i < acpi_get_cpu_count() && online < SMP_CPUS_MAX; ++i) {
+        const uint8_t apic_id = acpi_get_cpu_apic_id(i);
+        if (apic_id == cpu_locals[0].apic_id) {
+            continue;
+        }
+        if (!(start_cpu(params, online, apic_id))) {
+            printk(PRINTK_WARNING "SMP: CPU with APIC ID %u didn't start\n", apic_id);
+            break;
+        }
+    }
+    map_range(kernel_directory, AP_TRAMPOLINE_ADDRESS, AP_TRAMPOLINE_ADDRESS, PAGE_SIZE,
+              kernel_page_flags(PAGE_FLAGS_PRESENT));
+    printk(PRINTK_DEBUG "SMP: <cpus=%u,bsp_apic_id=%u>\n", online, cpu_locals[0].apic_id);
+}
+
+unsigned smp_cpu_index(void)
+{
+    if (!(started)) {
+        return 0;
+    }
+    unsigned index;
+    asm volatile("mov %%gs:0, %0":"=r"(index));
+    return index;
+}
+
+unsigned smp_cpu_count(void)
+{
+    return __atomic_load_n(&online, __ATOMIC_ACQUIRE);
+}
+
+struct cpu_local* smp_cpu_local(unsigned cpu)
+{
+    return &(cpu_locals[cpu]);
+}
+
+void smp_reschedule(unsigned cpu)
+{
+    if (apic_enabled() && cpu < smp_cpu_count()) {
+        lapic_send_ipi(cpu_locals[cpu].apic_id, IRQ_RESCHEDULE);
+    }
+}
+
+void smp_flush_tlb(unsigned cpu)
+{
+    if (apic_enabled() && cpu < smp_cpu_count()) {
+        lapic_send_ipi(cpu_locals[cpu].apic_id, IRQ_TLB_FLUSH);
+    }
+}
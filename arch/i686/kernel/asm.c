@@ -27,7 +27,19 @@ uint64_t read_ticks(void)
     asm("xorl %%eax, %%eax\ncpuid":::"%eax", "%ebx", "%ecx", "%edx");
     asm("rdtsc":"=a"(lo), "=d"(hi));
     RESTORE_INTERRUPT_STATE;
-    return ((uint64_t)(((uint64_t)hi << 32) | (lo & 0x0f)));
+    return ((uint64_t)(((uint64_t)hi << 32) | lo));
+}
+
+uint64_t read_msr(uint32_t msr)
+{
+    uint32_t hi, lo;
+    asm volatile("rdmsr":"=a"(lo), "=d"(hi):"c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void write_msr(uint32_t msr, uint64_t value)
+{
+    asm volatile("wrmsr"::"c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)):"memory");
 }
 
 void io_outb(uint16_t port, uint8_t value)
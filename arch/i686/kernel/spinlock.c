@@ -0,0 +1,89 @@
+/**
+ * \file kernel/spinlock.c
+ * The kernel lock.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <redshift/hal/smp.h>
+#include <redshift/kernel.h>
+#include <redshift/kernel/spinlock.h>
+#include <redshift/mem/paging.h>
+
+enum {
+    NO_OWNER = -1 /* Value of kernel_owner when no CPU holds the lock. */
+};
+
+static spinlock_t   kernel_spinlock = SPINLOCK_INIT;
+static volatile int kernel_owner    = NO_OWNER; /* Index of the CPU which holds the lock.    */
+static unsigned     kernel_depth;               /* Number of times the owner has taken it.  */
+
+void kernel_lock(void)
+{
+    const int cpu = (int)smp_cpu_index();
+    if (kernel_owner == cpu) {
+        ++kernel_depth;
+        return;
+    }
+    /* This is spin_lock, except that TLB flushes are acknowledged while waiting: the owner may be waiting for this CPU
+     * in page_tlb_shootdown, and interrupts are disabled so the IPI can't get through.
+     */
+    const uint16_t ticket = __atomic_fetch_add(&(kernel_spinlock.next), 1, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&(kernel_spinlock.owner), __ATOMIC_ACQUIRE) != ticket) {
+        page_tlb_sync();
+        asm volatile("pause");
+    }
+    kernel_owner = cpu;
+    kernel_depth = 1;
+    /* Another CPU may have changed the page tables while we were waiting.
+     */
+    page_tlb_sync();
+}
+
+void kernel_unlock(void)
+{
+    DEBUG_ASSERT(kernel_owner == (int)smp_cpu_index() && kernel_depth > 0);
+    if (--kernel_depth == 0) {
+        kernel_owner = NO_OWNER;
+        spin_unlock(&kernel_spinlock);
+    }
+}
+
+unsigned kernel_lock_depth(void)
+{
+    return kernel_owner == (int)smp_cpu_index() ? kernel_depth : 0;
+}
+
+void kernel_lock_set_depth(unsigned depth)
+{
+    if (depth == 0) {
+        if (kernel_lock_depth() > 0) {
+            kernel_depth = 1;
+            kernel_unlock();
+        }
+        return;
+    }
+    if (kernel_lock_depth() == 0) {
+        kernel_lock();
+    }
+    kernel_depth = depth;
+}
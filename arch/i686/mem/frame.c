@@ -0,0 +1,313 @@
+/**
+ * \file mem/frame.c
+ * \brief Physical frame allocator.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <libk/kmemory.h>
+#include <redshift/hal/memory.h>
+#include <redshift/kernel.h>
+#include <redshift/mem/frame.h>
+#include <redshift/mem/memblock.h>
+#include <redshift/mem/static.h>
+
+/* Binary buddy allocator. Free memory is kept in blocks of 2^order frames, each aligned to its own size, with one free
+ * list per order. A block's buddy is found by flipping bit `order` of its frame number, so freeing a block merges it
+ * with its buddy (and the result with its buddy, etc.) in at most FRAME_ORDER_MAX steps.
+ *
+ * Free memory isn't mapped, so the free lists are threaded through per-frame arrays instead of the frames themselves.
+ *
+ * An allocated frame's frame_state holds the number of extra references to it, so that a frame can be shared between
+ * address spaces. The count is back to zero by the time the frame is freed, so frames inside free blocks read as zero.
+ */
+
+enum {
+    FRAME_NONE       = UINT32_MAX, /* Null frame number.                                        */
+    FRAME_FREE       = 0x80,       /* Set in frame_state for the first frame of a free block.  */
+    FRAME_ORDER_MASK = 0x7F,       /* Mask for the block order in frame_state.                 */
+    FRAME_SHARE_MAX  = 0x7F        /* Largest number of extra references to a frame.           */
+};
+
+static uint32_t* frame_next;                        /* Next free block in list, by frame number.      */
+static uint32_t* frame_prev;                        /* Previous free block in list, by frame number.  */
+static uint8_t*  frame_state;                       /* Free block order, or allocated frame's shares. */
+static uint32_t  frame_count;                       /* Number of frames managed.                      */
+static uint32_t  free_lists[FRAME_ORDER_MAX + 1];   /* Free list heads, by order.                     */
+static uint32_t  free_orders;                       /* Bit i is set if free_lists[i] is non-empty.    */
+static size_t    free_frames;                       /* Number of free frames.                         */
+static size_t    used_frames;                       /* Number of frames allocated and not yet freed.  */
+static size_t    peak_used_frames;                  /* Largest value of used_frames.                  */
+static size_t    min_free_frames = SIZE_MAX;        /* Smallest value of free_frames after an alloc.  */
+
+/* Add a free block to the front of its list. */
+static void free_list_add(uint32_t frame, unsigned order)
+{
+    frame_state[frame] = FRAME_FREE | order;
+    frame_prev[frame]  = FRAME_NONE;
+    frame_next[frame]  = free_lists[order];
+    if (frame_next[frame] != FRAME_NONE) {
+        frame_prev[frame_next[frame]] = frame;
+    }
+    free_lists[order]  = frame;
+    free_orders       |= 1UL << order;
+}
+
+/* Remove a free block from its list. */
+static void free_list_remove(uint32_t frame, unsigned order)
+{
+    DEBUG_ASSERT(frame_state[frame] == (FRAME_FREE | order));
+    if (frame_prev[frame] != FRAME_NONE) {
+        frame_next[frame_prev[frame]] = frame_next[frame];
+    } else {
+        DEBUG_ASSERT(free_lists[order] == frame);
+        free_lists[order] = frame_next[frame];
+    }
+    if (frame_next[frame] != FRAME_NONE) {
+        frame_prev[frame_next[frame]] = frame_prev[frame];
+    }
+    if (free_lists[order] == FRAME_NONE) {
+        free_orders &= ~(1UL << order);
+    }
+    frame_state[frame] = 0;
+}
+
+/* Free a block, merging it with its buddy for as long as the buddy is also free. */
+static void release_block(uint32_t frame, unsigned order)
+{
+    free_frames += 1UL << order;
+    while (order < FRAME_ORDER_MAX) {
+        const uint32_t buddy = frame ^ (1UL << order);
+        if (buddy >= frame_count || frame_state[buddy] != (FRAME_FREE | order)) {
+            break;
+        }
+        free_list_remove(buddy, order);
+        frame = MIN(frame, buddy);
+        ++order;
+    }
+    free_list_add(frame, order);
+}
+
+/* Hand the frames in [start, end) to the allocator in the largest aligned blocks that fit. */
+static void release_range(uint32_t start, uint32_t end)
+{
+    while (start < end) {
+        unsigned order = FRAME_ORDER_MAX;
+        while (order > 0 && ((start & ((1UL << order) - 1)) != 0 || start + (1UL << order) > end)) {
+            --order;
+        }
+        release_block(start, order);
+        start += 1UL << order;
+    }
+}
+
+enum {
+    LOW_FRAMES = 0x100000 /* Frames below 4 GiB, which can be reached before paging is enabled. */
+};
+
+/* Release a range of boot memory. */
+static void __init_text release_boot_range(phys_addr_t start, phys_addr_t end)
+{
+    release_range(start/PAGE_SIZE, MIN(end/PAGE_SIZE, frame_count));
+}
+
+/* Release the part of a range of boot memory which is below 4 GiB. */
+static void __init_text release_low_range(phys_addr_t start, phys_addr_t end)
+{
+    release_range(start/PAGE_SIZE, MIN(end/PAGE_SIZE, MIN(frame_count, LOW_FRAMES)));
+}
+
+/* Release the part of a range of boot memory which is above 4 GiB. */
+static void __init_text release_high_range(phys_addr_t start, phys_addr_t end)
+{
+    release_range(MAX(start/PAGE_SIZE, LOW_FRAMES), MIN(end/PAGE_SIZE, frame_count));
+}
+
+uintptr_t __init_text frame_init(size_t static_size)
+{
+    SAVE_INTERRUPT_STATE;
+    frame_count = memblock_limit()/PAGE_SIZE;
+    /* Allocate the per-frame arrays then fix the amount of static memory, so nothing else is allocated where the free
+     * frames will be.
+     */
+    frame_next  = static_alloc(frame_count*sizeof(*frame_next));
+    frame_prev  = static_alloc(frame_count*sizeof(*frame_prev));
+    frame_state = static_alloc(frame_count*sizeof(*frame_state));
+    kmemory_fill8(frame_state, 0, frame_count*sizeof(*frame_state));
+    for (unsigned order = 0; order <= FRAME_ORDER_MAX; ++order) {
+        free_lists[order] = FRAME_NONE;
+    }
+    static_reserve(static_size);
+    /* Release available memory which memblock hasn't handed out. Memory above 4 GiB waits until paging is enabled.
+     */
+    memblock_release(MEMORY_TYPE_AVAILABLE, release_low_range);
+    const uintptr_t reserved_end = memblock_reserved_end();
+    printk(
+        PRINTK_DEBUG "Frame allocator: <frames=%lu,free=%luK,reserved_end=0x%08lX>\n",
+        frame_count,
+        free_frames*(PAGE_SIZE/1024),
+        reserved_end
+    );
+    RESTORE_INTERRUPT_STATE;
+    return reserved_end;
+}
+
+void __init_text frame_release_high_memory(void)
+{
+    SAVE_INTERRUPT_STATE;
+    const size_t free_before = free_frames;
+    memblock_release(MEMORY_TYPE_AVAILABLE, release_high_range);
+    if (free_frames != free_before) {
+        printk(PRINTK_DEBUG "Released high memory: <free=%luK>\n", (free_frames - free_before)*(PAGE_SIZE/1024));
+    }
+    RESTORE_INTERRUPT_STATE;
+}
+
+void __init_text frame_release_boot_memory(void)
+{
+    SAVE_INTERRUPT_STATE;
+    const size_t reclaimable = (size_t)memblock_release(MEMORY_TYPE_RECLAIMABLE, release_boot_range);
+    const size_t pool        = static_release();
+    printk(
+        PRINTK_DEBUG "Released boot memory: <reclaimable=%luK,static=%luK,free=%luK>\n",
+        reclaimable/1024,
+        pool/1024,
+        free_frames*(PAGE_SIZE/1024)
+    );
+    RESTORE_INTERRUPT_STATE;
+}
+
+size_t frame_free_boot_range(uintptr_t start, uintptr_t end)
+{
+    MAKE_PAGE_ALIGNED(start);
+    end &= ~(uintptr_t)(PAGE_SIZE - 1);
+    if (start >= end) {
+        return 0;
+    }
+    SAVE_INTERRUPT_STATE;
+    release_range(start/PAGE_SIZE, MIN(end/PAGE_SIZE, frame_count));
+    RESTORE_INTERRUPT_STATE;
+    return end - start;
+}
+
+phys_addr_t frame_alloc_order(unsigned order)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(order <= FRAME_ORDER_MAX);
+    /* Take the smallest block which is big enough, then split it in half until it's the right size, freeing the upper
+     * halves.
+     */
+    const uint32_t orders = free_orders & ~((1UL << order) - 1);
+    if (orders == 0) {
+        RESTORE_INTERRUPT_STATE;
+        return 0;
+    }
+    unsigned       block_order = __builtin_ctz(orders);
+    const uint32_t frame       = free_lists[block_order];
+    free_list_remove(frame, block_order);
+    while (block_order > order) {
+        --block_order;
+        free_list_add(frame + (1UL << block_order), block_order);
+    }
+    free_frames      -= 1UL << order;
+    used_frames      += 1UL << order;
+    peak_used_frames  = MAX(peak_used_frames, used_frames);
+    min_free_frames   = MIN(min_free_frames, free_frames);
+    RESTORE_INTERRUPT_STATE;
+    return (phys_addr_t)frame*PAGE_SIZE;
+}
+
+void frame_free_order(phys_addr_t address, unsigned order)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(order <= FRAME_ORDER_MAX);
+    DEBUG_ASSERT(IS_ALIGNED(address, PAGE_SIZE << order));
+    const uint32_t frame = address/PAGE_SIZE;
+    DEBUG_ASSERT(frame < frame_count);
+    DEBUG_ASSERT(!(TEST_FLAG(frame_state[frame], FRAME_FREE))); /* Check for double-free. */
+    DEBUG_ASSERT(frame_state[frame] == 0);                       /* Check the frame isn't shared. */
+    release_block(frame, order);
+    used_frames -= 1UL << order;
+    RESTORE_INTERRUPT_STATE;
+}
+
+void frame_free_range(phys_addr_t address, size_t count)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(address));
+    const uint32_t frame = address/PAGE_SIZE;
+    DEBUG_ASSERT(frame + count <= frame_count);
+    release_range(frame, frame + count);
+    used_frames -= count;
+    RESTORE_INTERRUPT_STATE;
+}
+
+int frame_share(phys_addr_t address)
+{
+    SAVE_INTERRUPT_STATE;
+    const uint32_t frame = address/PAGE_SIZE;
+    DEBUG_ASSERT(frame < frame_count);
+    DEBUG_ASSERT(!(TEST_FLAG(frame_state[frame], FRAME_FREE)));
+    if (frame_state[frame] == FRAME_SHARE_MAX) {
+        RESTORE_INTERRUPT_STATE;
+        return -1;
+    }
+    ++frame_state[frame];
+    RESTORE_INTERRUPT_STATE;
+    return 0;
+}
+
+bool frame_unshare(phys_addr_t address)
+{
+    SAVE_INTERRUPT_STATE;
+    const uint32_t frame = address/PAGE_SIZE;
+    if (frame >= frame_count || frame_state[frame] == 0) {
+        RESTORE_INTERRUPT_STATE;
+        return false;
+    }
+    DEBUG_ASSERT(!(TEST_FLAG(frame_state[frame], FRAME_FREE)));
+    --frame_state[frame];
+    RESTORE_INTERRUPT_STATE;
+    return true;
+}
+
+size_t frame_count_free(void)
+{
+    return free_frames;
+}
+
+void frame_get_stats(struct frame_stats* stats)
+{
+    SAVE_INTERRUPT_STATE;
+    stats->frame_count      = frame_count;
+    stats->free_frames      = free_frames;
+    stats->used_frames      = used_frames;
+    stats->peak_used_frames = peak_used_frames;
+    stats->min_free_frames  = min_free_frames == SIZE_MAX ? free_frames : min_free_frames;
+    RESTORE_INTERRUPT_STATE;
+}
+
+void frame_print_stats(void)
+{
+    struct frame_stats stats;
+    frame_get_stats(&stats);
+    printk(
+        PRINTK_DEBUG "Frame allocator: <free=%luK,used=%luK,peak_used=%luK,min_free=%luK>\n",
+        stats.free_frames*(PAGE_SIZE/1024),
+        stats.used_frames*(PAGE_SIZE/1024),
+        stats.peak_used_frames*(PAGE_SIZE/1024),
+        stats.min_free_frames*(PAGE_SIZE/1024)
+    );
+}
@@ -17,25 +17,15 @@
  * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
  * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
+#include <libk/ktree.h>
 #include <redshift/hal/memory.h>
 #include <redshift/kernel.h>
-#include <libk/ksorted_array.h>
+#include <redshift/mem/account.h>
 #include <redshift/mem/common.h>
 #include <redshift/mem/heap.h>
 #include <redshift/mem/paging.h>
 #include <redshift/mem/static.h>
 
-struct heap {
-    struct ksorted_array* blocklist;   /* List of blocks ordered from smallest to largest. */
-    uintptr_t           start;        /* Heap start address.                              */
-    uintptr_t           end;          /* Heap end address.                                */
-    size_t              max_size;     /* Maximum size of heap (end - start).              */
-    unsigned            alloc_count;  /* Number of times memory was allocated.            */
-    unsigned            free_count;   /* Number of times memory was freed.                */
-    uint64_t            bytes_allocd; /* Number of bytes currently allocated.             */
-    int                 flags;        /* Heap flags.                                      */
-};
-
 typedef enum {
     BLOCK_FLAGS_ALLOCATED = 0,       /* Marks an allocated (usable/in use) block. */
     BLOCK_FLAGS_AVAILABLE = 1 << 0   /* Marks an available block (hole).          */
@@ -45,47 +35,77 @@ struct blockheader {
     uint32_t magic;  /* Magic number. */
     uint32_t flags;  /* Block flags. */
     uint32_t size;   /* Size of the block. Excludes the header and footer. */
-    uint8_t  pad[4]; /* Pad to 16 bytes */
+    uint32_t owner;  /* Account an allocated block is charged to. Pads the header to 16 bytes. */
 } __packed;
 
 struct blockfooter {
     uint32_t magic;
     struct   blockheader* header;
-    uint8_t  pad[8]; /* Pad to 16 bytes */
+    uint8_t  pad[12 - sizeof(struct blockheader*)]; /* Pad to 16 bytes */
 } __packed;
 
+/* Free list links. These live in the usable part of a small hole, so every hole must have room for them. Large holes
+ * store a ktree_node there instead.
+ */
+struct holelinks {
+    struct blockheader* prev;
+    struct blockheader* next;
+};
+
 enum {
     MINIMUM_HEAP_SIZE  = 0x00080000UL,                                           /* Minimum size of a heap (512 kiB).   */
     INITIAL_HEAP_SIZE  = 0x00100000UL,                                           /* Initial size of a heap (1 MiB).     */
-    BLOCKLIST_SIZE     = 0x00002000UL,                                           /* Maximum number of blocks and holes. */
+    HEAP_GROW_CHUNK    = 0x00040000UL,                                           /* Kernel heap growth unit (256 kiB).  */
+    HEAP_SHRINK_CHUNK  = 0x00100000UL,                                           /* Kernel heap shrink unit (1 MiB).    */
+    HEAP_BINS          = 12,                                                     /* Number of small size classes.       */
+    LARGE_HOLE_SIZE    = 1UL << HEAP_BINS,                                       /* Smallest hole kept in the tree.     */
     BLOCK_MAGIC        = 0x600DB10CUL,                                           /* Block magic number.                 */
-    MINIMUM_BLOCK_SIZE = sizeof(struct blockheader) + sizeof(struct blockfooter) /* Size of an empty block.             */
+    BLOCK_ALIGNMENT    = 16,                                                     /* Alignment of usable memory.         */
+    MINIMUM_BLOCK_SIZE = sizeof(struct blockheader) + sizeof(struct blockfooter),/* Size of an empty block.             */
+    MINIMUM_HOLE_SIZE  = MINIMUM_BLOCK_SIZE + BLOCK_ALIGNMENT                    /* Size of the smallest possible hole. */
 };
 
-struct heap* __kernel_heap__ = NULL;
+/* Small holes are kept in segregated free lists ("bins"). Bin i holds holes whose usable size is in [2^i, 2^(i+1)), and
+ * bit i of the bitmap is set whenever bin i is non-empty, so the smallest bin which is guaranteed to satisfy a request
+ * can be found with a single bit scan instead of walking every hole in the heap. Large holes are kept in a tree ordered
+ * by address, which gives lowest-address first fit (keeping the end of the heap free to be contracted) and logarithmic
+ * removal when holes are merged.
+ */
+struct heap {
+    struct blockheader* bins[HEAP_BINS]; /* Free lists, one per power-of-two size class. */
+    uint32_t            bitmap;          /* Bit i is set if bins[i] is non-empty.        */
+    struct ktree        large_holes;     /* Large holes, ordered by address.             */
+    uintptr_t           start;           /* Heap start address.                          */
+    uintptr_t           end;             /* Heap end address.                            */
+    struct heap_policy  policy;          /* Sizing policy.                               */
+    unsigned            alloc_count;     /* Number of times memory was allocated.        */
+    unsigned            free_count;      /* Number of times memory was freed.            */
+    uint64_t            bytes_allocd;    /* Number of bytes currently allocated.         */
+    int                 flags;           /* Heap flags.                                  */
+};
 
-extern uintptr_t heap_addr; /* mem/static.c */
+struct heap* __kernel_heap__ = NULL;
 
 /* Get the amount of memory owned by a heap. Does not include the heap structure itself. */
-static size_t get_heap_size(struct heap* heap)
+static size_t get_heap_size(const struct heap* heap)
 {
     return heap->end - heap->start;
 }
 
 /* Get the address of the usable memory which immediately follows a block.  */
-static uintptr_t get_usable_address(struct blockheader* header)
+static uintptr_t get_usable_address(const struct blockheader* header)
 {
     return (uintptr_t)header + sizeof(*header);
 }
 
-/* Get the address of a block footer. */
-static uintptr_t get_footer_address(struct blockheader* header)
+/* Get a block's footer. */
+static struct blockfooter* get_footer(const struct blockheader* header)
 {
-    return get_usable_address(header) + header->size;
+    return (struct blockfooter*)(get_usable_address(header) + header->size);
 }
 
 /* Get the address of the end of a block footer. */
-static uintptr_t get_footer_end(struct blockfooter* footer)
+static uintptr_t get_footer_end(const struct blockfooter* footer)
 {
     return (uintptr_t)footer + sizeof(*footer);
 }
@@ -102,77 +122,203 @@ static size_t usable_block_size(size_t total_size)
     return total_size - MINIMUM_BLOCK_SIZE;
 }
 
-/* Scan the memory map for a region big enough to store the heap. */
-static uint32_t get_heap_region(uint64_t size)
+/* Test whether a block is a hole. */
+static bool is_hole(const struct blockheader* header)
+{
+    return TEST_FLAG(header->flags, BLOCK_FLAGS_AVAILABLE);
+}
+
+/* Get the block immediately to the right of a block, or NULL if the block is the last one in the heap. */
+static struct blockheader* get_next_block(const struct heap* heap, const struct blockheader* header)
+{
+    const uintptr_t address = get_footer_end(get_footer(header));
+    if (address >= heap->end) {
+        return NULL;
+    }
+    struct blockheader* next = (struct blockheader*)address;
+    DEBUG_ASSERT(next->magic == BLOCK_MAGIC);
+    return next;
+}
+
+/* Get the block immediately to the left of a block, or NULL if the block is the first one in the heap. */
+static struct blockheader* get_previous_block(const struct heap* heap, const struct blockheader* header)
+{
+    if ((uintptr_t)header <= heap->start) {
+        return NULL;
+    }
+    const struct blockfooter* footer = (const struct blockfooter*)((uintptr_t)header - sizeof(*footer));
+    DEBUG_ASSERT(footer->magic == BLOCK_MAGIC);
+    return footer->header;
+}
+
+/* Get the last block in the heap, or NULL if the heap is empty. */
+static struct blockheader* get_last_block(const struct heap* heap)
+{
+    if (heap->end <= heap->start) {
+        return NULL;
+    }
+    const struct blockfooter* footer = (const struct blockfooter*)(heap->end - sizeof(*footer));
+    DEBUG_ASSERT(footer->magic == BLOCK_MAGIC);
+    return footer->header;
+}
+
+/* Get the free list links of a hole. */
+static struct holelinks* get_links(const struct blockheader* header)
+{
+    return (struct holelinks*)get_usable_address(header);
+}
+
+/* Get the tree node of a large hole. */
+static struct ktree_node* get_tree_node(const struct blockheader* header)
+{
+    return (struct ktree_node*)get_usable_address(header);
+}
+
+/* Get the header of the large hole containing a tree node. */
+static struct blockheader* get_tree_header(const struct ktree_node* node)
+{
+    return node == NULL ? NULL : (struct blockheader*)((uintptr_t)node - sizeof(struct blockheader));
+}
+
+/* Get the bin a hole of a given size belongs in, i.e. floor(log2(size)). */
+static unsigned get_bin_index(size_t size)
 {
     DEBUG_ASSERT(size != 0);
-    const size_t map_size = memory_map_size();
-    DEBUG_ASSERT(memory_map_size() > 0);
-    const struct memory_map* region = memory_map_head();
-    for (size_t i = 0; i < map_size; ++i, region = region->next) {
-        DEBUG_ASSERT(region != NULL);
-        const uint64_t region_size = region->end - region->start;
-        if (region_size < size) {
-            continue;
-        } else if (region->type == MEMORY_TYPE_AVAILABLE) {
-            uintptr_t address = region->start;
-            /* Check we're not about to overwrite the kernel.
-            */
-            if (region->start < heap_addr && heap_addr <= region->end) {
-                address = heap_addr;
-            }
-            /* Page align the address.
-             */
-            MAKE_PAGE_ALIGNED(address);
-            /* Make sure we can still fit the heap into this region.
-             */
-            if (address + size <= region->end) {
-                /* The static allocator will continue allocating at the end of the kernel heap. This could result in
-                 * writing into reserved memory and screwing something up, like ACPI structures or the user's hard drive
-                 * This requires redesigning the memory manager somewhat so we'll add it to the to-do list (FIXME).
-                 */
-                heap_addr = address + size;
-                return address;
-            }
-        } else if (region->type == MEMORY_TYPE_RECLAIMABLE) {
-            printk(PRINTK_DEBUG "Reclaimable memory: <start=0x%llX,end=0x%llX>\n", region->start, region->end);
-        }
-    } while ((region = region->next) != NULL);
-    panic("no memory region large enough for kernel heap (%lluK)", size/1024);
+    return 31 - __builtin_clz((uint32_t)size);
+}
+
+/* Add a hole to the front of its bin, or to the tree if it is large. */
+static void hole_insert(struct heap* heap, struct blockheader* header)
+{
+    if (header->size >= LARGE_HOLE_SIZE) {
+        ktree_insert(&heap->large_holes, get_tree_node(header), (uintptr_t)header, header->size);
+        return;
+    }
+    const unsigned    index = get_bin_index(header->size);
+    struct holelinks* links = get_links(header);
+    links->prev = NULL;
+    links->next = heap->bins[index];
+    if (links->next != NULL) {
+        get_links(links->next)->prev = header;
+    }
+    heap->bins[index]  = header;
+    heap->bitmap      |= 1UL << index;
+}
+
+/* Remove a hole from its bin or the tree. */
+static void hole_remove(struct heap* heap, struct blockheader* header)
+{
+    if (header->size >= LARGE_HOLE_SIZE) {
+        ktree_remove(&heap->large_holes, get_tree_node(header));
+        return;
+    }
+    const unsigned    index = get_bin_index(header->size);
+    struct holelinks* links = get_links(header);
+    if (links->prev != NULL) {
+        get_links(links->prev)->next = links->next;
+    } else {
+        DEBUG_ASSERT(heap->bins[index] == header);
+        heap->bins[index] = links->next;
+    }
+    if (links->next != NULL) {
+        get_links(links->next)->prev = links->prev;
+    }
+    if (heap->bins[index] == NULL) {
+        heap->bitmap &= ~(1UL << index);
+    }
 }
 
-/* Get the smallest hole at least as big as size. */
-static int32_t get_smallest_hole(struct heap* heap, size_t size, bool aligned)
+/* Get the number of bytes which have to be split off the front of a hole so that its usable memory is aligned. This is
+ * either zero or large enough to leave a hole behind.
+ */
+static size_t get_alignment_gap(const struct blockheader* header, size_t alignment)
+{
+    const uintptr_t address = get_usable_address(header);
+    if (IS_ALIGNED(address, alignment)) {
+        return 0;
+    }
+    uintptr_t aligned = address + MINIMUM_HOLE_SIZE;
+    MAKE_ALIGNED(aligned, alignment);
+    return aligned - address;
+}
+
+/* Find a hole big enough for size bytes at the given alignment. Small requests take constant time: the head of the
+ * request's own bin is tried first, then the bitmap gives the smallest bin in which every hole is big enough. Large
+ * requests, and small ones which no bin can satisfy, take the lowest-addressed large hole that fits.
+ */
+static struct blockheader* find_hole(const struct heap* heap, size_t size, size_t alignment)
 {
     DEBUG_ASSERT(heap != NULL);
     DEBUG_ASSERT(size != 0);
-    for (uint32_t i = 0, j = ksorted_array_count(heap->blocklist); i < j; ++i) {
-        struct blockheader* header = (struct blockheader*)ksorted_array_get(heap->blocklist, i);
-        if (aligned) {
-            uintptr_t address = get_usable_address(header);
-            int32_t   offset  = 0;
-            if (!(IS_PAGE_ALIGNED(address))) {
-                offset = PAGE_SIZE - address%PAGE_SIZE;
-            }
-            int32_t hole_size = (int32_t)header->size - offset;
-            if (hole_size >= (int32_t)size) {
-                return i;
-            }
-        } else if (header->size >= size) {
-            return i;
+    /* Allow for the worst-case alignment gap.
+     */
+    const size_t needed = alignment > BLOCK_ALIGNMENT ? size + alignment + MINIMUM_HOLE_SIZE : size;
+    if (needed < LARGE_HOLE_SIZE) {
+        struct blockheader* header = heap->bins[get_bin_index(size)];
+        if (header != NULL && header->size >= size + get_alignment_gap(header, alignment)) {
+            return header;
+        }
+        /* Every hole in bins above the one for `needed` is at least 2^(index + 1) > needed bytes.
+         */
+        const uint32_t bins = heap->bitmap & ~((1UL << (get_bin_index(needed) + 1)) - 1);
+        if (bins != 0) {
+            return heap->bins[__builtin_ctz(bins)];
+        }
+    } else {
+        /* The lowest hole of at least size bytes will usually fit once aligned too.
+         */
+        struct blockheader* header = get_tree_header(ktree_find_first_fit(&heap->large_holes, size));
+        if (header != NULL && header->size >= size + get_alignment_gap(header, alignment)) {
+            return header;
         }
     }
-    return -1;
+    return get_tree_header(ktree_find_first_fit(&heap->large_holes, needed));
 }
 
-/* Returns true if its left argument comes before its right argument. */
-static bool blockheader_ascending_predicate(void* pa, void* pb)
+/* Place a block (header and footer) at a particular address. Address should be 16-bytes aligned. */
+static struct blockheader* place_block(uintptr_t address, size_t size, block_flags_t flags)
 {
-    DEBUG_ASSERT(pa != NULL);
-    DEBUG_ASSERT(pb != NULL);
-    struct blockheader* a = (struct blockheader*)pa;
-    struct blockheader* b = (struct blockheader*)pb;
-    return a->size < b->size;
+    struct blockheader* header = (struct blockheader*)address;
+    kmemory_fill8(header, 0, sizeof(*header));
+    header->magic = BLOCK_MAGIC;
+    header->size  = size;
+    header->flags = (uint32_t)flags;
+    struct blockfooter* footer = get_footer(header);
+    kmemory_fill8(footer, 0, sizeof(*footer));
+    footer->magic  = BLOCK_MAGIC;
+    footer->header = header;
+    return header;
+}
+
+/* Create a hole at address and add it to its bin. */
+static struct blockheader* create_hole(struct heap* heap, uintptr_t address, size_t hole_size)
+{
+    DEBUG_ASSERT(hole_size >= BLOCK_ALIGNMENT);
+    DEBUG_ASSERT(address + total_block_size(hole_size) <= heap->end);
+    struct blockheader* header = place_block(address, hole_size, BLOCK_FLAGS_AVAILABLE);
+    hole_insert(heap, header);
+    return header;
+}
+
+/* Convert heap_flags_t to page_flags_t. */
+static page_flags_t heap_flags_to_page_flags(const struct heap* heap, page_flags_t page_flags)
+{
+    if (TEST_FLAG(heap->flags, HEAP_FLAGS_USER_MODE)) {
+        page_flags |= PAGE_FLAGS_USER_MODE;
+    } else {
+        page_flags = kernel_page_flags(page_flags);
+    }
+    if (TEST_FLAG(heap->flags, HEAP_FLAGS_WRITEABLE)) {
+        page_flags |= PAGE_FLAGS_WRITEABLE;
+    }
+    return page_flags;
+}
+
+/* Map memory for the pages in [start, end). Returns false if there isn't enough physical memory. */
+static bool heap_map(struct heap* heap, uintptr_t start, uintptr_t end)
+{
+    const page_flags_t page_flags = heap_flags_to_page_flags(heap, PAGE_FLAGS_PRESENT);
+    return map_range_alloc(kernel_directory, start, end - start, page_flags) == 0;
 }
 
 struct heap* create_heap(uintptr_t start, uintptr_t end, size_t max_size, heap_flags_t flags)
@@ -191,36 +337,27 @@ struct heap* create_heap(uintptr_t start, uintptr_t end, size_t max_size, heap_f
     struct heap* heap = static_alloc(sizeof(*heap));
     DEBUG_ASSERT(heap != NULL);
     kmemory_fill8(heap, 0, sizeof(*heap));
-    heap->blocklist = ksorted_array_place((void*)start, BLOCKLIST_SIZE, true, blockheader_ascending_predicate);
-    DEBUG_ASSERT(heap->blocklist != NULL);
-    start += BLOCKLIST_SIZE*sizeof(void*);
-    heap->start    = start;
-    heap->end      = end;
-    heap->max_size = max_size;
-    heap->flags    = flags;
-    struct blockheader* hole = (struct blockheader*)start;
-    hole->size  = usable_block_size(end - start);
-    hole->magic = BLOCK_MAGIC;
-    hole->flags = BLOCK_FLAGS_AVAILABLE;
-    ksorted_array_add(heap->blocklist, (void*)hole);
+    heap->start               = start;
+    heap->end                 = end;
+    heap->flags               = flags;
+    heap->policy.initial_size = end - start;
+    heap->policy.min_size     = MIN(MINIMUM_HEAP_SIZE, end - start);
+    heap->policy.max_size     = max_size;
+    heap->policy.grow_chunk   = PAGE_SIZE;
+    heap->policy.shrink_chunk = PAGE_SIZE;
+    ktree_init(&heap->large_holes);
+    if (!(heap_map(heap, start, end))) {
+        panic("%s: out of memory", __func__);
+    }
+    create_hole(heap, start, usable_block_size(end - start));
     RESTORE_INTERRUPT_STATE;
     return heap;
 }
 
-/* Convert heap_flags_t to page_flags_t. */
-static page_flags_t heap_flags_to_page_flags(const struct heap* heap, page_flags_t page_flags)
-{
-    if (TEST_FLAG(heap->flags, HEAP_FLAGS_USER_MODE)) {
-        page_flags |= PAGE_FLAGS_USER_MODE;
-    }
-    if (TEST_FLAG(heap->flags, HEAP_FLAGS_WRITEABLE)) {
-        page_flags |= PAGE_FLAGS_WRITEABLE;
-    }
-    return page_flags;
-}
-
-/* Expand the heap. */
-static void heap_expand(struct heap* heap, size_t new_size)
+/* Expand the heap. The new pages are backed straight away, so that running out of memory fails the allocation rather
+ * than a later page fault. Returns false if there isn't enough free physical memory to back them.
+ */
+static bool heap_expand(struct heap* heap, size_t new_size)
 {
     const size_t old_size = get_heap_size(heap);
     DEBUG_ASSERT(new_size > old_size);
@@ -230,252 +367,154 @@ static void heap_expand(struct heap* heap, size_t new_size)
         old_size/1024UL,
         (new_size - old_size)/1024UL,
         new_size/1024UL,
-        heap->max_size/1024UL
+        heap->policy.max_size/1024UL
     );
-    DEBUG_ASSERT(new_size <= heap->max_size);
-    uint32_t i;
-    const uint32_t page_flags = heap_flags_to_page_flags(heap, PAGE_FLAGS_PRESENT);
-    for (i = old_size; i < new_size; i += PAGE_SIZE) {
-        frame_alloc(page_get(heap->start + i, kernel_directory, true), page_flags);
+    DEBUG_ASSERT(new_size <= heap->policy.max_size);
+    if (!(heap_map(heap, heap->end, heap->start + new_size))) {
+        printk(PRINTK_WARNING "Out of memory expanding heap: <size=%luK>\n", new_size/1024UL);
+        return false;
     }
     heap->end = heap->start + new_size;
+    return true;
 }
 
-/* Place a blockheader at a particular address. Address should be 4-bytes aligned. */
-static struct blockheader* place_header(uintptr_t address, size_t size, block_flags_t flags)
-{
-    struct blockheader* header = (struct blockheader*)address;
-    kmemory_fill8(header, 0, sizeof(*header));
-    header->magic = BLOCK_MAGIC;
-    header->size  = size;
-    header->flags = (uint32_t)flags;
-    return header;
-}
-
-/* Place a blockfooter to match a given blockheader. */
-static struct blockfooter* place_footer(struct blockheader* header)
+/* Contract the heap. */
+static void heap_contract(struct heap* heap, size_t new_size)
 {
-    struct blockfooter* footer = (struct blockfooter*)(header + header->size);
-    kmemory_fill8(footer, 0, sizeof(*footer));
-    footer->magic  = BLOCK_MAGIC;
-    footer->header = header;
-    return footer;
+    const size_t old_size = get_heap_size(heap);
+    DEBUG_ASSERT(new_size < old_size);
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(new_size));
+    DEBUG_ASSERT(new_size >= heap->policy.min_size);
+    unmap_range(kernel_directory, heap->start + new_size, old_size - new_size, true);
+    heap->end = heap->start + new_size;
 }
 
-/* Get the index of the last block added to the blocklist. */
-static uint32_t get_last_block(const struct heap* heap)
+/* Grow the heap so that its last block is a hole of at least size bytes. Returns false if the heap can't grow. */
+static bool grow_heap(struct heap* heap, size_t size)
 {
-    uint32_t last_value = 0;
-    int32_t  last_index = -1;
-    for (uint32_t i = 0, j = ksorted_array_count(heap->blocklist); i < j; ++i) {
-        uint32_t value = (uint32_t)ksorted_array_get(heap->blocklist, i);
-        if (value > last_value) {
-            DEBUG_ASSERT(i < (uint32_t)INT32_MAX);
-            last_value = value;
-            last_index = (int32_t)i;
-        }
+    /* If the heap ends with a hole, grow that hole instead of creating a new one.
+     */
+    struct blockheader* last  = get_last_block(heap);
+    uintptr_t           start = heap->end;
+    if (last != NULL && is_hole(last)) {
+        start = (uintptr_t)last;
     }
-    return last_index;
-
-}
-
-/* Create a new block header (index < 0) or update an existing one (index >= 0), then create a new footer. */
-static struct blockheader* create_or_update_block(
-    struct heap*  heap,
-    int32_t       index,
-    uintptr_t     address,
-    size_t        alloc_size,
-    block_flags_t flags)
-{
-    if (index >= 0) {
-        address = (uintptr_t)ksorted_array_get(heap->blocklist, index);
-        DEBUG_ASSERT(address != 0);
+    size_t new_size = start + total_block_size(size) - heap->start;
+    MAKE_PAGE_ALIGNED(new_size);
+    if (new_size > heap->policy.max_size) {
+        printk(PRINTK_WARNING "Heap exhausted: <size=%luK,max_size=%luK>\n", get_heap_size(heap)/1024UL, heap->policy.max_size/1024UL);
+        return false;
     }
-    struct blockheader* header = place_header(address, alloc_size, flags);
-    struct blockfooter* footer = place_footer(header);
-    DEBUG_ASSERT(footer != NULL);
-    ksorted_array_add(heap->blocklist, (void*)header);
-    return header;
+    /* Grow in whole chunks (as far as the maximum allows) so that a run of small allocations doesn't grow the heap one
+     * page at a time.
+     */
+    MAKE_ALIGNED(new_size, heap->policy.grow_chunk);
+    new_size = MIN(new_size, heap->policy.max_size);
+    const uintptr_t old_end = heap->end;
+    if (!(heap_expand(heap, new_size))) {
+        return false;
+    }
+    if (start != old_end) {
+        hole_remove(heap, last);
+    }
+    create_hole(heap, start, usable_block_size(heap->end - start));
+    return true;
 }
 
-/* Create a hole at address. The hole may be smaller than hole_size if address+hole_size is past the end of the heap. */
-static struct blockheader* create_hole(struct heap* heap, uintptr_t address, size_t hole_size)
+/* Give the pages at the end of the heap back if they are covered by a hole. Returns false if the hole no longer
+ * exists.
+ */
+static bool shrink_heap(struct heap* heap, struct blockheader* header)
 {
-    /* Make sure we don't write past the end of the heap.
+    DEBUG_ASSERT(get_footer_end(get_footer(header)) == heap->end);
+    uintptr_t new_end = (uintptr_t)header;
+    if (!(IS_PAGE_ALIGNED(new_end))) {
+        /* Leave enough of the hole behind to be a valid hole.
+         */
+        new_end += MINIMUM_HOLE_SIZE;
+        MAKE_PAGE_ALIGNED(new_end);
+    }
+    /* Only give memory back a chunk at a time so that a heap hovering around a chunk boundary doesn't keep mapping
+     * and unmapping the same pages.
      */
-    if (address + total_block_size(hole_size) > heap->end) {
-        printk(PRINTK_WARNING "Trying to create hole past end of heap");
-        hole_size -= sizeof(struct blockfooter);
+    size_t new_size = new_end - heap->start;
+    MAKE_ALIGNED(new_size, heap->policy.grow_chunk);
+    new_size = MAX(new_size, heap->policy.min_size);
+    if (new_size >= get_heap_size(heap) || get_heap_size(heap) - new_size < heap->policy.shrink_chunk) {
+        return true;
     }
-    struct blockheader* header = place_header(address, hole_size, BLOCK_FLAGS_AVAILABLE);
-    place_footer(header);
-    ksorted_array_add(heap->blocklist, (void*)header);
-    return header;
+    heap_contract(heap, new_size);
+    new_end = heap->end;
+    if (new_end == (uintptr_t)header) {
+        return false;
+    }
+    place_block((uintptr_t)header, usable_block_size(new_end - (uintptr_t)header), BLOCK_FLAGS_AVAILABLE);
+    return true;
 }
 
-/* Create a hole at the end of a heap and try to allocate within it. */
-static void* create_hole_and_alloc(struct heap* heap, size_t alloc_size, bool page_align)
+/* Allocate from a hole, splitting off what is left on either side into new holes. */
+static struct blockheader* alloc_with_hole(struct heap* heap, struct blockheader* hole, size_t size, size_t alignment)
 {
-    /* Expand the heap.
-     */
-    const uint32_t old_end = heap->end;
-    const uint32_t old_len = get_heap_size(heap);
-    size_t block_size = total_block_size(alloc_size);
-    heap_expand(heap, old_len + block_size);
-    const uint32_t new_len = get_heap_size(heap);
-    DEBUG_ASSERT(new_len >= alloc_size);
-    /* Find the header furthest to the end of the heap.
-     */
-    create_or_update_block(heap, get_last_block(heap), old_end, alloc_size, BLOCK_FLAGS_AVAILABLE);
-    /* Try to allocate again.
-     */
-    return heap_alloc(heap, alloc_size, page_align);
-}
-/* Allocate "inside" a hole. */
-static void* alloc_with_hole(struct heap* heap, int32_t hole, size_t alloc_size, bool page_align)
-{
-    DEBUG_ASSERT(hole >= 0);
-    struct blockheader* original_header = (struct blockheader*)ksorted_array_get(heap->blocklist, hole);
-    DEBUG_ASSERT(original_header != NULL);
-    size_t    block_size    = total_block_size(alloc_size);
-    uintptr_t original_addr = (uintptr_t)original_header;
-    size_t    original_size = original_header->size;
-    if (original_size - block_size <= MINIMUM_BLOCK_SIZE) {
-        /* If there is space left over, but not enough to create a hole, expand the allocated memory to include the
-         * extra space.
+    DEBUG_ASSERT(is_hole(hole));
+    hole_remove(heap, hole);
+    const uintptr_t end = get_footer_end(get_footer(hole));
+    const size_t    gap = get_alignment_gap(hole, alignment);
+    if (gap > 0) {
+        /* Leave a hole in front of the block so that its usable memory is aligned.
          */
-        alloc_size += original_size - block_size;
-        block_size = total_block_size(alloc_size);
+        create_hole(heap, (uintptr_t)hole, usable_block_size(gap));
     }
-    if (page_align && !(IS_PAGE_ALIGNED(original_addr))) {
-        /* If address needs to be aligned, page-align it and create a new hole in front.
+    const uintptr_t address   = (uintptr_t)hole + gap;
+    const size_t    available = usable_block_size(end - address);
+    DEBUG_ASSERT(available >= size);
+    if (available - size < MINIMUM_HOLE_SIZE) {
+        /* There isn't enough space left over to create a hole, so expand the block to include it.
          */
-        const size_t              adjusted_size = PAGE_SIZE - (original_addr & 0xFFF) - sizeof(struct blockheader);
-        const uintptr_t           new_addr      = original_addr + adjusted_size;
-        const struct blockheader* header        = create_hole(heap, original_addr, adjusted_size);
-        original_addr  = new_addr;
-        original_size -= header->size;
-        DEBUG_ASSERT(original_size > 0);
-    } else {
-        /* Delete the hole.
-         */
-        ksorted_array_remove(heap->blocklist, hole);
+        return place_block(address, available, BLOCK_FLAGS_ALLOCATED);
     }
-    /* Create the block.
-     */
-    struct blockheader* header = create_or_update_block(heap, -1, original_addr, block_size, BLOCK_FLAGS_ALLOCATED);
-    if (alloc_size - block_size > MINIMUM_BLOCK_SIZE) {
-        /* Create a new hole after the allocated block.
-         */
-        const uintptr_t hole_address = original_addr + sizeof(struct blockheader) + alloc_size + sizeof(struct blockfooter);
-        const size_t    hole_size    = original_size - MINIMUM_BLOCK_SIZE;
-        DEBUG_ASSERT(hole_size > 0);
-        create_hole(heap, hole_address, hole_size);
-    }
-    /* Return a pointer to the usable memory.
-     */
+    struct blockheader* header = place_block(address, size, BLOCK_FLAGS_ALLOCATED);
+    create_hole(heap, address + total_block_size(size), available - total_block_size(size));
     return header;
 }
 
-void* heap_alloc(struct heap* heap, size_t size, bool page_align)
+void* heap_alloc(struct heap* heap, size_t size, size_t alignment)
 {
     SAVE_INTERRUPT_STATE;
     DEBUG_ASSERT(heap != NULL);
     DEBUG_ASSERT(size != 0);
-    /* Find the smallest hole big enough to contain the allocated memory.
+    DEBUG_ASSERT((alignment & (alignment - 1)) == 0);
+    alignment = MAX(alignment, BLOCK_ALIGNMENT);
+    MAKE_ALIGNED(size, BLOCK_ALIGNMENT);
+    /* Find a hole big enough to contain the allocated memory.
      */
-    const size_t  block_size = total_block_size(size);
-    const int32_t hole       = get_smallest_hole(heap, block_size, page_align);
-    if (hole < 0) {
-        /* No hole big enough - try to create a new hole.
+    struct blockheader* hole = find_hole(heap, size, alignment);
+    if (hole == NULL) {
+        /* No hole big enough - try to create a new hole at the end of the heap. Bins only guarantee a fit from the
+         * next size class up, so the tail hole may fit even though the search missed it.
          */
-        void* ptr = create_hole_and_alloc(heap, size, page_align);
-        RESTORE_INTERRUPT_STATE;
-        return ptr;
+        hole = get_last_block(heap);
+        if (hole == NULL || !(is_hole(hole)) || hole->size < size + get_alignment_gap(hole, alignment)) {
+            if (!(grow_heap(heap, size + (alignment > BLOCK_ALIGNMENT ? alignment + MINIMUM_HOLE_SIZE : 0)))) {
+                RESTORE_INTERRUPT_STATE;
+                return NULL;
+            }
+            hole = get_last_block(heap);
+        }
+        DEBUG_ASSERT(hole != NULL && is_hole(hole));
     }
     /* Allocate using the hole we found.
      */
-    struct blockheader* header = alloc_with_hole(heap, hole, size, page_align);
+    struct blockheader* header = alloc_with_hole(heap, hole, size, alignment);
     /* Update statistics & return the allocated block (usable part).
      */
+    header->owner = mem_account_current();
+    mem_account_charge_heap(header->owner, header->size);
     heap->alloc_count++;
     heap->bytes_allocd += header->size;
     RESTORE_INTERRUPT_STATE;
     return (void*)get_usable_address(header);
 }
 
-static uint32_t heap_contract(struct heap* heap, size_t new_size)
-{
-    uint32_t old_size = get_heap_size(heap);
-    DEBUG_ASSERT(new_size < old_size);
-    MAKE_PAGE_ALIGNED(new_size);
-    if (new_size < MINIMUM_HEAP_SIZE) {
-        new_size = MINIMUM_HEAP_SIZE;
-    }
-    uint32_t i = 0;
-    for (i = old_size - PAGE_SIZE; i > new_size; i -= PAGE_SIZE) {
-        frame_free(page_get(heap->start + i, kernel_directory, false));
-    }
-    heap->end = heap->start + new_size;
-    return new_size;
-}
-
-enum {
-    NO_UNIFY    = 0,
-    UNIFY_LEFT  = 1 << 0,
-    UNIFY_RIGHT = 1 << 1
-};
-
-static int unify_left(struct blockheader** pheader, struct blockfooter* footer)
-{
-    struct blockfooter* test_footer = (struct blockfooter*)((uintptr_t)*pheader - sizeof(*test_footer));
-    if (test_footer->magic == BLOCK_MAGIC && TEST_FLAG(test_footer->header->flags, BLOCK_FLAGS_AVAILABLE)) {
-       /* Unify with the hole to the left.
-        */
-        size_t cached_size = (*pheader)->size;
-        *pheader = test_footer->header;
-        footer->header = *pheader;
-        (*pheader)->size += cached_size;
-        return UNIFY_LEFT;
-    }
-    return NO_UNIFY;
-}
-
-static int unify_right(struct heap* heap, struct blockheader* header, struct blockfooter** pfooter)
-{
-    struct blockheader* test_header = (struct blockheader*)((uintptr_t)*pfooter + sizeof(**pfooter));
-    if (test_header->magic == BLOCK_MAGIC && TEST_FLAG(test_header->flags, BLOCK_FLAGS_AVAILABLE)) {
-        /* Unify with the hole to the right.
-         */
-        header->size += test_header->size;
-        *pfooter = (struct blockfooter*)get_footer_address(test_header);
-        (*pfooter)->magic  = BLOCK_MAGIC;
-        (*pfooter)->header = header;
-        /* Remove the header from the blocklist.
-        */
-        uint32_t i, j;
-        for (i = 0, j = ksorted_array_count(heap->blocklist); i < j; ++i) {
-            if (ksorted_array_get(heap->blocklist, i) == (void*)test_header) {
-               break;
-            }
-        }
-        DEBUG_ASSERT(i < j);
-        ksorted_array_remove(heap->blocklist, i);
-        return UNIFY_RIGHT;
-    }
-    return NO_UNIFY;
-}
-
-/* Try to unify a hole with holes to the left or right. Returns 1 if unified left, 2 if unified right, 3 if both, 0 if neither. */
-static int unify_holes(struct heap* heap, struct blockheader** header, struct blockfooter** footer)
-{
-    DEBUG_ASSERT(header != NULL);
-    DEBUG_ASSERT(*header != NULL);
-    DEBUG_ASSERT(footer != NULL);
-    DEBUG_ASSERT(*footer != NULL);
-    return unify_left(header, *footer) | unify_right(heap, *header, footer);
-}
-
 void heap_free(struct heap* heap, void* ptr)
 {
     SAVE_INTERRUPT_STATE;
@@ -487,67 +526,149 @@ void heap_free(struct heap* heap, void* ptr)
     /* Find the block's header and footer and mark it as a hole.
      */
     struct blockheader* header = (struct blockheader*)((uintptr_t)ptr - sizeof(*header));
-    struct blockfooter* footer = (struct blockfooter*)((uintptr_t)header + header->size - sizeof(*footer));
     DEBUG_ASSERT(header->magic == BLOCK_MAGIC);
-    DEBUG_ASSERT(footer->magic == BLOCK_MAGIC);
-    DEBUG_ASSERT(footer->header == header);
+    DEBUG_ASSERT(get_footer(header)->magic == BLOCK_MAGIC);
+    DEBUG_ASSERT(get_footer(header)->header == header);
+    DEBUG_ASSERT(!(is_hole(header))); /* Check for double-free. */
     const size_t original_size = header->size;
+    mem_account_uncharge_heap(header->owner, original_size);
     header->flags |= BLOCK_FLAGS_AVAILABLE;
-    /* Attempt to unify the hole with adjacent holes.
+    /* Unify the hole with adjacent holes. The neighbours are found through the boundary tags and unlinked from their
+     * bin or the tree directly, so this doesn't depend on the number of holes (beyond the tree's logarithmic height).
      */
-    const int  unify_result = unify_holes(heap, &header, &footer);
-    const bool unified_left = TEST_FLAG(unify_result, UNIFY_LEFT);
-    const bool add_to_list  = !(unified_left);
-    if (get_footer_end(footer) >= heap->end) {
-        /* Contract the heap.
-         */
-        const size_t old_len = get_heap_size(heap);
-        const size_t new_len = heap_contract(heap, (uint32_t)header - heap->start);
-        if (header->size - (old_len - new_len) > 0) {
-            /* Resize the current block.
-             */
-            header->size -= old_len - new_len;
-            footer = (struct blockfooter*)((uint32_t)footer + header->size - sizeof(*footer));
-            footer->magic  = BLOCK_MAGIC;
-            footer->header = header;
-        } else {
-            /* Current block will no longer exist: remove it from the blocklist.
-             */
-            uint32_t i, j;
-            for (i = 0, j = ksorted_array_count(heap->blocklist); i < j; ++i) {
-                if (ksorted_array_get(heap->blocklist, i) == (void*)header) {
-                    break;
-                }
-            }
-            if (i < j) {
-                ksorted_array_remove(heap->blocklist, i);
-            }
-        }
+    struct blockheader* next = get_next_block(heap, header);
+    if (next != NULL && is_hole(next)) {
+        hole_remove(heap, next);
+        header->size += total_block_size(next->size);
+        next->magic   = 0;
+    }
+    struct blockheader* previous = get_previous_block(heap, header);
+    if (previous != NULL && is_hole(previous)) {
+        hole_remove(heap, previous);
+        previous->size += total_block_size(header->size);
+        header->magic   = 0;
+        header          = previous;
     }
-    if (add_to_list) {
-        ksorted_array_add(heap->blocklist, (void*)header);
+    place_block((uintptr_t)header, header->size, BLOCK_FLAGS_AVAILABLE);
+    /* Contract the heap if the hole is at the end, then put whatever is left of it into its bin.
+     */
+    bool keep = true;
+    if (get_footer_end(get_footer(header)) == heap->end) {
+        keep = shrink_heap(heap, header);
+    }
+    if (keep) {
+        hole_insert(heap, header);
     }
     /* Update heap statistics.
      */
     heap->free_count++;
     heap->bytes_allocd -= original_size;
-    DEBUG_ASSERT(heap->free_count <= heap->alloc_count);         /* Check for double-free. */
+    DEBUG_ASSERT(heap->free_count <= heap->alloc_count);     /* Check for double-free. */
     DEBUG_ASSERT(heap->bytes_allocd <= get_heap_size(heap)); /* Check we haven't allocated more bytes than available. */
     RESTORE_INTERRUPT_STATE;
 }
 
+void heap_get_stats(const struct heap* heap, struct heap_stats* stats)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(heap != NULL);
+    DEBUG_ASSERT(stats != NULL);
+    kmemory_fill8(stats, 0, sizeof(*stats));
+    stats->size        = get_heap_size(heap);
+    stats->max_size    = heap->policy.max_size;
+    stats->bytes_used  = heap->bytes_allocd;
+    stats->alloc_count = heap->alloc_count;
+    stats->free_count  = heap->free_count;
+    /* Walk the heap through the boundary tags to count holes and overhead.
+     */
+    const struct blockheader* header = heap->end > heap->start ? (const struct blockheader*)heap->start : NULL;
+    for (; header != NULL; header = get_next_block(heap, header)) {
+        stats->overhead += MINIMUM_BLOCK_SIZE;
+        if (is_hole(header)) {
+            stats->hole_count++;
+            stats->bytes_free += header->size;
+        } else {
+            stats->block_count++;
+        }
+    }
+    RESTORE_INTERRUPT_STATE;
+}
+
+void heap_print_stats(const struct heap* heap)
+{
+    struct heap_stats stats;
+    heap_get_stats(heap, &stats);
+    printk(
+        PRINTK_DEBUG "Heap: <size=%luK,max=%luK,used=%lluB,free=%luB,overhead=%luB,blocks=%lu,holes=%lu>\n",
+        stats.size/1024UL,
+        stats.max_size/1024UL,
+        stats.bytes_used,
+        stats.bytes_free,
+        stats.overhead,
+        stats.block_count,
+        stats.hole_count
+    );
+}
 
-void heap_init(void)
+void heap_set_policy(struct heap* heap, const struct heap_policy* policy)
 {
     SAVE_INTERRUPT_STATE;
-    const uint32_t start = get_heap_region(INITIAL_HEAP_SIZE);
-    DEBUG_ASSERT(UINT32_MAX - INITIAL_HEAP_SIZE > start);
+    DEBUG_ASSERT(heap != NULL);
+    DEBUG_ASSERT(policy != NULL);
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(policy->grow_chunk)   && policy->grow_chunk   > 0);
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(policy->shrink_chunk) && policy->shrink_chunk > 0);
+    DEBUG_ASSERT(policy->min_size <= policy->max_size);
+    DEBUG_ASSERT(get_heap_size(heap) <= policy->max_size);
+    heap->policy = *policy;
+    RESTORE_INTERRUPT_STATE;
+}
+
+void heap_get_kernel_policy(struct heap_policy* policy)
+{
+    DEBUG_ASSERT(policy != NULL);
+    /* Size the heap from the memory map if it's available, otherwise from the amount of installed memory. The heap may
+     * grow to a quarter of available memory, bounded by the virtual range reserved for it.
+     */
+    uint64_t available = memory_size_available();
+    if (available == 0) {
+        available = (uint64_t)memory_size_total()*1024ULL;
+    }
+    uint64_t max_size = MIN(available/4, (uint64_t)KERNEL_HEAP_RESERVED);
+    max_size = MAX(max_size, (uint64_t)INITIAL_HEAP_SIZE);
+    max_size &= ~(uint64_t)(HEAP_GROW_CHUNK - 1);
+    uint64_t initial_size = MAX(available/256, (uint64_t)INITIAL_HEAP_SIZE);
+    initial_size = MIN(initial_size, max_size) & ~(uint64_t)(HEAP_GROW_CHUNK - 1);
+    policy->initial_size = (size_t)initial_size;
+    policy->min_size     = (size_t)initial_size;
+    policy->max_size     = (size_t)max_size;
+    policy->grow_chunk   = HEAP_GROW_CHUNK;
+    policy->shrink_chunk = HEAP_SHRINK_CHUNK;
+}
+
+void __init_text heap_init(void)
+{
+    SAVE_INTERRUPT_STATE;
+    struct heap_policy policy;
+    heap_get_kernel_policy(&policy);
+    printk(
+        PRINTK_DEBUG "Kernel heap policy: <initial=%luK,max=%luK,grow=%luK,shrink=%luK>\n",
+        policy.initial_size/1024UL,
+        policy.max_size/1024UL,
+        policy.grow_chunk/1024UL,
+        policy.shrink_chunk/1024UL
+    );
     /* Try to create the heap.
      */
-    __kernel_heap__ = create_heap(start, start + INITIAL_HEAP_SIZE, INITIAL_HEAP_SIZE, HEAP_FLAGS_WRITEABLE);
+    __kernel_heap__ = create_heap(
+        KERNEL_HEAP_START,
+        KERNEL_HEAP_START + policy.initial_size,
+        policy.max_size,
+        HEAP_FLAGS_WRITEABLE
+    );
     if (__kernel_heap__ == NULL) {
         panic("failed to create heap");
     }
+    heap_set_policy(__kernel_heap__, &policy);
     /* Enable kmalloc/kfree and disable static_alloc.
      */
     enable_kmalloc();
@@ -17,93 +17,189 @@
  * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
  * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
+#include <redshift/hal/cpu.h>
+#include <redshift/hal/smp.h>
 #include <redshift/kernel.h>
 #include <redshift/mem/common.h>
+#include <redshift/mem/frame.h>
 #include <redshift/mem/paging.h>
 #include <redshift/kernel/interrupt.h>
 #include <redshift/mem/heap.h>
+#include <redshift/mem/slab.h>
 #include <redshift/mem/static.h>
+#include <libk/kmemory.h>
 #include <libk/kstring.h>
 
-#define BIT_INDEX(a)  ((a)/(8*4))
-#define BIT_OFFSET(a) ((a)%(8*4))
+/* With PAE, entries are 64 bits wide and a table holds half as many of them, so four directories are needed to cover
+ * the address space. The directories are allocated together and treated as one directory with PAGE_TABLES entries, and
+ * CR3 points at a four-entry page directory pointer table which points at them.
+ */
+#ifdef CONFIG_PAE
+typedef uint64_t table_entry_t;
+#else
+typedef uint32_t table_entry_t;
+#endif
 
 struct page {
-    unsigned present  :  1;
-    unsigned rw       :  1;
-    unsigned user     :  1;
-    unsigned accessed :  1;
-    unsigned written  :  1;
-    unsigned reserved :  7;
-    unsigned frame    : 20;
+    table_entry_t present       :  1;
+    table_entry_t rw            :  1;
+    table_entry_t user          :  1;
+    table_entry_t write_through :  1;
+    table_entry_t cache_disable :  1;
+    table_entry_t accessed      :  1;
+    table_entry_t dirty         :  1;
+    table_entry_t pat           :  1;
+    table_entry_t global        :  1;
+    table_entry_t cow           :  1; /* Copy-on-write: the page is read-only until it's written to, then copied. */
+    table_entry_t available     :  2;
+#ifdef CONFIG_PAE
+    table_entry_t frame         : 40;
+    table_entry_t reserved      : 11;
+    table_entry_t no_execute    :  1;
+#else
+    table_entry_t frame         : 20;
+#endif
 } __packed;
 
 struct page_table {
     struct page pages[PAGE_ENTRIES];
 };
 
+/* The directory's entries are in DIRECTORY_PAGES contiguous frames. The last DIRECTORY_PAGES entries map the directory
+ * onto itself, so while a directory is loaded its entries are at RECURSIVE_DIRECTORY and its page tables are at
+ * RECURSIVE_TABLES. The DIRECTORY_PAGES entries before them are pointed at another directory to reach that directory's
+ * tables the same way.
+ *
+ * Kernel space (the identity map below user space, and everything from KERNEL_SPACE_INDEX up) is mapped by the same
+ * page tables in every directory. Directories are kept in a list so that changes to kernel_directory's kernel space
+ * entries can be copied to the others.
+ */
 struct page_directory {
-    struct page_table* tables[PAGE_TABLES];
-    uint32_t physical_tables[PAGE_TABLES];
-    uint32_t physical_address;
+    phys_addr_t            physical_address; /* Physical address of the directory's entries.                   */
+    uint32_t               cr3;              /* Value loaded into CR3: the directory, or with PAE, its PDPT.   */
+#ifdef CONFIG_PAE
+    uint64_t*              pdpt;             /* Page directory pointer table, from pdpt_pool.                  */
+#endif
+    struct page_directory* next;             /* Next directory in the list.                                    */
 };
 
-extern uint32_t               heap_addr;
-struct page_directory*        kernel_directory;
-static struct page_directory* current_directory;
-static uint32_t*              frames;
-static uint32_t               frames_count;
+/* Mask for the frame address in a table entry. */
+#define ENTRY_FRAME_MASK ((table_entry_t)0x000FFFFFFFFFF000ULL)
 
-static void frame_set(uint32_t addr)
-{
-    uint32_t frame = addr / PAGE_SIZE;
-    SET_BIT(frames[BIT_INDEX(frame)], BIT_OFFSET(frame));
-}
+enum {
+    STATIC_RESERVED_SIZE = 0x200000,                /* Static memory reserved for allocations made after paging_init. */
+    LARGE_PAGE_SIZE      = PAGE_SIZE*PAGE_ENTRIES,  /* Size of a large page (4 MiB, or 2 MiB with PAE).             */
+#ifdef CONFIG_PAE
+    DIRECTORY_PAGES      = 4,                       /* Frames holding a directory's entries.                          */
+    DIRECTORY_ORDER      = 2,                       /* Frame allocator order of DIRECTORY_PAGES.                      */
+#else
+    DIRECTORY_PAGES      = 1,
+    DIRECTORY_ORDER      = 0,
+#endif
+    PDE_PRESENT          = 1 << 0,                  /* Directory entry is present.                                    */
+    PDE_WRITEABLE        = 1 << 1,                  /* Directory entry is writeable.                                  */
+    PDE_USER_MODE        = 1 << 2,                  /* Directory entry is accessible from user mode.                  */
+    PDE_WRITE_THROUGH    = 1 << 3,                  /* Selects PAT entry 1 for a 4 MiB page.                          */
+    PDE_CACHE_DISABLE    = 1 << 4,                  /* Selects PAT entry 2 (uncached) for a 4 MiB page.               */
+    PDE_LARGE            = 1 << 7,                  /* Directory entry maps a 4 MiB page instead of a page table.     */
+    PDE_GLOBAL           = 1 << 8,                  /* 4 MiB page is global (ignored for page tables).                */
+    PDE_TABLE            = PDE_PRESENT | PDE_WRITEABLE | PDE_USER_MODE,
+    CR0_WP               = 1 << 16,                 /* Make read-only pages read-only in kernel mode as well.         */
+    CR0_PG               = 1UL << 31,               /* Paging enable.                                                 */
+    CR4_PSE              = 1 << 4,                  /* Page size extensions enable.                                   */
+    CR4_PAE              = 1 << 5,                  /* Physical address extension enable.                             */
+    CR4_PGE              = 1 << 7,                  /* Global pages enable.                                           */
+    MSR_PAT              = 0x277,                   /* Page attribute table MSR.                                      */
+    PAT_WRITE_COMBINE    = 0x01,                    /* PAT memory type for write-combining.                           */
+    PAT_WC_INDEX         = 1,                       /* PAT entry used for write-combining (PWT=1, PCD=0, PAT=0).      */
+    VGA_FRAMEBUFFER      = 0xA0000,                 /* Legacy VGA framebuffer.                                        */
+    VGA_FRAMEBUFFER_SIZE = 0x20000,                 /* Size of the VGA framebuffer window.                            */
+    INVALIDATE_MAX_PAGES = 32,                      /* Largest range invalidated page by page instead of by a flush.  */
+    BENCHMARK_SWITCHES   = 1000,                    /* Number of CR3 reloads timed by paging_benchmark_switch.        */
+    BENCHMARK_PAGES      = 64,                      /* Number of kernel pages touched after each reload.              */
+    DEMAND_REGIONS_MAX   = 16,                      /* Largest number of demand-paged regions.                        */
+#ifdef CONFIG_PAE
+    PDPT_MAX             = PAGE_SIZE/32,            /* Largest number of page directory pointer tables.               */
+#endif
+    ZERO_POOL_SIZE       = 256,                     /* Largest number of pre-zeroed frames kept in the pool.          */
+    ZERO_POOL_RESERVE    = 1024,                    /* Free frames which are left alone when the pool is refilled.    */
+    RECURSIVE_INDEX      = PAGE_TABLES - DIRECTORY_PAGES,   /* First directory entry which maps the loaded directory. */
+    FOREIGN_INDEX        = PAGE_TABLES - 2*DIRECTORY_PAGES, /* First directory entry which maps another directory.    */
+    RECURSIVE_TABLES     = RECURSIVE_INDEX*(uintptr_t)LARGE_PAGE_SIZE,     /* Page tables of the loaded directory.    */
+    RECURSIVE_DIRECTORY  = RECURSIVE_TABLES + RECURSIVE_INDEX*PAGE_SIZE,   /* Entries of the loaded directory.        */
+    FOREIGN_TABLES       = FOREIGN_INDEX*(uintptr_t)LARGE_PAGE_SIZE,       /* Page tables of the foreign directory.   */
+    FOREIGN_DIRECTORY    = FOREIGN_TABLES + RECURSIVE_INDEX*PAGE_SIZE,     /* Entries of the foreign directory.       */
+    FRAME_WINDOW         = FOREIGN_TABLES - PAGE_SIZE, /* Page through which unmapped frames are reached.             */
+    KERNEL_SPACE_INDEX   = KERNEL_HEAP_START/LARGE_PAGE_SIZE /* First directory entry of kernel space.               */
+};
 
-static void frame_clear(uint32_t addr)
-{
-    uint32_t frame = addr / PAGE_SIZE;
-    CLEAR_BIT(frames[BIT_INDEX(frame)], BIT_OFFSET(frame));
-}
+/* Range of virtual memory which is backed a page at a time when it is first touched. The region can be divided into
+ * slots with a guard page (or pages) at the bottom of each one, which are never backed.
+ */
+struct demand_region {
+    struct page_directory* dir;        /* Page directory, or NULL if the entry is unused.    */
+    uintptr_t              start;      /* Start of the region.                               */
+    uintptr_t              end;        /* End of the region.                                 */
+    size_t                 slot_size;  /* Size of each slot, or 0 if there are no slots.     */
+    size_t                 guard_size; /* Size of the guard at the bottom of each slot.      */
+    page_flags_t           flags;      /* Flags for pages mapped in the region.              */
+};
 
-#if 0
-static uint32_t frame_test(uint32_t addr)
-{
-    uint32_t frame = addr / PAGE_SIZE;
-    return TEST_BIT(frames[BIT_INDEX(frame)], BIT_OFFSET(frame));
-}
+/* Physically contiguous run of frames waiting to be freed. */
+struct frame_run {
+    uint32_t start;
+    uint32_t end;
+};
+
+struct page_directory*        kernel_directory;
+static struct page_directory* current_directories[SMP_CPUS_MAX]; /* Directory loaded by each CPU. */
+static struct page_directory* foreign_directory; /* Directory mapped by FOREIGN_INDEX.   */
+static struct page_directory* foreign_host;      /* Directory whose foreign entries map it. */
+static volatile uint32_t      tlb_generation;    /* Bumped whenever a translation is invalidated. */
+static volatile uint32_t      tlb_seen[SMP_CPUS_MAX]; /* Generation each CPU's TLB is up to date with. */
+static bool                   paging_enabled;    /* Whether CR0.PG is set.              */
+static bool                   large_pages;  /* Whether 4 MiB pages are enabled.  */
+static bool                   global_pages; /* Whether global pages are enabled. */
+static bool                   write_combining; /* Whether the PAT has a write-combining entry. */
+static struct demand_region   demand_regions[DEMAND_REGIONS_MAX];
+static bool                   nontemporal_stores;           /* Whether the CPU has SSE2 (movnti).           */
+static phys_addr_t            zero_pool[ZERO_POOL_SIZE];    /* Free frames which have already been zeroed.  */
+static size_t                 zero_pool_count;              /* Number of frames in zero_pool.               */
+static uint32_t               user_space_index;             /* First directory entry of user space.         */
+static struct kmem_cache*     directory_cache;              /* Cache of cloned page directories.            */
+#ifdef CONFIG_PAE
+/* Page directory pointer tables have to be below 4 GiB, which the frame allocator can't promise, so they're taken from
+ * a page of static memory.
+ */
+static uint64_t             (*pdpt_pool)[4];
+static uint32_t               pdpt_used[PDPT_MAX/32];       /* Bit i is set if pdpt_pool[i] is in use.      */
 #endif
 
-static uint32_t frame_get_first_free(void)
+/* Point a page at a frame. */
+static void page_set(struct page* page, uint32_t frame, page_flags_t flags)
 {
-    uint32_t i, j;
-    for (i = 0; i < BIT_INDEX(frames_count); ++i) {
-        if (frames[i] != 0xFFFFFFFF) {
-            for (j = 0; j < 32; ++j) {
-                if (!(TEST_BIT(frames[i], j))) {
-                    return i * 4 * 8 + j;
-                }
-            }
-        }
-    }
-    return 0;
+    page->present = TEST_FLAG(flags, PAGE_FLAGS_PRESENT)   ? 1 : 0;
+    page->rw      = TEST_FLAG(flags, PAGE_FLAGS_WRITEABLE) ? 1 : 0;
+    page->user    = TEST_FLAG(flags, PAGE_FLAGS_USER_MODE) ? 1 : 0;
+    page->global  = TEST_FLAG(flags, PAGE_FLAGS_GLOBAL)    ? 1 : 0;
+    page->write_through = write_combining && TEST_FLAG(flags, PAGE_FLAGS_WRITE_COMBINE) ? 1 : 0;
+    page->cache_disable = TEST_FLAG(flags, PAGE_FLAGS_UNCACHED) ? 1 : 0;
+    page->cow     = 0;
+    page->frame   = frame;
 }
 
 void frame_alloc(struct page* page, page_flags_t flags)
 {
     SAVE_INTERRUPT_STATE;
     if (page->frame) {
+        RESTORE_INTERRUPT_STATE;
         return; /* Already allocated. */
     }
-    uint32_t i = frame_get_first_free();
-    if (i >= ((uint32_t)-1)) {
+    const phys_addr_t address = TEST_FLAG(flags, PAGE_FLAGS_ZEROED) ? frame_alloc_zeroed() : frame_alloc_order(0);
+    if (address == 0) {
         panic("%s: out of memory", __func__);
     }
-    frame_set(i * PAGE_SIZE);
-    page->present = TEST_FLAG(flags, PAGE_FLAGS_PRESENT)   ? 1 : 0;
-    page->rw      = TEST_FLAG(flags, PAGE_FLAGS_WRITEABLE) ? 1 : 0;
-    page->user    = TEST_FLAG(flags, PAGE_FLAGS_USER_MODE) ? 1 : 0;
-    page->frame   = i;
+    page_set(page, address/PAGE_SIZE, flags);
     RESTORE_INTERRUPT_STATE;
 }
 
@@ -112,30 +208,15 @@ void frame_free(struct page* page)
     SAVE_INTERRUPT_STATE;
     uint32_t frame = page->frame;
     if (!(frame)) {
+        RESTORE_INTERRUPT_STATE;
         return; /* Already freed. */
     }
-    frame_clear(frame);
-    page->frame = 0;
-    RESTORE_INTERRUPT_STATE;
-}
-
-static void page_fault_handler(const struct cpu_state* regs)
-{
-    uint32_t address = 0;
-    asm("mov %%cr2, %0":"=r"(address));
-    bool user    = TEST_BIT(regs->error_code, 2);
-    bool rw      = TEST_BIT(regs->error_code, 1);
-    bool present = TEST_BIT(regs->error_code, 0);
-    printk(
-        PRINTK_ERROR "Page fault at 0x%8lX in %s mode when %s because %s\n",
-        address,
-        user    ? "user"                       : "kernel",
-        rw      ? "writing"                    : "reading",
-        present ? "there was an invalid write" : "the page was not marked present"
-    );
-    if (!(user)) {
-        panic("bug: kernel triggered page fault");
+    if (!(frame_unshare((phys_addr_t)frame*PAGE_SIZE))) {
+        frame_free_order((phys_addr_t)frame*PAGE_SIZE, 0);
     }
+    page->present = 0;
+    page->frame   = 0;
+    RESTORE_INTERRUPT_STATE;
 }
 
 void page_enable(void)
@@ -143,82 +224,1087 @@ void page_enable(void)
     SAVE_INTERRUPT_STATE;
     uint32_t cr0;
     asm volatile("mov %%cr0, %0":"=r"(cr0));
-    cr0 |= 0x80000000;
-    asm volatile("mov %0, %%cr0":"=r"(cr0));
+    cr0 |= CR0_PG;
+    asm volatile("mov %0, %%cr0"::"r"(cr0));
+    paging_enabled = true;
     RESTORE_INTERRUPT_STATE;
 }
 
+/* Make read-only pages read-only in kernel mode as well, so kernel writes to copy-on-write pages fault. */
+static void write_protect_enable(void)
+{
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0":"=r"(cr0));
+    asm volatile("mov %0, %%cr0"::"r"(cr0 | CR0_WP));
+}
+
 void page_disable(void)
 {
     SAVE_INTERRUPT_STATE;
     uint32_t cr0;
     asm volatile("mov %%cr0, %0":"=r"(cr0));
-    cr0 &= ~0x80000000;
-    asm volatile("mov %0, %%cr0":"=r"(cr0));
+    cr0 &= ~CR0_PG;
+    asm volatile("mov %0, %%cr0"::"r"(cr0));
+    paging_enabled = false;
     RESTORE_INTERRUPT_STATE;
 }
 
 void page_directory_load(struct page_directory* dir)
 {
     SAVE_INTERRUPT_STATE;
-    current_directory = dir;
-    asm volatile("mov %0, %%cr3"::"r"(&dir->physical_tables));
+    current_directories[smp_cpu_index()] = dir;
+    asm volatile("mov %0, %%cr3"::"r"(dir->cr3):"memory");
+    RESTORE_INTERRUPT_STATE;
+}
+
+/* Set or clear bits in CR4. */
+static void cr4_set(uint32_t bits, bool set)
+{
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0":"=r"(cr4));
+    cr4 = set ? cr4 | bits : cr4 & ~bits;
+    asm volatile("mov %0, %%cr4"::"r"(cr4):"memory");
+}
+
+struct page_directory* page_directory_current(void)
+{
+    return current_directories[smp_cpu_index()];
+}
+
+/* Flush the current CPU's TLB, including global entries. */
+static void tlb_flush(void)
+{
+    if (global_pages) {
+        /* Toggling CR4.PGE flushes global entries as well as everything else.
+         */
+        cr4_set(CR4_PGE, false);
+        cr4_set(CR4_PGE, true);
+    } else {
+        uint32_t cr3;
+        asm volatile("mov %%cr3, %0\n\tmov %0, %%cr3":"=r"(cr3)::"memory");
+    }
+}
+
+/* Record that a translation has been invalidated on the current CPU, so that the other CPUs flush their TLBs. A CPU
+ * which was up to date stays up to date, since it's the one which did the invalidating.
+ */
+static uint32_t tlb_changed(void)
+{
+    const uint32_t generation = __atomic_add_fetch(&tlb_generation, 1, __ATOMIC_RELEASE);
+    const unsigned cpu        = smp_cpu_index();
+    if (tlb_seen[cpu] == generation - 1) {
+        tlb_seen[cpu] = generation;
+    }
+    return generation;
+}
+
+void page_invalidate(uintptr_t address)
+{
+    asm volatile("invlpg (%0)"::"r"(address):"memory");
+    tlb_changed();
+}
+
+void page_invalidate_all(void)
+{
+    SAVE_INTERRUPT_STATE;
+    tlb_flush();
+    tlb_seen[smp_cpu_index()] = tlb_changed();
     RESTORE_INTERRUPT_STATE;
 }
 
+void page_tlb_sync(void)
+{
+    const unsigned cpu        = smp_cpu_index();
+    const uint32_t generation = __atomic_load_n(&tlb_generation, __ATOMIC_ACQUIRE);
+    if (tlb_seen[cpu] != generation) {
+        if (paging_enabled) {
+            tlb_flush();
+        }
+        tlb_seen[cpu] = generation;
+    }
+}
+
+void page_tlb_shootdown(void)
+{
+    page_tlb_sync();
+    const unsigned self       = smp_cpu_index();
+    const unsigned count      = smp_cpu_count();
+    const uint32_t generation = __atomic_load_n(&tlb_generation, __ATOMIC_ACQUIRE);
+    for (unsigned cpu = 0; cpu < count; ++cpu) {
+        if (cpu != self && tlb_seen[cpu] != generation) {
+            smp_flush_tlb(cpu);
+        }
+    }
+    /* A CPU acknowledges by catching up with the generation, either from the IPI or while it waits for the kernel lock.
+     * Generations wrap, so compare the difference.
+     */
+    for (unsigned cpu = 0; cpu < count; ++cpu) {
+        while (cpu != self && (int32_t)(__atomic_load_n(&(tlb_seen[cpu]), __ATOMIC_ACQUIRE) - generation) < 0) {
+            asm volatile("pause");
+        }
+    }
+}
+
+void page_invalidate_range(uintptr_t address, size_t size)
+{
+    /* Past a few dozen pages, refilling the TLB after a flush is cheaper than a run of invlpgs.
+     */
+    if (size/PAGE_SIZE > INVALIDATE_MAX_PAGES) {
+        page_invalidate_all();
+        return;
+    }
+    for (uintptr_t end = address + size; address < end; address += PAGE_SIZE) {
+        page_invalidate(address);
+    }
+}
+
+/* Convert page_flags_t to directory entry flags. */
+static uint32_t page_flags_to_pde(page_flags_t flags)
+{
+    uint32_t entry = 0;
+    entry |= TEST_FLAG(flags, PAGE_FLAGS_PRESENT)   ? PDE_PRESENT   : 0;
+    entry |= TEST_FLAG(flags, PAGE_FLAGS_WRITEABLE) ? PDE_WRITEABLE : 0;
+    entry |= TEST_FLAG(flags, PAGE_FLAGS_USER_MODE) ? PDE_USER_MODE : 0;
+    entry |= TEST_FLAG(flags, PAGE_FLAGS_GLOBAL)    ? PDE_GLOBAL    : 0;
+    entry |= write_combining && TEST_FLAG(flags, PAGE_FLAGS_WRITE_COMBINE) ? PDE_WRITE_THROUGH : 0;
+    entry |= TEST_FLAG(flags, PAGE_FLAGS_UNCACHED) ? PDE_CACHE_DISABLE : 0;
+    return entry;
+}
+
+/* Get a directory's entries. The loaded directory is reached through its recursive entry and any other directory
+ * through the loaded directory's foreign entry. Before paging is enabled, directories are reached physically. Only one
+ * directory's foreign entries are kept up to date, since the CPUs take turns under the kernel lock.
+ */
+static table_entry_t* directory_entries(struct page_directory* dir)
+{
+    if (!(paging_enabled)) {
+        return (table_entry_t*)(uintptr_t)dir->physical_address;
+    } else if (dir == page_directory_current()) {
+        return (table_entry_t*)RECURSIVE_DIRECTORY;
+    } else if (dir != foreign_directory || foreign_host != page_directory_current()) {
+        for (uint32_t i = 0; i < DIRECTORY_PAGES; ++i) {
+            ((table_entry_t*)RECURSIVE_DIRECTORY)[FOREIGN_INDEX + i] =
+                (dir->physical_address + i*PAGE_SIZE) | PDE_PRESENT | PDE_WRITEABLE;
+        }
+        foreign_directory = dir;
+        foreign_host      = page_directory_current();
+        page_invalidate_range(FOREIGN_TABLES, DIRECTORY_PAGES*LARGE_PAGE_SIZE);
+    }
+    return (table_entry_t*)FOREIGN_DIRECTORY;
+}
+
+/* Get the address through which the page table at an index in a directory is reached. */
+static struct page_table* table_address(struct page_directory* dir, uint32_t index)
+{
+    const table_entry_t* entries = directory_entries(dir);
+    if (!(paging_enabled)) {
+        return (struct page_table*)(uintptr_t)(entries[index] & ENTRY_FRAME_MASK);
+    }
+    return (struct page_table*)((dir == page_directory_current() ? RECURSIVE_TABLES : FOREIGN_TABLES) + index*PAGE_SIZE);
+}
+
+/* Write a directory entry, invalidating the translations it affected. */
+static void directory_write(struct page_directory* dir, uint32_t index, table_entry_t entry)
+{
+    directory_entries(dir)[index] = entry;
+    if (paging_enabled) {
+        page_invalidate((uintptr_t)table_address(dir, index));
+        if (dir == page_directory_current()) {
+            page_invalidate(index*LARGE_PAGE_SIZE);
+        }
+    }
+}
+
+/* Test whether a directory entry is in kernel space, which is mapped by the same page tables in every directory. */
+static bool is_kernel_index(uint32_t index)
+{
+    return index < user_space_index || (KERNEL_SPACE_INDEX <= index && index < FOREIGN_INDEX);
+}
+
+/* Set a directory entry. Kernel space entries of kernel_directory are copied to every other directory. */
+static void directory_set(struct page_directory* dir, uint32_t index, table_entry_t entry)
+{
+    directory_write(dir, index, entry);
+    if (dir == kernel_directory && is_kernel_index(index)) {
+        for (struct page_directory* other = kernel_directory->next; other != NULL; other = other->next) {
+            directory_write(other, index, entry);
+        }
+    }
+}
+
+/* Test whether a directory entry maps a 4 MiB page. */
+static bool is_large_page(struct page_directory* dir, uint32_t index)
+{
+    return TEST_FLAG(directory_entries(dir)[index], PDE_LARGE);
+}
+
+/* Test whether a page table maps nothing. */
+static bool table_is_empty(const struct page_table* table)
+{
+    const table_entry_t* entries = (const table_entry_t*)table->pages;
+    for (uint32_t i = 0; i < PAGE_ENTRIES; ++i) {
+        if (entries[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Allocate an empty page table for a directory slot. Kernel space tables are always added to kernel_directory, which
+ * shares them with every other directory.
+ */
+static struct page_table* table_create(struct page_directory* dir, uint32_t index)
+{
+    if (is_kernel_index(index)) {
+        dir = kernel_directory;
+    }
+    /* Frames can only be zeroed through the frame window once paging is enabled. Before then they're zeroed in place.
+     */
+    const phys_addr_t physical_address = paging_enabled ? frame_alloc_zeroed() : frame_alloc_order(0);
+    if (physical_address == 0) {
+        panic("%s: out of memory", __func__);
+    }
+    directory_set(dir, index, physical_address | PDE_TABLE);
+    struct page_table* table = table_address(dir, index);
+    if (!(paging_enabled)) {
+        kmemory_fill8(table, 0, sizeof(*table));
+    }
+    return table;
+}
+
+/* Remove a page table from a directory and free it. */
+static void table_free(struct page_directory* dir, uint32_t index)
+{
+    const phys_addr_t physical_address = directory_entries(dir)[index] & ENTRY_FRAME_MASK;
+    directory_set(dir, index, 0);
+    page_tlb_shootdown();
+    frame_free_order(physical_address, 0);
+}
+
+/* Map a 4 MiB page, freeing the page table in the slot if it is empty. Returns false if large pages are disabled or the
+ * slot has a page table which is in use.
+ */
+static bool large_page_set(struct page_directory* dir, uint32_t index, phys_addr_t physical_address,
+                           page_flags_t flags)
+{
+    if (!(large_pages) || !(TEST_FLAG(flags, PAGE_FLAGS_PRESENT))) {
+        return false;
+    }
+    const table_entry_t entry = directory_entries(dir)[index];
+    if (TEST_FLAG(entry, PDE_PRESENT) && !(TEST_FLAG(entry, PDE_LARGE))) {
+        if (!(table_is_empty(table_address(dir, index)))) {
+            return false;
+        }
+        table_free(dir, index);
+    }
+    directory_set(dir, index, physical_address | PDE_LARGE | page_flags_to_pde(flags));
+    return true;
+}
+
+static void* window_map(phys_addr_t physical_address);
+
+/* Replace a 4 MiB page with a page table which maps the same memory in 4 KiB pages. The table is filled in before it
+ * replaces the 4 MiB page, so the memory stays mapped throughout: a fault in between would back a demand-paged page
+ * with a fresh frame and lose its contents.
+ */
+static struct page_table* large_page_split(struct page_directory* dir, uint32_t index)
+{
+    if (is_kernel_index(index)) {
+        dir = kernel_directory;
+    }
+    const table_entry_t entry = directory_entries(dir)[index];
+    page_flags_t flags = PAGE_FLAGS_PRESENT;
+    flags |= TEST_FLAG(entry, PDE_WRITEABLE) ? PAGE_FLAGS_WRITEABLE : 0;
+    flags |= TEST_FLAG(entry, PDE_USER_MODE) ? PAGE_FLAGS_USER_MODE : 0;
+    flags |= TEST_FLAG(entry, PDE_GLOBAL)    ? PAGE_FLAGS_GLOBAL    : 0;
+    flags |= TEST_FLAG(entry, PDE_WRITE_THROUGH) ? PAGE_FLAGS_WRITE_COMBINE : 0;
+    flags |= TEST_FLAG(entry, PDE_CACHE_DISABLE) ? PAGE_FLAGS_UNCACHED      : 0;
+    const phys_addr_t physical_address = frame_alloc_order(0);
+    if (physical_address == 0) {
+        panic("%s: out of memory", __func__);
+    }
+    /* The table isn't reachable through the directory yet, so it's filled through the frame window (or in place before
+     * paging is enabled).
+     */
+    struct page_table* table = paging_enabled ? window_map(physical_address)
+                                              : (struct page_table*)(uintptr_t)physical_address;
+    const uint32_t     frame = (entry & ENTRY_FRAME_MASK)/PAGE_SIZE;
+    kmemory_fill8(table, 0, sizeof(*table));
+    for (uint32_t i = 0; i < PAGE_ENTRIES; ++i) {
+        page_set(&(table->pages[i]), frame + i, flags);
+    }
+    directory_set(dir, index, physical_address | PDE_TABLE);
+    return table_address(dir, index);
+}
+
+/* Get the page table at an index in a directory, creating it if it doesn't exist and create is true. A 4 MiB page in
+ * the slot is split.
+ */
+static struct page_table* table_get(struct page_directory* dir, uint32_t index, bool create)
+{
+    const table_entry_t entry = directory_entries(dir)[index];
+    if (TEST_FLAG(entry, PDE_LARGE)) {
+        return large_page_split(dir, index);
+    } else if (TEST_FLAG(entry, PDE_PRESENT)) {
+        return table_address(dir, index);
+    }
+    return create ? table_create(dir, index) : NULL;
+}
+
+/* Free a run of frames. */
+static void frame_run_flush(struct frame_run* run)
+{
+    if (run->end != run->start) {
+        frame_free_range((phys_addr_t)run->start*PAGE_SIZE, run->end - run->start);
+    }
+    run->start = run->end = 0;
+}
+
+/* Add frames to a run, flushing the run first if they aren't contiguous with it. */
+static void frame_run_add(struct frame_run* run, uint32_t frame, uint32_t count)
+{
+    if (frame != run->end) {
+        frame_run_flush(run);
+        run->start = run->end = frame;
+    }
+    run->end += count;
+}
+
+/* Zero a page with non-temporal stores, which bypass the cache so that zeroing doesn't evict anything useful. */
+static void page_zero_nontemporal(void* address)
+{
+    uint32_t* p   = address;
+    uint32_t* end = p + PAGE_SIZE/sizeof(*p);
+    for (; p < end; p += 4) {
+        asm volatile(
+            "movnti %1, 0(%0)\n\t"
+            "movnti %1, 4(%0)\n\t"
+            "movnti %1, 8(%0)\n\t"
+            "movnti %1, 12(%0)"
+            :: "r"(p), "r"(0) : "memory"
+        );
+    }
+    asm volatile("sfence" ::: "memory");
+}
+
+/* Map a frame at the frame window, replacing whatever was there. The window's page table is created by paging_init.
+ * Every CPU invalidates the window before using it, so the other CPUs don't need to be told.
+ */
+static void* window_map(phys_addr_t physical_address)
+{
+    struct page_table* table = table_get(page_directory_current(), FRAME_WINDOW/LARGE_PAGE_SIZE, false);
+    DEBUG_ASSERT(table != NULL);
+    page_set(&(table->pages[(FRAME_WINDOW/PAGE_SIZE) % PAGE_ENTRIES]), physical_address/PAGE_SIZE,
+             PAGE_FLAGS_PRESENT | PAGE_FLAGS_WRITEABLE);
+    asm volatile("invlpg (%0)"::"r"(FRAME_WINDOW):"memory");
+    return (void*)FRAME_WINDOW;
+}
+
+/* Zero a frame by mapping it at the frame window. */
+static void frame_zero(phys_addr_t physical_address)
+{
+    void* address = window_map(physical_address);
+    if (nontemporal_stores) {
+        page_zero_nontemporal(address);
+    } else {
+        kmemory_fill8(address, 0, PAGE_SIZE);
+    }
+}
+
+phys_addr_t frame_alloc_zeroed(void)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(paging_enabled);
+    phys_addr_t physical_address = 0;
+    if (zero_pool_count > 0) {
+        physical_address = zero_pool[--zero_pool_count];
+    } else {
+        physical_address = frame_alloc_order(0);
+        if (physical_address != 0) {
+            frame_zero(physical_address);
+        }
+    }
+    RESTORE_INTERRUPT_STATE;
+    return physical_address;
+}
+
+size_t zero_pool_fill(size_t count)
+{
+    /* Zero one frame at a time with interrupts disabled, so whoever's filling the pool can be preempted in between.
+     */
+    size_t filled = 0;
+    while (filled < count) {
+        SAVE_INTERRUPT_STATE;
+        if (zero_pool_count == ZERO_POOL_SIZE || frame_count_free() <= ZERO_POOL_RESERVE) {
+            RESTORE_INTERRUPT_STATE;
+            break;
+        }
+        const phys_addr_t physical_address = frame_alloc_order(0);
+        if (physical_address == 0) {
+            RESTORE_INTERRUPT_STATE;
+            break;
+        }
+        frame_zero(physical_address);
+        zero_pool[zero_pool_count++] = physical_address;
+        RESTORE_INTERRUPT_STATE;
+        ++filled;
+    }
+    return filled;
+}
+
+phys_addr_t virt_to_phys(uintptr_t address)
+{
+    if (!(paging_enabled)) {
+        return address;
+    }
+    /* Read the translation straight out of the recursive mapping rather than walking the directory.
+     */
+    const table_entry_t pde = ((const table_entry_t*)RECURSIVE_DIRECTORY)[address/LARGE_PAGE_SIZE];
+    if (!(TEST_FLAG(pde, PDE_PRESENT))) {
+        return 0;
+    } else if (TEST_FLAG(pde, PDE_LARGE)) {
+        return (pde & ENTRY_FRAME_MASK & ~(table_entry_t)(LARGE_PAGE_SIZE - 1)) | (address & (LARGE_PAGE_SIZE - 1));
+    }
+    const table_entry_t pte = ((const table_entry_t*)RECURSIVE_TABLES)[address/PAGE_SIZE];
+    if (!(TEST_FLAG(pte, PDE_PRESENT))) {
+        return 0;
+    }
+    return (pte & ENTRY_FRAME_MASK) | (address & (PAGE_SIZE - 1));
+}
+
 struct page* page_get(uint32_t addr, struct page_directory* dir, bool create)
 {
     SAVE_INTERRUPT_STATE;
     addr /= PAGE_SIZE;
-    uint32_t i = addr / PAGE_ENTRIES;
-    if (dir->tables[i]) {
+    struct page_table* table = table_get(dir, addr / PAGE_ENTRIES, create);
+    RESTORE_INTERRUPT_STATE;
+    return table == NULL ? NULL : &(table->pages[addr % PAGE_ENTRIES]);
+}
+
+void map_range(struct page_directory* dir, uintptr_t virtual_address, phys_addr_t physical_address, size_t size,
+               page_flags_t flags)
+{
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(virtual_address));
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(physical_address));
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(size));
+    SAVE_INTERRUPT_STATE;
+    uint32_t page  = virtual_address/PAGE_SIZE;
+    uint32_t frame = physical_address/PAGE_SIZE;
+    uint32_t count = size/PAGE_SIZE;
+    /* Use a 4 MiB page wherever the virtual and physical addresses are both 4 MiB-aligned and the range covers the whole
+     * page, and otherwise fill each page table in one go rather than walking the directory for every page. Pages which
+     * weren't present can't be in the TLB, so the range only needs invalidating if something was already mapped.
+     */
+    bool remapped = false;
+    while (count > 0) {
+        const uint32_t first = page % PAGE_ENTRIES;
+        if (first == 0 && frame % PAGE_ENTRIES == 0 && count >= PAGE_ENTRIES &&
+            large_page_set(dir, page/PAGE_ENTRIES, (phys_addr_t)frame*PAGE_SIZE, flags)) {
+            page  += PAGE_ENTRIES;
+            frame += PAGE_ENTRIES;
+            count -= PAGE_ENTRIES;
+            continue;
+        }
+        struct page_table* table = table_get(dir, page/PAGE_ENTRIES, true);
+        const uint32_t     n     = MIN(count, PAGE_ENTRIES - first);
+        for (uint32_t i = 0; i < n; ++i) {
+            remapped = remapped || table->pages[first + i].present;
+            page_set(&(table->pages[first + i]), frame + i, flags);
+        }
+        page  += n;
+        frame += n;
+        count -= n;
+    }
+    if (remapped && dir == page_directory_current()) {
+        page_invalidate_range(virtual_address, size);
+    }
+    RESTORE_INTERRUPT_STATE;
+}
+
+int map_range_alloc(struct page_directory* dir, uintptr_t virtual_address, size_t size, page_flags_t flags)
+{
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(virtual_address));
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(size));
+    SAVE_INTERRUPT_STATE;
+    /* Back the range with the largest blocks that fit, falling back to smaller blocks when none are free, so that a
+     * large range takes a few allocations and is mostly physically contiguous. Blocks are also kept virtually aligned
+     * to their size, so a whole order-FRAME_ORDER_MAX block can be mapped as a 4 MiB page.
+     */
+    const uintptr_t end     = virtual_address + size;
+    uintptr_t       address = virtual_address;
+    while (address < end) {
+        unsigned order = FRAME_ORDER_MAX;
+        while (order > 0 && (((uintptr_t)PAGE_SIZE << order) > end - address ||
+                             !(IS_ALIGNED(address, (uintptr_t)PAGE_SIZE << order)))) {
+            --order;
+        }
+        phys_addr_t physical_address = frame_alloc_order(order);
+        while (physical_address == 0 && order > 0) {
+            physical_address = frame_alloc_order(--order);
+        }
+        if (physical_address == 0) {
+            unmap_range(dir, virtual_address, address - virtual_address, true);
+            RESTORE_INTERRUPT_STATE;
+            return -1;
+        }
+        map_range(dir, address, physical_address, PAGE_SIZE << order, flags);
+        address += PAGE_SIZE << order;
+    }
+    RESTORE_INTERRUPT_STATE;
+    return 0;
+}
+
+void unmap_range(struct page_directory* dir, uintptr_t virtual_address, size_t size, bool free)
+{
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(virtual_address));
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(size));
+    SAVE_INTERRUPT_STATE;
+    uint32_t page  = virtual_address/PAGE_SIZE;
+    uint32_t count = size/PAGE_SIZE;
+    /* Collect physically contiguous frames into runs so they go back to the frame allocator in as few blocks as
+     * possible. A 4 MiB page which is only partly unmapped is split first. Page tables in user space are freed once
+     * they're empty; kernel space tables are kept, as they are meant to be shared between address spaces.
+     */
+    struct frame_run run      = {0, 0};
+    bool             unmapped = false;
+    while (count > 0) {
+        const uint32_t index = page/PAGE_ENTRIES;
+        const uint32_t first = page % PAGE_ENTRIES;
+        const uint32_t n     = MIN(count, PAGE_ENTRIES - first);
+        if (n == PAGE_ENTRIES && is_large_page(dir, index)) {
+            if (free) {
+                /* Frames are only shared a page at a time, so a 4 MiB page is never shared.
+                 */
+                frame_run_add(&run, (directory_entries(dir)[index] & ENTRY_FRAME_MASK)/PAGE_SIZE, PAGE_ENTRIES);
+            }
+            directory_set(dir, index, 0);
+            unmapped = true;
+            page  += n;
+            count -= n;
+            continue;
+        }
+        struct page_table* table = table_get(dir, index, false);
+        for (uint32_t i = 0; table != NULL && i < n; ++i) {
+            struct page* entry = &(table->pages[first + i]);
+            if (!(entry->frame)) {
+                continue;
+            }
+            if (free && !(frame_unshare((phys_addr_t)entry->frame*PAGE_SIZE))) {
+                frame_run_add(&run, entry->frame, 1);
+            }
+            kmemory_fill8(entry, 0, sizeof(*entry));
+            unmapped = true;
+        }
+        if (table != NULL && index < KERNEL_SPACE_INDEX && table_is_empty(table)) {
+            table_free(dir, index);
+        }
+        page  += n;
+        count -= n;
+    }
+    /* Kernel space is mapped in every directory, so it's invalidated whichever directory is loaded. Other CPUs may still
+     * have the old translations, so they have to flush before the frames can be reused.
+     */
+    if (unmapped) {
+        if (dir == page_directory_current() || is_kernel_index(virtual_address/LARGE_PAGE_SIZE)) {
+            page_invalidate_range(virtual_address, size);
+        } else {
+            tlb_changed();
+        }
+        if (free) {
+            page_tlb_shootdown();
+        }
+    }
+    frame_run_flush(&run);
+    RESTORE_INTERRUPT_STATE;
+}
+
+/* Point a directory's CR3 value at its entries. With PAE this takes a PDPT from the pool, and -1 is returned if the pool
+ * is empty.
+ */
+static int directory_set_cr3(struct page_directory* dir)
+{
+#ifdef CONFIG_PAE
+    for (uint32_t i = 0; i < PDPT_MAX; ++i) {
+        if (TEST_BIT(pdpt_used[i/32], i % 32)) {
+            continue;
+        }
+        pdpt_used[i/32] |= 1UL << (i % 32);
+        dir->pdpt = pdpt_pool[i];
+        for (uint32_t j = 0; j < DIRECTORY_PAGES; ++j) {
+            dir->pdpt[j] = (dir->physical_address + j*PAGE_SIZE) | PDE_PRESENT;
+        }
+        dir->cr3 = (uintptr_t)dir->pdpt;
+        return 0;
+    }
+    return -1;
+#else
+    dir->cr3 = dir->physical_address;
+    return 0;
+#endif
+}
+
+/* Copy a user space page table into a new directory. The frames are shared, and writeable pages are made read-only and
+ * copy-on-write in both directories. The new directory is written through the frame window, since it isn't loaded or
+ * reachable through the foreign entries yet.
+ */
+static int table_clone(struct page_directory* src, struct page_directory* dst, uint32_t index)
+{
+    const phys_addr_t physical_address = frame_alloc_zeroed();
+    if (physical_address == 0) {
+        return -1;
+    }
+    struct page* pages  = table_get(src, index, false)->pages;
+    struct page* copy   = window_map(physical_address);
+    int          result = 0;
+    for (uint32_t i = 0; i < PAGE_ENTRIES; ++i) {
+        if (!(pages[i].present)) {
+            continue;
+        }
+        result = frame_share((phys_addr_t)pages[i].frame*PAGE_SIZE);
+        if (result < 0) {
+            break;
+        }
+        if (pages[i].rw) {
+            pages[i].rw  = 0;
+            pages[i].cow = 1;
+        }
+        copy[i] = pages[i];
+    }
+    table_entry_t* entries = window_map(dst->physical_address + (index/PAGE_ENTRIES)*PAGE_SIZE);
+    entries[index % PAGE_ENTRIES] = physical_address | PDE_TABLE;
+    return result;
+}
+
+struct page_directory* page_directory_clone(struct page_directory* src)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(paging_enabled);
+    if (directory_cache == NULL) {
+        directory_cache = kmem_cache_create("page_directory", sizeof(struct page_directory), 0, NULL);
+    }
+    struct page_directory* dir = kmem_cache_alloc(directory_cache);
+    if (dir == NULL) {
+        RESTORE_INTERRUPT_STATE;
+        return NULL;
+    }
+    dir->physical_address = frame_alloc_order(DIRECTORY_ORDER);
+    if (dir->physical_address == 0 || directory_set_cr3(dir) < 0) {
+        if (dir->physical_address != 0) {
+            frame_free_order(dir->physical_address, DIRECTORY_ORDER);
+        }
+        kmem_cache_free(directory_cache, dir);
         RESTORE_INTERRUPT_STATE;
-        return &(dir->tables[i]->pages[addr % PAGE_ENTRIES]);
-    } else if (create) {
-        uint32_t tmp;
-        dir->tables[i] = (struct page_table*)static_alloc_base(sizeof(struct page_table), true, &tmp);
-        kmemory_fill8(dir->tables[i], 0, PAGE_SIZE);
-        dir->physical_tables[i] = tmp | 0x07;
-        return &(dir->tables[i]->pages[addr % PAGE_ENTRIES]);
+        return NULL;
+    }
+    /* Fill in the directory's entries through the frame window. Kernel space points at kernel_directory's tables, and
+     * the directory joins the list so that it sees kernel_directory's changes from here on.
+     */
+    const table_entry_t* kernel_entries = directory_entries(kernel_directory);
+    for (uint32_t i = 0; i < DIRECTORY_PAGES; ++i) {
+        table_entry_t* entries = window_map(dir->physical_address + i*PAGE_SIZE);
+        for (uint32_t j = 0; j < PAGE_ENTRIES; ++j) {
+            const uint32_t index = i*PAGE_ENTRIES + j;
+            if (is_kernel_index(index)) {
+                entries[j] = kernel_entries[index];
+            } else if (index >= RECURSIVE_INDEX) {
+                entries[j] = (dir->physical_address + (index - RECURSIVE_INDEX)*PAGE_SIZE) | PDE_PRESENT | PDE_WRITEABLE;
+            } else {
+                entries[j] = 0;
+            }
+        }
+    }
+    dir->next              = kernel_directory->next;
+    kernel_directory->next = dir;
+    /* Share user space a page table at a time.
+     */
+    int result = 0;
+    for (uint32_t index = user_space_index; index < KERNEL_SPACE_INDEX && result == 0; ++index) {
+        if (TEST_FLAG(directory_entries(src)[index], PDE_PRESENT)) {
+            result = table_clone(src, dir, index);
+        }
+    }
+    /* Demand-paged regions in the source's user space are demand-paged in the copy as well.
+     */
+    for (unsigned i = 0; i < DEMAND_REGIONS_MAX && result == 0 && src != kernel_directory; ++i) {
+        const struct demand_region region = demand_regions[i];
+        if (region.dir == src) {
+            result = page_reserve(dir, region.start, region.end - region.start, region.slot_size, region.guard_size,
+                                  region.flags);
+        }
+    }
+    /* The source's writeable pages are read-only now, so drop their translations. Reloading CR3 keeps global (kernel)
+     * pages in the TLB. Any other CPU with the source loaded has to flush too before copy-on-write can be relied on.
+     */
+    if (src == page_directory_current()) {
+        page_directory_load(src);
+    }
+    tlb_changed();
+    page_tlb_shootdown();
+    if (result < 0) {
+        page_directory_destroy(dir);
+        dir = NULL;
     }
     RESTORE_INTERRUPT_STATE;
-    return NULL;
+    return dir;
 }
 
-enum {
-    HEAP_ADDRESS   = 0x1000000,
-    HEAP_SIZE_INIT = 0x1000
-};
+void page_directory_destroy(struct page_directory* dir)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(dir != kernel_directory);
+    for (unsigned cpu = 0; cpu < SMP_CPUS_MAX; ++cpu) {
+        DEBUG_ASSERT(dir != current_directories[cpu]);
+    }
+    /* Free user space, then the directory itself. Frames which are still shared with another directory are kept.
+     */
+    unmap_range(dir, user_space_index*LARGE_PAGE_SIZE, (KERNEL_SPACE_INDEX - user_space_index)*LARGE_PAGE_SIZE, true);
+    for (unsigned i = 0; i < DEMAND_REGIONS_MAX; ++i) {
+        if (demand_regions[i].dir == dir) {
+            demand_regions[i].dir = NULL;
+        }
+    }
+    struct page_directory* prev = kernel_directory;
+    while (prev->next != dir) {
+        DEBUG_ASSERT(prev->next != NULL);
+        prev = prev->next;
+    }
+    prev->next = dir->next;
+    if (foreign_directory == dir || foreign_host == dir) {
+        foreign_directory = NULL;
+    }
+#ifdef CONFIG_PAE
+    const uint32_t i = (uint32_t)(dir->pdpt - pdpt_pool[0])/4;
+    pdpt_used[i/32] &= ~(1UL << (i % 32));
+#endif
+    frame_free_order(dir->physical_address, DIRECTORY_ORDER);
+    kmem_cache_free(directory_cache, dir);
+    RESTORE_INTERRUPT_STATE;
+}
 
-int paging_init(uint32_t mem_size)
+size_t page_directory_resident(struct page_directory* dir)
 {
     SAVE_INTERRUPT_STATE;
-    uint64_t mem_end = (uint64_t)mem_size * 1024ULL;
-    frames_count = (uint32_t)(mem_end / 0x1000ULL);
-    frames = (uint32_t*)static_alloc(BIT_INDEX(frames_count));
-    kmemory_fill8(frames, 0, BIT_INDEX(frames_count));
-    /* Create kernel page directory.
+    size_t resident = 0;
+    for (uint32_t index = user_space_index; index < KERNEL_SPACE_INDEX; ++index) {
+        const table_entry_t entry = directory_entries(dir)[index];
+        if (TEST_FLAG(entry, PDE_LARGE)) {
+            resident += PAGE_ENTRIES;
+        } else if (TEST_FLAG(entry, PDE_PRESENT)) {
+            const struct page_table* table = table_address(dir, index);
+            for (uint32_t i = 0; i < PAGE_ENTRIES; ++i) {
+                resident += table->pages[i].present;
+            }
+        }
+    }
+    RESTORE_INTERRUPT_STATE;
+    return resident;
+}
+
+/* Point the PAT entry selected by PWT alone at write-combining. The entry's power-on type is write-through, which
+ * nothing uses, and the other entries are left alone so existing mappings keep their types. Each CPU has its own PAT.
+ */
+static void pat_load(void)
+{
+    uint64_t pat = read_msr(MSR_PAT);
+    pat &= ~((uint64_t)0xFF << (PAT_WC_INDEX*8));
+    pat |= (uint64_t)PAT_WRITE_COMBINE << (PAT_WC_INDEX*8);
+    write_msr(MSR_PAT, pat);
+    /* Nothing should be cached under the old type, but flush the caches anyway as the SDM asks.
      */
-    kernel_directory = static_alloc(sizeof(*kernel_directory));
-    kmemory_fill8(kernel_directory, 0, sizeof(*kernel_directory));
-    /* Identity map pages up to heap address. We make the first page non-present so that NULL-pointer dereferences cause
-     * a page fault.
+    asm volatile("wbinvd":::"memory");
+}
+
+/* Enable write-combining on the boot CPU. */
+static void __init_text pat_init(void)
+{
+    pat_load();
+    write_combining = true;
+}
+
+int __init_text paging_init(void)
+{
+    SAVE_INTERRUPT_STATE;
+    /* Set up the frame allocator. Everything below static_end (the kernel, boot modules and static memory) is identity
+     * mapped and never handed out as a frame.
      */
-    frame_alloc(page_get(0, kernel_directory, true), 0);
-    uint32_t i = 0;
-    for (i = PAGE_SIZE; i < heap_addr; i += PAGE_SIZE) {
-        frame_alloc(page_get(i, kernel_directory, true), PAGE_FLAGS_PRESENT);
+    const uintptr_t static_end = frame_init(STATIC_RESERVED_SIZE);
+#ifdef CONFIG_PAE
+    /* PAE has to be enabled before paging. Large (2 MiB) pages are always available with PAE.
+     */
+    if (!(cpu_has_feature(CPU_FEATURE_PAE))) {
+        panic("%s: kernel was built for PAE but the CPU doesn't support it", __func__);
     }
-    /* Map pages for the heap.
-    */
-    for (; i < HEAP_ADDRESS + HEAP_SIZE_INIT; i += PAGE_SIZE) {
-        page_get(i, kernel_directory, true);
+    cr4_set(CR4_PAE, true);
+    large_pages = true;
+#else
+    /* Enable 4 MiB pages if the CPU supports them. Otherwise everything is mapped with page tables.
+     */
+    large_pages = cpu_has_feature(CPU_FEATURE_PSE);
+    if (large_pages) {
+        cr4_set(CR4_PSE, true);
+    }
+#endif
+    /* Create kernel page directory and map it onto itself.
+     */
+    kernel_directory = static_alloc(sizeof(*kernel_directory));
+    kernel_directory->next             = NULL;
+    kernel_directory->physical_address = frame_alloc_order(DIRECTORY_ORDER);
+    if (kernel_directory->physical_address == 0) {
+        panic("%s: out of memory", __func__);
+    }
+    table_entry_t* entries = directory_entries(kernel_directory);
+    kmemory_fill8(entries, 0, DIRECTORY_PAGES*PAGE_SIZE);
+    for (uint32_t i = 0; i < DIRECTORY_PAGES; ++i) {
+        entries[RECURSIVE_INDEX + i] = (kernel_directory->physical_address + i*PAGE_SIZE) | PDE_PRESENT | PDE_WRITEABLE;
+    }
+#ifdef CONFIG_PAE
+    /* Static memory is below 4 GiB and identity mapped, so the PDPT pool is too.
+     */
+    pdpt_pool = (uint64_t(*)[4])static_alloc_base(PAGE_SIZE, ALLOC_PAGE_ALIGN, NULL);
+    kmemory_fill8(pdpt_used, 0, sizeof(pdpt_used));
+#endif
+    directory_set_cr3(kernel_directory);
+    /* Create the frame window's page table now, since creating a page table later on needs the window.
+     */
+    table_get(kernel_directory, FRAME_WINDOW/LARGE_PAGE_SIZE, true);
+    nontemporal_stores = cpu_has_feature(CPU_FEATURE_SSE2);
+    /* Identity map static memory. We leave the first page unmapped so that NULL-pointer dereferences cause a page fault.
+     * With large pages the map is rounded up to a 4 MiB boundary, so that everything above the first 4 MiB takes one TLB
+     * entry per 4 MiB; the extra memory is free frames which are otherwise unmapped, so aliasing them is harmless.
+     */
+    uintptr_t identity_end = static_end;
+    if (large_pages) {
+        MAKE_ALIGNED(identity_end, LARGE_PAGE_SIZE);
     }
-    /* Set page fault handler.
+    user_space_index = (identity_end + LARGE_PAGE_SIZE - 1)/LARGE_PAGE_SIZE;
+    map_range(kernel_directory, PAGE_SIZE, PAGE_SIZE, identity_end - PAGE_SIZE,
+              kernel_page_flags(PAGE_FLAGS_PRESENT | PAGE_FLAGS_WRITEABLE));
+    /* Map the VGA framebuffer write-combining, so that console updates go out in bursts instead of stalling on every
+     * store. The MTRRs mark it uncacheable, but a write-combining PAT type takes precedence.
      */
-    set_interrupt_handler(ISR_PAGE_FAULT, page_fault_handler);
+    if (cpu_has_feature(CPU_FEATURE_PAT)) {
+        pat_init();
+        map_range(kernel_directory, VGA_FRAMEBUFFER, VGA_FRAMEBUFFER, VGA_FRAMEBUFFER_SIZE,
+                  kernel_page_flags(PAGE_FLAGS_PRESENT | PAGE_FLAGS_WRITEABLE | PAGE_FLAGS_WRITE_COMBINE));
+    }
     page_directory_load(kernel_directory);
     page_enable();
+    /* Only make read-only pages read-only in kernel mode once the kernel's own memory is mapped writeable, since
+     * copy-on-write depends on it.
+     */
+    write_protect_enable();
+    frame_release_high_memory();
+    /* Enable global pages if the CPU supports them, so kernel mappings stay in the TLB when CR3 is reloaded.
+     */
+    global_pages = cpu_has_feature(CPU_FEATURE_PGE);
+    if (global_pages) {
+        cr4_set(CR4_PGE, true);
+    }
     RESTORE_INTERRUPT_STATE;
     return 0;
 }
+
+void paging_init_ap(void)
+{
+    SAVE_INTERRUPT_STATE;
+    if (write_combining) {
+        pat_load();
+    }
+    page_directory_load(kernel_directory);
+    RESTORE_INTERRUPT_STATE;
+}
+
+void paging_print_stats(void)
+{
+    SAVE_INTERRUPT_STATE;
+    /* Each present 4 MiB page and each present 4 KiB page needs its own TLB entry.
+     */
+    unsigned long large = 0;
+    unsigned long small = 0;
+    const table_entry_t* entries = directory_entries(kernel_directory);
+    for (uint32_t i = 0; i < FOREIGN_INDEX; ++i) {
+        if (TEST_FLAG(entries[i], PDE_LARGE)) {
+            ++large;
+        } else if (TEST_FLAG(entries[i], PDE_PRESENT)) {
+            const struct page_table* table = table_address(kernel_directory, i);
+            for (uint32_t j = 0; j < PAGE_ENTRIES; ++j) {
+                small += table->pages[j].present;
+            }
+        }
+    }
+    printk(
+        PRINTK_DEBUG "Kernel mappings: <pse=%s,large=%lu,small=%lu,tlb_entries=%lu,tlb_entries_without_pse=%lu>\n",
+        large_pages ? "yes" : "no",
+        large,
+        small,
+        large + small,
+        large*PAGE_ENTRIES + small
+    );
+    RESTORE_INTERRUPT_STATE;
+}
+
+int page_reserve(struct page_directory* dir, uintptr_t start, size_t size, size_t slot_size, size_t guard_size,
+                 page_flags_t flags)
+{
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(start));
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(size));
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(slot_size));
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(guard_size));
+    DEBUG_ASSERT(guard_size == 0 || (slot_size > guard_size && size % slot_size == 0));
+    SAVE_INTERRUPT_STATE;
+    for (unsigned i = 0; i < DEMAND_REGIONS_MAX; ++i) {
+        struct demand_region* region = &(demand_regions[i]);
+        if (region->dir == NULL) {
+            region->dir        = dir;
+            region->start      = start;
+            region->end        = start + size;
+            region->slot_size  = slot_size;
+            region->guard_size = guard_size;
+            region->flags      = flags | PAGE_FLAGS_PRESENT;
+            RESTORE_INTERRUPT_STATE;
+            return 0;
+        }
+    }
+    RESTORE_INTERRUPT_STATE;
+    printk(PRINTK_ERROR "Too many demand-paged regions: <start=0x%08lX,size=%luK>\n", start, size/1024);
+    return -1;
+}
+
+/* Find the demand-paged region containing an address in the loaded address space. Kernel regions are in every address
+ * space.
+ */
+static const struct demand_region* demand_region_find(uintptr_t address)
+{
+    for (unsigned i = 0; i < DEMAND_REGIONS_MAX; ++i) {
+        const struct demand_region* region = &(demand_regions[i]);
+        if ((region->dir == page_directory_current() || region->dir == kernel_directory) &&
+            region->start <= address && address < region->end) {
+            return region;
+        }
+    }
+    return NULL;
+}
+
+bool page_is_guard(uintptr_t address)
+{
+    const struct demand_region* region = demand_region_find(address);
+    return region != NULL && region->guard_size > 0 &&
+           (address - region->start) % region->slot_size < region->guard_size;
+}
+
+/* Resolve a write to a copy-on-write page in the loaded address space. If other address spaces still share the frame
+ * the page gets a copy of it, otherwise it's simply made writeable. Returns false if the page isn't copy-on-write.
+ */
+static bool cow_resolve(uintptr_t address, uintptr_t eip)
+{
+    const table_entry_t pde = ((const table_entry_t*)RECURSIVE_DIRECTORY)[address/LARGE_PAGE_SIZE];
+    if (!(TEST_FLAG(pde, PDE_PRESENT)) || TEST_FLAG(pde, PDE_LARGE)) {
+        return false;
+    }
+    struct page* page = &(((struct page*)RECURSIVE_TABLES)[address/PAGE_SIZE]);
+    if (!(page->present) || !(page->cow)) {
+        return false;
+    }
+    address &= ~(uintptr_t)(PAGE_SIZE - 1);
+    if (frame_unshare((phys_addr_t)page->frame*PAGE_SIZE)) {
+        const phys_addr_t physical_address = frame_alloc_order(0);
+        if (physical_address == 0) {
+            panic("%s: out of memory: <address=0x%08lX,eip=0x%08lX>", __func__, address, eip);
+        }
+        kmemory_copy(window_map(physical_address), (const void*)address, PAGE_SIZE);
+        page->frame = physical_address/PAGE_SIZE;
+    }
+    page->rw  = 1;
+    page->cow = 0;
+    page_invalidate(address);
+    return true;
+}
+
+void page_fault_handler(uint32_t error_code, uintptr_t eip)
+{
+    uintptr_t address = 0;
+    asm volatile("mov %%cr2, %0":"=r"(address));
+    const bool user    = TEST_BIT(error_code, 2);
+    const bool rw      = TEST_BIT(error_code, 1);
+    const bool present = TEST_BIT(error_code, 0);
+    SAVE_INTERRUPT_STATE;
+    if (present && rw && cow_resolve(address, eip)) {
+        RESTORE_INTERRUPT_STATE;
+        return;
+    }
+    /* Back the page if it's in a demand-paged region and isn't a guard page.
+     */
+    const struct demand_region* region = present ? NULL : demand_region_find(address);
+    if (region != NULL) {
+        if (page_is_guard(address)) {
+            panic("stack overflow: <address=0x%08lX,eip=0x%08lX>", address, eip);
+        }
+        const phys_addr_t physical_address = frame_alloc_zeroed();
+        if (physical_address == 0) {
+            panic("%s: out of memory: <address=0x%08lX,eip=0x%08lX>", __func__, address, eip);
+        }
+        address &= ~(uintptr_t)(PAGE_SIZE - 1);
+        map_range(region->dir, address, physical_address, PAGE_SIZE, region->flags);
+        RESTORE_INTERRUPT_STATE;
+        return;
+    }
+    RESTORE_INTERRUPT_STATE;
+    printk(
+        PRINTK_ERROR "Page fault at 0x%8lX in %s mode when %s because %s\n",
+        address,
+        user    ? "user"                       : "kernel",
+        rw      ? "writing"                    : "reading",
+        present ? "there was an invalid write" : "the page was not marked present"
+    );
+    if (!(user)) {
+        panic("bug: kernel triggered page fault: <address=0x%08lX,eip=0x%08lX>", address, eip);
+    }
+}
+
+page_flags_t kernel_page_flags(page_flags_t flags)
+{
+    return cpu_has_feature(CPU_FEATURE_PGE) ? flags | PAGE_FLAGS_GLOBAL : flags;
+}
+
+/* Reload CR3 repeatedly, touching kernel pages after each reload as the kernel would after a process switch. Returns
+ * the average number of cycles per reload.
+ */
+static uint64_t time_switches(void)
+{
+    const volatile uint8_t* kernel = (const volatile uint8_t*)&__kernel_start__;
+    const size_t            pages  = MIN(
+        (size_t)BENCHMARK_PAGES,
+        (size_t)((uintptr_t)&__kernel_end__ - (uintptr_t)&__kernel_start__)/PAGE_SIZE
+    );
+    const uint64_t start = read_ticks();
+    for (unsigned i = 0; i < BENCHMARK_SWITCHES; ++i) {
+        page_directory_load(page_directory_current());
+        for (size_t j = 0; j < pages; ++j) {
+            (void)kernel[j*PAGE_SIZE];
+        }
+    }
+    return (read_ticks() - start)/BENCHMARK_SWITCHES;
+}
+
+void __init_text paging_benchmark_switch(void)
+{
+    SAVE_INTERRUPT_STATE;
+    if (!(global_pages)) {
+        printk(PRINTK_DEBUG "Switch benchmark: <global_pages=no,cycles=%llu>\n", time_switches());
+        RESTORE_INTERRUPT_STATE;
+        return;
+    }
+    /* Time switches with global pages, then again with CR4.PGE clear, which makes the global bits ignored.
+     */
+    const uint64_t global = time_switches();
+    cr4_set(CR4_PGE, false);
+    const uint64_t non_global = time_switches();
+    cr4_set(CR4_PGE, true);
+    printk(
+        PRINTK_DEBUG "Switch benchmark: <global_pages=yes,pages=%u,cycles=%llu,cycles_without_global=%llu>\n",
+        BENCHMARK_PAGES,
+        global,
+        non_global
+    );
+    RESTORE_INTERRUPT_STATE;
+}
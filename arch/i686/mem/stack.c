@@ -0,0 +1,97 @@
+/**
+ * \file mem/stack.c
+ * \brief Kernel stack allocator.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <libk/kmemory.h>
+#include <redshift/kernel.h>
+#include <redshift/mem/common.h>
+#include <redshift/mem/paging.h>
+#include <redshift/mem/stack.h>
+
+enum {
+    STACK_SLOTS = KERNEL_STACKS_RESERVED/STACK_SLOT_SIZE
+};
+
+static uint32_t used_slots[STACK_SLOTS/32]; /* Bit i is set if slot i is in use. */
+static bool     reserved;                   /* Whether the stack area has been reserved. */
+
+void* stack_alloc(size_t size)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(size > 0 && size <= STACK_SIZE_MAX);
+    if (!(reserved)) {
+        const page_flags_t flags = kernel_page_flags(PAGE_FLAGS_WRITEABLE);
+        if (page_reserve(kernel_directory, KERNEL_STACKS_START, KERNEL_STACKS_RESERVED, STACK_SLOT_SIZE,
+                         STACK_GUARD_SIZE, flags) < 0) {
+            panic("%s: unable to reserve stack area", __func__);
+        }
+        reserved = true;
+    }
+    for (uint32_t i = 0; i < ARRAY_SIZE(used_slots); ++i) {
+        if (used_slots[i] != UINT32_MAX) {
+            const uint32_t bit = __builtin_ctz(~used_slots[i]);
+            /* Put the stack at the top of the slot, so that the unused space and then the guard are below it. The
+             * stack is backed up front, because a push onto a page that isn't present faults again when the CPU
+             * pushes the fault's frame and becomes a double fault.
+             */
+            const uintptr_t slot   = KERNEL_STACKS_START + (i*32 + bit)*STACK_SLOT_SIZE;
+            const uintptr_t top    = slot + STACK_SLOT_SIZE;
+            const uintptr_t bottom = (top - size) & ~(uintptr_t)(PAGE_SIZE - 1);
+            const page_flags_t flags = kernel_page_flags(PAGE_FLAGS_PRESENT | PAGE_FLAGS_WRITEABLE);
+            if (map_range_alloc(kernel_directory, bottom, top - bottom, flags) < 0) {
+                break;
+            }
+            kmemory_fill8((void*)bottom, 0, top - bottom);
+            used_slots[i] |= 1UL << bit;
+            RESTORE_INTERRUPT_STATE;
+            return (void*)(top - size);
+        }
+    }
+    RESTORE_INTERRUPT_STATE;
+    return NULL;
+}
+
+void stack_free(void* stack)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT((uintptr_t)stack >= KERNEL_STACKS_START + STACK_GUARD_SIZE);
+    DEBUG_ASSERT((uintptr_t)stack <  KERNEL_STACKS_START + KERNEL_STACKS_RESERVED);
+    const uint32_t  index = ((uintptr_t)stack - KERNEL_STACKS_START)/STACK_SLOT_SIZE;
+    const uintptr_t slot  = KERNEL_STACKS_START + index*STACK_SLOT_SIZE;
+    DEBUG_ASSERT(used_slots[index/32] & (1UL << (index % 32)));
+    unmap_range(kernel_directory, slot, STACK_SLOT_SIZE, true);
+    used_slots[index/32] &= ~(1UL << (index % 32));
+    RESTORE_INTERRUPT_STATE;
+}
+
+size_t stack_high_water(const void* stack)
+{
+    if ((uintptr_t)stack < KERNEL_STACKS_START || (uintptr_t)stack >= KERNEL_STACKS_START + KERNEL_STACKS_RESERVED) {
+        return 0;
+    }
+    /* Stacks are zeroed when they're allocated, so the lowest non-zero word is as deep as the stack has ever been.
+     */
+    const uint32_t  index = ((uintptr_t)stack - KERNEL_STACKS_START)/STACK_SLOT_SIZE;
+    const uintptr_t top   = KERNEL_STACKS_START + (index + 1)*STACK_SLOT_SIZE;
+    for (const uint32_t* word = stack; (uintptr_t)word < top; ++word) {
+        if (*word != 0) {
+            return top - ((uintptr_t)word & ~(uintptr_t)(PAGE_SIZE - 1));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+/**
+ * \file mem/vmalloc.c
+ * \brief Virtually contiguous kernel allocator.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <redshift/kernel.h>
+#include <redshift/mem/account.h>
+#include <redshift/mem/common.h>
+#include <redshift/mem/paging.h>
+#include <redshift/mem/vmalloc.h>
+
+enum {
+    VMALLOC_PAGES = KERNEL_VMALLOC_RESERVED/PAGE_SIZE
+};
+
+/* The area is managed a page at a time with a pair of bitmaps. A run of used pages is an allocation followed by its
+ * guard page, and the allocation's last page is marked in last_pages so that vfree can find its end.
+ */
+static uint32_t used_pages[VMALLOC_PAGES/32]; /* Bit i is set if page i is allocated or a guard page. */
+static uint32_t last_pages[VMALLOC_PAGES/32]; /* Bit i is set if page i is the last of an allocation. */
+static uint8_t  owners[VMALLOC_PAGES];        /* Account charged for the allocation at page i (< MEM_ACCOUNTS_MAX). */
+
+/* Test whether a page's bit is set in a bitmap. */
+static bool page_test(const uint32_t* bitmap, uint32_t page)
+{
+    return (bitmap[page/32] & (1UL << (page % 32))) != 0;
+}
+
+/* Set or clear a run of bits in a bitmap. */
+static void page_mark(uint32_t* bitmap, uint32_t page, uint32_t count, bool set)
+{
+    for (uint32_t end = page + count; page < end; ++page) {
+        if (set) {
+            bitmap[page/32] |= 1UL << (page % 32);
+        } else {
+            bitmap[page/32] &= ~(1UL << (page % 32));
+        }
+    }
+}
+
+/* Find the first run of free pages which is long enough. Returns VMALLOC_PAGES if there isn't one. */
+static uint32_t find_free_run(uint32_t count)
+{
+    uint32_t run = 0;
+    for (uint32_t page = 0; page < VMALLOC_PAGES; ++page) {
+        if (page % 32 == 0 && used_pages[page/32] == UINT32_MAX) {
+            run   = 0;
+            page += 31;
+        } else if (page_test(used_pages, page)) {
+            run = 0;
+        } else if (++run == count) {
+            return page + 1 - count;
+        }
+    }
+    return VMALLOC_PAGES;
+}
+
+void* vmalloc(size_t size)
+{
+    DEBUG_ASSERT(size > 0);
+    SAVE_INTERRUPT_STATE;
+    const uint32_t count = (size + PAGE_SIZE - 1)/PAGE_SIZE;
+    const uint32_t page  = find_free_run(count + 1);
+    if (page == VMALLOC_PAGES) {
+        RESTORE_INTERRUPT_STATE;
+        printk(PRINTK_ERROR "Vmalloc area exhausted: <size=%luK>\n", size/1024);
+        return NULL;
+    }
+    /* Back the pages but not the guard after them, so running off the end faults.
+     */
+    const uintptr_t address = KERNEL_VMALLOC_START + page*PAGE_SIZE;
+    const page_flags_t flags = kernel_page_flags(PAGE_FLAGS_PRESENT | PAGE_FLAGS_WRITEABLE);
+    if (map_range_alloc(kernel_directory, address, count*PAGE_SIZE, flags) < 0) {
+        RESTORE_INTERRUPT_STATE;
+        return NULL;
+    }
+    page_mark(used_pages, page, count + 1, true);
+    page_mark(last_pages, page + count - 1, 1, true);
+    /* Charge the pages like a heap block, so that the large kmallocs which come here are counted too.
+     */
+    owners[page] = (uint8_t)mem_account_current();
+    mem_account_charge_heap(owners[page], count*PAGE_SIZE);
+    RESTORE_INTERRUPT_STATE;
+    return (void*)address;
+}
+
+void vfree(void* ptr)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(is_vmalloc_address(ptr));
+    DEBUG_ASSERT(IS_PAGE_ALIGNED((uintptr_t)ptr));
+    const uint32_t page = ((uintptr_t)ptr - KERNEL_VMALLOC_START)/PAGE_SIZE;
+    DEBUG_ASSERT(page_test(used_pages, page));
+    uint32_t count = 1;
+    while (!(page_test(last_pages, page + count - 1))) {
+        ++count;
+    }
+    unmap_range(kernel_directory, (uintptr_t)ptr, count*PAGE_SIZE, true);
+    mem_account_uncharge_heap(owners[page], count*PAGE_SIZE);
+    page_mark(last_pages, page + count - 1, 1, false);
+    page_mark(used_pages, page, count + 1, false);
+    RESTORE_INTERRUPT_STATE;
+}
@@ -21,12 +21,24 @@
 #ifndef REDSHIFT_BOOT_GDT_H
 #define REDSHIFT_BOOT_GDT_H
 
-#include <redshift/kernel.h>
+/** Selector of the segment based at the current CPU's struct cpu_local. */
+#define CPU_LOCAL_SELECTOR 0x30
+
+#ifndef __ASM_SOURCE__
+# include <redshift/kernel.h>
 
 /**
- * Initialises the Global Descriptor Table.
- * \return On success, 0 is returned. On error, -1  is returned.
+ * Initialises the Global Descriptor Table of every CPU and loads the boot CPU's. Each CPU has its own GDT so that its
+ * TSS and CPU_LOCAL_SELECTOR segment can be its own.
  */
 void gdt_init(void);
 
+/**
+ * Get the address of a CPU's GDT pointer, which is what lgdt (and loadgdt) take.
+ * \param cpu The CPU index.
+ * \return The address of the GDT pointer.
+ */
+uint32_t gdt_get_pointer(unsigned cpu);
+#endif /* ! __ASM_SOURCE__ */
+
 #endif /* ! REDSHIFT_BOOT_GDT_H */
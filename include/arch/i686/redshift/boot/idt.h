@@ -28,6 +28,11 @@
  */
 void idt_init(void);
 
+/**
+ * Load the Interrupt Descriptor Table on the current CPU. Every CPU shares the table set up by idt_init.
+ */
+void idt_load(void);
+
 /* Interrupt Service Routines
  */
 extern void isr0(void);
@@ -38,7 +43,6 @@ extern void isr4(void);
 extern void isr5(void);
 extern void isr6(void);
 extern void isr7(void);
-extern void isr8(void);
 extern void isr9(void);
 extern void isr10(void);
 extern void isr11(void);
@@ -81,5 +85,9 @@ extern void irq12(void);
 extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
+extern void irq16(void);
+extern void irq17(void);
+extern void irq18(void);
+extern void isr_spurious(void);
 
 #endif /* ! REDSHIFT_BOOT_IDT_H */
@@ -30,4 +30,10 @@
  */
 int pit_init(uint32_t freq);
 
+/**
+ * Busy-wait on the PIT. Unlike usleep this works with interrupts disabled, so it can time hardware during boot.
+ * \param usec The number of microseconds to wait.
+ */
+void pit_delay(uint32_t usec);
+
 #endif /* ! _PIT_H */
@@ -21,7 +21,8 @@
 #ifndef REDSHIFT_BOOT_TSS_H
 #define REDSHIFT_BOOT_TSS_H
 
-#define TSS_SELECTOR 0x28
+#define TSS_SELECTOR              0x28
+#define DOUBLE_FAULT_TSS_SELECTOR 0x38 /**< Selector of the current CPU's double-fault task. */
 
 #ifndef __ASM_SOURCE__
 # include <redshift/kernel.h>
@@ -30,9 +31,32 @@ void tss_init(void);
 
 void tss_load(void);
 
-uint32_t get_tss_base(void);
+uint32_t get_tss_base(unsigned cpu);
+
+/**
+ * Get the address of a CPU's double-fault TSS, whose task is entered through the #DF task gate.
+ * \param cpu The CPU index.
+ * \return The address of the TSS.
+ */
+uint32_t get_double_fault_tss_base(unsigned cpu);
 
 size_t get_tss_size(void);
+
+/**
+ * Set the stack the current CPU switches to when an interrupt arrives in user mode.
+ * \param esp0 The top of the current process' kernel stack.
+ */
+void tss_set_kernel_stack(uintptr_t esp0);
+
+/**
+ * Point every CPU's double-fault task at the loaded address space. Called once the kernel's page directory is loaded.
+ */
+void tss_init_double_fault(void);
+
+/**
+ * Report a double fault. Called by the double-fault task, and never returns.
+ */
+void __noreturn double_fault_handler(void);
 #endif /* ! __ASM_SOURCE__ */
 
 #endif /* ! REDSHIFT_BOOT_TSS_H */
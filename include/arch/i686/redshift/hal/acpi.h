@@ -0,0 +1,83 @@
+/**
+ * \file hal/acpi.h
+ * ACPI table parsing.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef REDSHIFT_HAL_ACPI_H
+#define REDSHIFT_HAL_ACPI_H
+
+#include <redshift/boot/multiboot2.h>
+#include <redshift/kernel.h>
+
+enum {
+    ACPI_ISA_IRQS = 16 /**< Number of ISA IRQs which can be redirected by the MADT. */
+};
+
+/** Polarity and trigger mode of an interrupt, as given by an MADT interrupt source override. */
+typedef enum {
+    ACPI_IRQ_ACTIVE_LOW = 1 << 0, /**< Interrupt is active low rather than active high. */
+    ACPI_IRQ_LEVEL      = 1 << 1  /**< Interrupt is level- rather than edge-triggered.  */
+} acpi_irq_flags_t;
+
+/**
+ * Find the ACPI tables and read the interrupt controllers and CPUs from the MADT. The tables are read physically, so
+ * this has to be done before paging is enabled. Finding nothing isn't an error: the machine just stays uniprocessor.
+ * \param mb_tags The multiboot2 tags, which may hold a copy of the RSDP.
+ */
+void acpi_init(struct multiboot2_tag* mb_tags);
+
+/**
+ * Get the physical address of the local APICs.
+ * \return The address, or 0 if there's no MADT.
+ */
+uint32_t acpi_get_lapic_address(void);
+
+/**
+ * Get the physical address of the first I/O APIC.
+ * \return The address, or 0 if there's no I/O APIC.
+ */
+uint32_t acpi_get_ioapic_address(void);
+
+/**
+ * Get the number of usable CPUs, including the boot CPU.
+ * \return The number of CPUs, or 0 if there's no MADT.
+ */
+size_t acpi_get_cpu_count(void);
+
+/**
+ * Get the local APIC ID of a CPU.
+ * \param i The CPU's index in the MADT, from 0 to acpi_get_cpu_count() - 1.
+ * \return The local APIC ID.
+ */
+uint8_t acpi_get_cpu_apic_id(size_t i);
+
+/**
+ * Get the I/O APIC input which an ISA IRQ is wired to.
+ * \param irq The ISA IRQ.
+ * \param flags Receives the interrupt's polarity and trigger mode.
+ * \return The I/O APIC input, relative to the first I/O APIC.
+ */
+uint32_t acpi_get_isa_irq_input(uint8_t irq, acpi_irq_flags_t* flags);
+
+#endif /* ! REDSHIFT_HAL_ACPI_H */
@@ -0,0 +1,87 @@
+/**
+ * \file hal/apic.h
+ * Local and I/O APICs.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef REDSHIFT_HAL_APIC_H
+#define REDSHIFT_HAL_APIC_H
+
+#include <redshift/kernel.h>
+
+/**
+ * Enable the boot CPU's local APIC, calibrate its timer against the PIT, and route the ISA IRQs through the I/O APIC
+ * to the boot CPU instead of through the PICs, which are masked. Requires paging and the ACPI tables.
+ * \return True if the APICs are in use, false if the machine doesn't have them.
+ */
+bool apic_init(void);
+
+/**
+ * Test whether interrupts are delivered through the APICs, i.e. whether apic_init succeeded.
+ * \return True if the APICs are in use.
+ */
+bool apic_enabled(void);
+
+/**
+ * Enable the current CPU's local APIC. apic_init does this for the boot CPU.
+ */
+void lapic_enable(void);
+
+/**
+ * Get the current CPU's local APIC ID.
+ * \return The local APIC ID.
+ */
+uint8_t lapic_get_id(void);
+
+/**
+ * Signal the end of an interrupt to the current CPU's local APIC.
+ */
+void lapic_eoi(void);
+
+/**
+ * Start the current CPU's local APIC timer, which raises IRQ_LAPIC_TIMER periodically.
+ * \param msec The period in milliseconds.
+ */
+void lapic_timer_start(uint32_t msec);
+
+/**
+ * Send an interrupt to another CPU.
+ * \param apic_id The local APIC ID of the CPU.
+ * \param vector The interrupt vector.
+ */
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+
+/**
+ * Send an INIT IPI, which resets a CPU and leaves it waiting for a startup IPI.
+ * \param apic_id The local APIC ID of the CPU.
+ */
+void lapic_send_init(uint8_t apic_id);
+
+/**
+ * Send a startup IPI, which starts a CPU waiting after an INIT IPI in real mode at a page-aligned address below 1 MiB.
+ * \param apic_id The local APIC ID of the CPU.
+ * \param address The address the CPU starts at.
+ */
+void lapic_send_startup(uint8_t apic_id, uintptr_t address);
+
+#endif /* ! REDSHIFT_HAL_APIC_H */
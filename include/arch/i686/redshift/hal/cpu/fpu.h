@@ -0,0 +1,71 @@
+/**
+ * \file hal/cpu/fpu.h
+ * Lazy FPU state switching.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef REDSHIFT_HAL_CPU_FPU_H
+#define REDSHIFT_HAL_CPU_FPU_H
+
+#include <redshift/kernel.h>
+
+enum {
+    FPU_STATE_SIZE  = 512, /**< Size of the FXSAVE area.         */
+    FPU_STATE_ALIGN = 16   /**< Alignment FXSAVE/FXRSTOR need. */
+};
+
+/**
+ * Saved FPU, MMX and SSE registers. Uses the FXSAVE layout, or FNSAVE's on CPUs without FXSR.
+ */
+struct fpu_state {
+    uint8_t data[FPU_STATE_SIZE];
+} __aligned(FPU_STATE_ALIGN);
+
+/**
+ * Enable the FPU, and SSE if the CPU has it, and install the device-not-available handler which switches FPU state
+ * lazily. Until the scheduler starts, the FPU state belongs to the boot thread.
+ */
+void fpu_init(void);
+
+/**
+ * Enable the FPU on an application processor. fpu_init must already have run on the boot CPU.
+ */
+void fpu_init_ap(void);
+
+/**
+ * Tell the FPU code which process is about to run. Nothing is saved or restored here: instead CR0.TS is set, so the
+ * first FPU or SSE instruction the process executes traps, and the registers are switched then. A process which never
+ * uses the FPU never pays for it, and switching back to the process which last used it costs nothing either.
+ * \param state The process' FPU state slot. It should start out NULL; the state is allocated on first use.
+ */
+void fpu_switch(struct fpu_state** state);
+
+/**
+ * Test whether some CPU's FPU holds registers which haven't been saved to a state yet. A process whose state is loaded
+ * has to stay on that CPU.
+ * \param state The process' FPU state, or NULL.
+ * \return True if the state is loaded in a CPU's FPU.
+ */
+bool fpu_loaded(const struct fpu_state* state);
+
+#endif /* ! REDSHIFT_HAL_CPU_FPU_H */
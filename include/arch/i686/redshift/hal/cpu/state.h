@@ -28,7 +28,7 @@
 /**
  * CPU registers state.
  *
- * NB: The members here must have the same order, size and alignment as in isr_irq_stub.asm:cpu_state.
+ * NB: The members here must have the same order, size and alignment as the frame built by isr_irq_stub.S.
  */
 struct cpu_state {
     uint32_t eax;
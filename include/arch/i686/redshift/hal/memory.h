@@ -56,7 +56,7 @@ void memory_init(struct multiboot2_tag* mb_tags);
 /**
  * Parse memory map.
  * \param mb_Tags The multiboot2 tags.
- * \note This has to be called *after* static_init.
+ * \note This has to be called *after* memblock_init.
  */
 void memory_map_init(struct multiboot2_tag* mb_tags);
 
@@ -90,4 +90,10 @@ size_t memory_size_upper(void);
  */
 size_t memory_size_total(void);
 
+/**
+ * Get the amount of memory the memory map marks as available, in bytes.
+ * \return The amount of available memory in bytes, or zero if memory_map_init hasn't been called.
+ */
+uint64_t memory_size_available(void);
+
 #endif /* ! REDSHIFT_HAL_MEMORY_H */
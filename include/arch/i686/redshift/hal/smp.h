@@ -0,0 +1,89 @@
+/**
+ * \file hal/smp.h
+ * Multiprocessor support.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef REDSHIFT_HAL_SMP_H
+#define REDSHIFT_HAL_SMP_H
+
+/** Physical address the application processors start at. It has to be page aligned and below 1 MiB. */
+#define AP_TRAMPOLINE_ADDRESS 0x8000
+
+#ifndef __ASM_SOURCE__
+# include <redshift/kernel.h>
+
+enum {
+    SMP_CPUS_MAX = 8 /**< Largest number of CPUs which are brought up. */
+};
+
+/**
+ * Data private to a CPU. Each CPU's GDT has a segment based at its own copy, which is loaded into GS whenever the CPU
+ * is in the kernel.
+ */
+struct cpu_local {
+    unsigned index;   /**< Index of the CPU, 0 for the boot CPU. Must be first: smp_cpu_index reads it at %gs:0. */
+    uint8_t  apic_id; /**< Local APIC ID of the CPU.                                                           */
+};
+
+/**
+ * Bring up the other CPUs listed in the ACPI tables and switch interrupts over to the APICs. Each CPU starts scheduling
+ * from its own run queue as soon as it's up. Does nothing on a machine without an APIC.
+ */
+void smp_init(void);
+
+/**
+ * Get the index of the CPU which is running the caller. Unless interrupts are disabled, the caller can be moved to
+ * another CPU straight afterwards.
+ * \return The CPU index, from 0 to smp_cpu_count() - 1.
+ */
+unsigned smp_cpu_index(void);
+
+/**
+ * Get the number of CPUs which are running.
+ * \return The number of CPUs.
+ */
+unsigned smp_cpu_count(void);
+
+/**
+ * Get a CPU's private data.
+ * \param cpu The CPU index.
+ * \return The CPU's private data.
+ */
+struct cpu_local* smp_cpu_local(unsigned cpu);
+
+/**
+ * Make another CPU look at its run queue again, e.g. because a process has been made ready on it.
+ * \param cpu The CPU index.
+ */
+void smp_reschedule(unsigned cpu);
+
+/**
+ * Make another CPU flush its TLB (see page_tlb_shootdown).
+ * \param cpu The CPU index.
+ */
+void smp_flush_tlb(unsigned cpu);
+
+#endif /* ! __ASM_SOURCE__ */
+
+#endif /* ! REDSHIFT_HAL_SMP_H */
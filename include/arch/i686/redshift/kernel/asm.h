@@ -29,7 +29,9 @@ enum io_ports {
     PIC_MASTER_CMND = 0x20,  /**< Master PIC command port. */
     PIC_MASTER_DATA = 0x21,  /**< Master PIC data port.    */
     PIT_DATA        = 0x40,  /**< PIT data port.           */
+    PIT_DATA_2      = 0x42,  /**< PIT channel 2 data port. */
     PIT_CMND        = 0x43,  /**< PIT command port.        */
+    PIT_GATE        = 0x61,  /**< PIT channel 2 gate/out.  */
     KEYBOARD_CMND   = 0x64,  /**< Keyboard command port.   */
     KEYBOARD_DATA   = 0x60,  /**< Keyboard data port.      */
     PIC_SLAVE_CMND  = 0xA0,  /**< Slave PIC command port.  */
@@ -65,8 +67,7 @@ void disable_interrupts(void);
 void enable_interrupts(void);
 
 /**
- * Waits until the next interrupt.
- * NB: If called after disable_interrupts, the CPU will never wake up.
+ * Waits until the next interrupt. Interrupts are enabled on return.
  */
 void wait_for_interrupt(void);
 
@@ -85,6 +86,20 @@ extern void __noreturn hang(void);
  */
 uint64_t read_ticks(void);
 
+/**
+ * Reads a model-specific register.
+ * \param msr The register to read.
+ * \return The value of the register is returned.
+ */
+uint64_t read_msr(uint32_t msr);
+
+/**
+ * Writes a model-specific register.
+ * \param msr The register to write.
+ * \param value The value to write.
+ */
+void write_msr(uint32_t msr, uint64_t value);
+
 /**
  * Writes a byte value to a port.
  * \param port The port to write to.
@@ -41,6 +41,11 @@
 #define IRQ14 46
 #define IRQ15 47
 
+#define IRQ_LAPIC_TIMER 48   /**< Local APIC timer, which preempts processes on the application processors. */
+#define IRQ_RESCHEDULE  49   /**< Inter-processor interrupt asking a CPU to look at its run queue again.    */
+#define IRQ_TLB_FLUSH   50   /**< Inter-processor interrupt asking a CPU to flush its TLB.                  */
+#define IRQ_SPURIOUS    0xFF /**< Spurious interrupt from the local APIC.                                   */
+
 typedef enum {
     ISR_TYPE_ABORT,
     ISR_TYPE_FAULT,
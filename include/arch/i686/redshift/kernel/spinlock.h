@@ -0,0 +1,91 @@
+/**
+ * \file kernel/spinlock.h
+ * Spinlocks and the kernel lock.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef REDSHIFT_KERNEL_SPINLOCK_H
+#define REDSHIFT_KERNEL_SPINLOCK_H
+
+#include <libk/kmacro.h>
+#include <libk/ktypes.h>
+
+/**
+ * Ticket spinlock. CPUs which are waiting for the lock get it in the order they asked for it, so none of them can be
+ * starved by the others.
+ */
+typedef struct {
+    volatile uint16_t next;  /**< Next ticket to hand out.           */
+    volatile uint16_t owner; /**< Ticket which currently holds it.   */
+} spinlock_t;
+
+/** Initialiser for an unlocked spinlock. */
+#define SPINLOCK_INIT {0, 0}
+
+/**
+ * Take a spinlock, spinning until it's free. The lock isn't recursive, and interrupts should be disabled while it's
+ * held if an interrupt handler can take it too.
+ * \param lock The lock.
+ */
+__always_inline static inline void spin_lock(spinlock_t* lock)
+{
+    const uint16_t ticket = __atomic_fetch_add(&(lock->next), 1, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&(lock->owner), __ATOMIC_ACQUIRE) != ticket) {
+        asm volatile("pause");
+    }
+}
+
+/**
+ * Release a spinlock taken by spin_lock.
+ * \param lock The lock.
+ */
+__always_inline static inline void spin_unlock(spinlock_t* lock)
+{
+    __atomic_store_n(&(lock->owner), (uint16_t)(lock->owner + 1), __ATOMIC_RELEASE);
+}
+
+/**
+ * Take the kernel lock, which serialises the kernel's critical sections across CPUs. It can be taken recursively by the
+ * CPU which holds it. Interrupts must be disabled. SAVE_INTERRUPT_STATE takes it, so this is rarely called directly.
+ */
+void kernel_lock(void);
+
+/**
+ * Release the kernel lock once for every time it was taken.
+ */
+void kernel_unlock(void);
+
+/**
+ * Get the number of times the current CPU has taken the kernel lock without releasing it.
+ * \return The depth, or 0 if the current CPU doesn't hold the lock.
+ */
+unsigned kernel_lock_depth(void);
+
+/**
+ * Set the number of times the current CPU holds the kernel lock, taking or releasing it as needed. This lets a process
+ * switch hand the lock from one process to the next, since each process has its own depth.
+ * \param depth The new depth.
+ */
+void kernel_lock_set_depth(unsigned depth);
+
+#endif /* ! REDSHIFT_KERNEL_SPINLOCK_H */
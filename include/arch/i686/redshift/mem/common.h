@@ -24,7 +24,7 @@
 #define ALIGN_MASK(ALIGNMENT)       (~(ALIGNMENT - 1))
 
 /** Test whether X is aligned to ALIGNMENT bytes. */
-#define IS_ALIGNED(X, ALIGNMENT)    (((uintptr_t)(X) & ALIGN_MASK(ALIGNMENT)) == 0)
+#define IS_ALIGNED(X, ALIGNMENT)    (((uintptr_t)(X) & ((ALIGNMENT) - 1)) == 0)
 
 /** Get the address of X when aligned to ALIGNMENT bytes. Returns uintptr_t. */
 #define ALIGNED_ADDR(X, ALIGNMENT)  (((uintptr_t)(X) & ALIGN_MASK(ALIGNMENT)) + ALIGNMENT)
@@ -68,11 +68,11 @@
  */
 #define MAKE_ALLOC_ALIGNED(X, SIZE)\
     do {                           \
-        if (size >= 16) {          \
+        if (SIZE >= 16) {          \
             MAKE_ALIGNED(X, 16);   \
-        } else if (size >= 4) {    \
+        } else if (SIZE >= 4) {    \
             MAKE_ALIGNED(X, 4);    \
-        } else if (size >= 2) {    \
+        } else if (SIZE >= 2) {    \
             MAKE_ALIGNED(X, 2);    \
         }                          \
     } while (0)
@@ -0,0 +1,135 @@
+/**
+ * \file mem/frame.h
+ * Physical frame allocator.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef REDSHIFT_MEM_FRAME_H
+#define REDSHIFT_MEM_FRAME_H 1
+
+#include <redshift/kernel.h>
+#include <redshift/mem/common.h>
+
+#ifdef CONFIG_PAE
+/** Physical address. */
+typedef uint64_t phys_addr_t;
+
+/** End of the physical memory which is used. PAE allows more, but 64 GiB keeps frame numbers well within 32 bits. */
+# define PHYS_ADDR_LIMIT 0x1000000000ULL
+#else
+/** Physical address. */
+typedef uint32_t phys_addr_t;
+
+/** End of the physical memory which is used. The last page is dropped so that the end of a range fits in 32 bits. */
+# define PHYS_ADDR_LIMIT 0xFFFFF000UL
+#endif
+
+enum {
+    FRAME_ORDER_MAX = 10 /**< Largest block the frame allocator manages is 2^FRAME_ORDER_MAX frames (4 MiB). */
+};
+
+/** Frame allocator statistics. Memory used during boot isn't counted as used, so the watermarks show runtime use. */
+struct frame_stats {
+    size_t frame_count;      /**< Number of frames managed.                                            */
+    size_t free_frames;      /**< Number of free frames.                                               */
+    size_t used_frames;      /**< Number of frames allocated and not yet freed.                        */
+    size_t peak_used_frames; /**< High watermark: the largest number of frames allocated at once.      */
+    size_t min_free_frames;  /**< Low watermark: the smallest number of free frames after allocating.  */
+};
+
+/**
+ * Initialise the frame allocator from the boot memory map. Reserves static memory, then hands every available frame
+ * which memblock hasn't allocated to the allocator.
+ * \param static_size The amount of static memory to reserve for allocations made after this call.
+ * \return The end of the memory reserved by the kernel, which has to be identity mapped.
+ */
+uintptr_t frame_init(size_t static_size);
+
+/**
+ * Hand memory which is only needed during boot to the allocator: reclaimable firmware memory and the unused part of
+ * the static memory pool.
+ */
+void frame_release_boot_memory(void);
+
+/**
+ * Hand available memory above 4 GiB to the allocator. Such memory can't be reached until paging is enabled, so it is
+ * held back by frame_init.
+ */
+void frame_release_high_memory(void);
+
+/**
+ * Free the whole pages in a range of identity-mapped boot memory. Partial pages at either end are kept, since they
+ * might be shared with something else.
+ * \param start The start of the range.
+ * \param end The end of the range (exclusive).
+ * \return The number of bytes freed is returned.
+ */
+size_t frame_free_boot_range(uintptr_t start, uintptr_t end);
+
+/**
+ * Allocate a physically contiguous, naturally aligned block of 2^order frames.
+ * \param order The order of the block. Must be at most FRAME_ORDER_MAX.
+ * \return The physical address of the block, or 0 if no block is available. Frame 0 is never handed out.
+ */
+phys_addr_t frame_alloc_order(unsigned order);
+
+/**
+ * Free a block of frames allocated by frame_alloc_order.
+ * \param address The physical address of the block.
+ * \param order The order the block was allocated with.
+ */
+void frame_free_order(phys_addr_t address, unsigned order);
+
+/**
+ * Free a run of frames. The frames need not have been allocated as a single block.
+ * \param address The physical address of the first frame.
+ * \param count The number of frames.
+ */
+void frame_free_range(phys_addr_t address, size_t count);
+
+/**
+ * Add a reference to an allocated frame, so that it can be mapped in another address space.
+ * \param address The physical address of the frame.
+ * \return On success, 0 is returned. If the frame already has the largest number of references, -1 is returned.
+ */
+int frame_share(phys_addr_t address);
+
+/**
+ * Drop a reference to a frame which was added by frame_share.
+ * \param address The physical address of the frame.
+ * \return If the frame had other references, true is returned. Otherwise false is returned and the caller holds the
+ * last reference, so it is the caller's job to free the frame.
+ */
+bool frame_unshare(phys_addr_t address);
+
+/**
+ * Get the number of free frames.
+ * \return The number of free frames.
+ */
+size_t frame_count_free(void);
+
+/**
+ * Get the frame allocator's statistics.
+ * \param stats Receives the statistics.
+ */
+void frame_get_stats(struct frame_stats* stats);
+
+/**
+ * Print the frame allocator's statistics.
+ */
+void frame_print_stats(void);
+
+#endif /* ! REDSHIFT_MEM_FRAME_H */
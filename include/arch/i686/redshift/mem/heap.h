@@ -21,7 +21,6 @@
 #define REDSHIFT_MEM_HEAP_H 1
 
 #include <redshift/kernel.h>
-#include <libk/ksorted_array.h>
 
 /** Heap flags. */
 typedef enum {
@@ -30,9 +29,37 @@ typedef enum {
     HEAP_FLAGS_WRITEABLE  = 1 << 1  /**< Create writeable heap. */
 } heap_flags_t;
 
+/** Kernel heap virtual address range. The heap can grow to fill it, but only pages in use are backed by memory. */
+enum {
+    KERNEL_HEAP_START    = 0xC0000000UL, /**< Start of the kernel heap.                     */
+    KERNEL_HEAP_RESERVED = 0x10000000UL  /**< Size of the range reserved for it (256 MiB).  */
+};
+
 /* Forward declaration for struct heap (mem/heap.c). */
 struct heap;
 
+/** Heap sizing policy. */
+struct heap_policy {
+    size_t initial_size; /**< Initial size of the heap.                                          */
+    size_t min_size;     /**< The heap never shrinks below this size.                            */
+    size_t max_size;     /**< The heap never grows beyond this size.                             */
+    size_t grow_chunk;   /**< The heap grows in multiples of this size. Must be page aligned.    */
+    size_t shrink_chunk; /**< The heap shrinks once this much is free at its end. Page aligned.  */
+};
+
+/** Heap usage statistics. */
+struct heap_stats {
+    size_t   size;        /**< Amount of memory owned by the heap.                 */
+    size_t   max_size;    /**< Maximum size of the heap.                           */
+    uint64_t bytes_used;  /**< Number of bytes in allocated blocks.                */
+    size_t   bytes_free;  /**< Number of bytes in holes.                           */
+    size_t   overhead;    /**< Number of bytes used by block headers and footers.  */
+    size_t   block_count; /**< Number of allocated blocks.                         */
+    size_t   hole_count;  /**< Number of holes.                                    */
+    unsigned alloc_count; /**< Number of times memory was allocated.               */
+    unsigned free_count;  /**< Number of times memory was freed.                   */
+};
+
 /** Default kernel heap. */
 extern struct heap* __kernel_heap__;
 
@@ -46,9 +73,10 @@ void heap_init(void);
  * Create a new heap.
  * \param start The start address.
  * \param end The end address.
- * \param max_size The maximum size of the heap. Must be >= end - start.
+ * \param max_size The maximum size of the heap. Must be >= end - start. The range [start, start + max_size) must be
+ * reserved for the heap.
  * \param Heap flags.
- * \return The new heap.
+ * \return The new heap. It grows and shrinks a page at a time until heap_set_policy is called.
  */
 struct heap* create_heap(uintptr_t start, uintptr_t end, size_t max_size, heap_flags_t flags);
 
@@ -56,10 +84,11 @@ struct heap* create_heap(uintptr_t start, uintptr_t end, size_t max_size, heap_f
  * Allocate a block of memory on a heap.
  * \param heap The heap.
  * \param size The size of the memory to allocate.
- * \param page_align Whether to align the block on a page boundary. Blocks are always aligned to 8-byte boundaries.
- * \return A pointer to the memory block.
+ * \param alignment The alignment of the block. Must be zero or a power of two. Blocks are always aligned to at least
+ * 16-byte boundaries.
+ * \return A pointer to the memory block, or NULL if the heap can't grow large enough.
  */
-void* heap_alloc(struct heap* heap, size_t size, bool page_align);
+void* heap_alloc(struct heap* heap, size_t size, size_t alignment);
 
 /**
  * Free a block of memory allocated on a heap.
@@ -68,4 +97,30 @@ void* heap_alloc(struct heap* heap, size_t size, bool page_align);
  */
 void heap_free(struct heap* heap, void* ptr);
 
+/**
+ * Change a heap's sizing policy.
+ * \param heap The heap.
+ * \param policy The new policy. The heap's current size must not exceed the new maximum size.
+ */
+void heap_set_policy(struct heap* heap, const struct heap_policy* policy);
+
+/**
+ * Get the sizing policy for the kernel heap, which is scaled to the amount of available memory. Requires the memory map.
+ * \param policy Receives the policy.
+ */
+void heap_get_kernel_policy(struct heap_policy* policy);
+
+/**
+ * Get a heap's usage statistics. Walks every block in the heap.
+ * \param heap The heap.
+ * \param stats Receives the statistics.
+ */
+void heap_get_stats(const struct heap* heap, struct heap_stats* stats);
+
+/**
+ * Print a heap's usage statistics.
+ * \param heap The heap.
+ */
+void heap_print_stats(const struct heap* heap);
+
 #endif /* ! REDSHIFT_MEM_HEAP_H */
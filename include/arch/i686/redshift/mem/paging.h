@@ -23,44 +23,232 @@
 
 #include <redshift/kernel.h>
 #include <redshift/kernel/interrupt.h>
+#include <redshift/mem/frame.h>
 
 enum {
-    PAGE_ENTRIES = 1024,
-    PAGE_TABLES  = 1024
+#ifdef CONFIG_PAE
+    PAGE_ENTRIES = 512,  /**< Entries per page table.                                                   */
+    PAGE_TABLES  = 2048  /**< Page tables per address space, in four page directories of 512 entries.   */
+#else
+    PAGE_ENTRIES = 1024, /**< Entries per page table.                                                   */
+    PAGE_TABLES  = 1024  /**< Page tables per address space.                                            */
+#endif
 };
 
 typedef enum {
-    PAGE_FLAGS_PRESENT   = 1 << 0,
-    PAGE_FLAGS_USER_MODE = 1 << 1,
-    PAGE_FLAGS_WRITEABLE = 1 << 2,
+    PAGE_FLAGS_PRESENT       = 1 << 0,
+    PAGE_FLAGS_USER_MODE     = 1 << 1,
+    PAGE_FLAGS_WRITEABLE     = 1 << 2,
+    PAGE_FLAGS_GLOBAL        = 1 << 3, /**< Page isn't flushed from the TLB when CR3 is reloaded. Kernel pages only. */
+    PAGE_FLAGS_ZEROED        = 1 << 4, /**< frame_alloc only: back the page with a zeroed frame.                   */
+    PAGE_FLAGS_WRITE_COMBINE = 1 << 5, /**< Combine writes to the page into bursts (framebuffers). Needs PAT.     */
+    PAGE_FLAGS_UNCACHED      = 1 << 6, /**< Don't cache the page (memory-mapped device registers).                */
 } page_flags_t;
 
 struct page;
 extern struct page_directory* kernel_directory;
 
 /**
- * Initialises paging.
- * \param mem_size The size of memory in kiB.
+ * Initialises the frame allocator and paging. Requires the memory map.
  * \return On success, 0 is returned. On error, -1 is returned.
  */
-int paging_init(uint32_t mem_size);
+int paging_init(void);
+
+/**
+ * Set up paging on an application processor, which has already enabled it with the boot CPU's CR3 and CR4. Loads the
+ * kernel page directory and the CPU's PAT.
+ */
+void paging_init_ap(void);
 
 /**
  * Loads a page directory.
  */
 void page_directory_load(struct page_directory* dir);
 
+/**
+ * Create a copy of an address space. Kernel space is shared with every other directory. User space page tables are
+ * copied but their frames are shared: writeable pages become read-only in both directories and are copied the first
+ * time either one writes to them.
+ * \param src The page directory to copy.
+ * \return The new page directory, or NULL if there isn't enough memory.
+ */
+struct page_directory* page_directory_clone(struct page_directory* src);
+
+/**
+ * Free a page directory created by page_directory_clone, along with its user space pages.
+ * \param dir The page directory. Must not be loaded.
+ */
+void page_directory_destroy(struct page_directory* dir);
+
+/**
+ * Count the pages mapped in a directory's user space. Frames shared with other directories are counted in each.
+ * \param dir The page directory.
+ * \return The number of pages mapped in user space.
+ */
+size_t page_directory_resident(struct page_directory* dir);
+
+/**
+ * Get the loaded page directory.
+ * \return The page directory which was last loaded.
+ */
+struct page_directory* page_directory_current(void);
+
+/**
+ * Invalidate the TLB entry for a page in the loaded page directory. Other CPUs flush their TLBs the next time they take
+ * the kernel lock.
+ * \param address The page address.
+ */
+void page_invalidate(uintptr_t address);
+
+/**
+ * Invalidate the TLB entries for a range of pages in the loaded page directory. Large ranges are flushed entirely.
+ * \param address The start of the range.
+ * \param size The size of the range.
+ */
+void page_invalidate_range(uintptr_t address, size_t size);
+
+/**
+ * Flush the whole TLB, including global pages.
+ */
+void page_invalidate_all(void);
+
+/**
+ * Flush the current CPU's TLB if another CPU has invalidated a translation since it was last flushed. Called by
+ * kernel_lock, so a CPU never works on kernel data through a stale translation.
+ */
+void page_tlb_sync(void);
+
+/**
+ * Make every other CPU flush its TLB if it hasn't since the last invalidation, and wait until they all have. Called
+ * before freed frames are reused or copy-on-write pages are relied on, since a CPU running without the kernel lock
+ * doesn't flush by itself. CPUs which are already up to date aren't interrupted. Call with the kernel lock held.
+ */
+void page_tlb_shootdown(void);
+
 /**
  * Gets a page from memory.
  * \param addr The page address.
  * \param dir The page directory.
  * \param create Whether to create the page if it doesn't exist.
- * \return The desired page.
+ * \return The desired page. It is only valid until another directory is loaded or operated on.
  */
 struct page* page_get(uint32_t addr, struct page_directory* dir, bool create);
 
+/**
+ * Translate a virtual address in the loaded address space to a physical address.
+ * \param address The virtual address.
+ * \return The physical address, or 0 if the address isn't mapped.
+ */
+phys_addr_t virt_to_phys(uintptr_t address);
+
+/**
+ * Map a range of virtual memory onto a range of physical memory, creating page tables as needed. If the CPU supports
+ * PSE, each 4 MiB-aligned block of the range which is also 4 MiB-aligned physically is mapped as a single 4 MiB page.
+ * \param dir The page directory.
+ * \param virtual_address The start of the virtual range. Must be page-aligned.
+ * \param physical_address The start of the physical range. Must be page-aligned.
+ * \param size The size of the range. Must be page-aligned.
+ * \param flags The page flags.
+ */
+void map_range(struct page_directory* dir, uintptr_t virtual_address, phys_addr_t physical_address, size_t size,
+               page_flags_t flags);
+
+/**
+ * Allocate frames for a range of virtual memory and map them, creating page tables as needed. The frames are allocated
+ * in the largest blocks available, so they are not necessarily contiguous.
+ * \param dir The page directory.
+ * \param virtual_address The start of the range. Must be page-aligned.
+ * \param size The size of the range. Must be page-aligned.
+ * \param flags The page flags.
+ * \return On success, 0 is returned. If there are not enough free frames, nothing is mapped and -1 is returned.
+ */
+int map_range_alloc(struct page_directory* dir, uintptr_t virtual_address, size_t size, page_flags_t flags);
+
+/**
+ * Unmap a range of virtual memory. Pages in the range which aren't mapped are skipped.
+ * \param dir The page directory.
+ * \param virtual_address The start of the range. Must be page-aligned.
+ * \param size The size of the range. Must be page-aligned.
+ * \param free Whether to give the frames back to the frame allocator.
+ */
+void unmap_range(struct page_directory* dir, uintptr_t virtual_address, size_t size, bool free);
+
+/**
+ * Reserve a range of virtual memory to be backed a page at a time when it is first touched. Pages are zeroed when they
+ * are backed. The range can be divided into slots, the lowest pages of which are guard pages: touching one is a fatal
+ * error.
+ * \param dir The page directory. Regions in kernel_directory are visible in every address space.
+ * \param start The start of the range. Must be page-aligned.
+ * \param size The size of the range. Must be page-aligned.
+ * \param slot_size The size of each slot, or 0 for no slots. Must be page-aligned.
+ * \param guard_size The size of the guard at the bottom of each slot. Must be page-aligned.
+ * \param flags The page flags.
+ * \return On success, 0 is returned. If too many regions are reserved, -1 is returned.
+ */
+int page_reserve(struct page_directory* dir, uintptr_t start, size_t size, size_t slot_size, size_t guard_size,
+                 page_flags_t flags);
+
+/**
+ * Handle a page fault. Called by the page fault stub with interrupts disabled.
+ * \param error_code The error code pushed by the CPU.
+ * \param eip The address of the faulting instruction.
+ */
+void page_fault_handler(uint32_t error_code, uintptr_t eip);
+
+/**
+ * Check whether an address is in a guard page of a demand-paged region in the loaded address space.
+ * \param address The address.
+ * \return True if the address is in a guard page, otherwise false.
+ */
+bool page_is_guard(uintptr_t address);
+
+/**
+ * Print the number of 4 MiB and 4 KiB pages mapped in the kernel directory, and so the number of TLB entries needed to
+ * cover the kernel's address space with and without 4 MiB pages.
+ */
+void paging_print_stats(void);
+
+/**
+ * Add the flags that every kernel mapping should have to a set of page flags. Kernel mappings are the same in every
+ * address space, so they are made global when the CPU supports it.
+ * \param flags The page flags.
+ * \return The page flags for a kernel mapping.
+ */
+page_flags_t kernel_page_flags(page_flags_t flags);
+
+/**
+ * Time reloading the page directory followed by touching kernel pages, as happens on a process switch, with and without
+ * global pages, and print the results.
+ */
+void paging_benchmark_switch(void);
+
+/**
+ * Allocate a zeroed frame. Frames come from a pool which is refilled in the background by zero_pool_fill; if the pool
+ * is empty a frame is zeroed on the spot.
+ * \return The physical address of the frame is returned, or 0 if there is no free memory.
+ * \note Only usable once paging is enabled.
+ */
+phys_addr_t frame_alloc_zeroed(void);
+
+/**
+ * Zero free frames and add them to the zeroed frame pool. Interrupts are enabled between frames (if they were enabled
+ * on entry), so this can be called from the idle process.
+ * \param count The largest number of frames to zero.
+ * \return The number of frames added to the pool is returned.
+ */
+size_t zero_pool_fill(size_t count);
+
+/**
+ * Allocate a frame for a page.
+ * \param page The page. Nothing is done if the page already has a frame.
+ * \param flags The page flags. With PAGE_FLAGS_ZEROED the frame is zeroed.
+ */
 void frame_alloc(struct page* page, page_flags_t flags);
 
+/**
+ * Free a page's frame and mark the page non-present.
+ * \param page The page.
+ */
 void frame_free(struct page* page);
 
 #endif /* ! REDSHIFT_MEM_PAGING_H */
@@ -0,0 +1,56 @@
+/**
+ * \file mem/stack.h
+ * Kernel stack allocator.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef REDSHIFT_MEM_STACK_H
+#define REDSHIFT_MEM_STACK_H 1
+
+#include <redshift/kernel.h>
+#include <redshift/mem/heap.h>
+
+/** Stack area virtual address range. Each stack gets a slot with a guard page at the bottom, which is never backed by
+ * memory. */
+enum {
+    KERNEL_STACKS_START    = KERNEL_HEAP_START + KERNEL_HEAP_RESERVED, /**< Start of the stack area.             */
+    KERNEL_STACKS_RESERVED = 0x04000000UL,                             /**< Size of the stack area (64 MiB).     */
+    STACK_SLOT_SIZE        = 0x10000UL,                                /**< Size of a stack slot (64 KiB).       */
+    STACK_GUARD_SIZE       = 0x1000UL,                                 /**< Size of the guard below each stack.  */
+    STACK_SIZE_MAX         = STACK_SLOT_SIZE - STACK_GUARD_SIZE        /**< Largest stack which can be allocated. */
+};
+
+/**
+ * Allocate a stack. It's backed by zeroed memory up front, and running off the bottom of the slot hits a guard page.
+ * \param size The size of the stack. Must be at most STACK_SIZE_MAX.
+ * \return The bottom of the stack, or NULL if there are no free slots or no memory to back it.
+ */
+void* stack_alloc(size_t size);
+
+/**
+ * Free a stack allocated with stack_alloc.
+ * \param stack The bottom of the stack.
+ */
+void stack_free(void* stack);
+
+/**
+ * Get the deepest a stack has grown, to the nearest page.
+ * \param stack The bottom of the stack.
+ * \return The number of bytes of the stack which have been used, or 0 if the stack wasn't allocated with stack_alloc.
+ */
+size_t stack_high_water(const void* stack);
+
+#endif /* ! REDSHIFT_MEM_STACK_H */
@@ -0,0 +1,57 @@
+/**
+ * \file mem/vmalloc.h
+ * Virtually contiguous kernel allocator.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef REDSHIFT_MEM_VMALLOC_H
+#define REDSHIFT_MEM_VMALLOC_H 1
+
+#include <redshift/kernel.h>
+#include <redshift/mem/stack.h>
+
+/** Vmalloc area virtual address range. Each allocation is followed by an unmapped guard page. */
+enum {
+    KERNEL_VMALLOC_START    = KERNEL_STACKS_START + KERNEL_STACKS_RESERVED, /**< Start of the vmalloc area.         */
+    KERNEL_VMALLOC_RESERVED = 0x10000000UL,                                 /**< Size of the vmalloc area (256 MiB). */
+    VMALLOC_THRESHOLD       = 0x10000UL  /**< kmalloc passes allocations of at least this size (64 KiB) to vmalloc. */
+};
+
+/**
+ * Allocate memory which is contiguous in kernel space but backed by whatever frames are free, so large buffers don't
+ * need a large block of the kernel heap.
+ * \param size The size of the allocation. It is rounded up to a whole number of pages.
+ * \return A page-aligned pointer to the memory, or NULL if there isn't enough virtual or physical memory.
+ */
+void* vmalloc(size_t size);
+
+/**
+ * Free memory allocated with vmalloc.
+ * \param ptr The pointer returned by vmalloc.
+ */
+void vfree(void* ptr);
+
+/**
+ * Test whether an address is in the vmalloc area.
+ * \param ptr The address.
+ * \return True if the address is in the vmalloc area, otherwise false.
+ */
+__always_inline static inline bool is_vmalloc_address(const void* ptr)
+{
+    return (uintptr_t)ptr - KERNEL_VMALLOC_START < KERNEL_VMALLOC_RESERVED;
+}
+
+#endif /* ! REDSHIFT_MEM_VMALLOC_H */
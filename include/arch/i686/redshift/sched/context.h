@@ -0,0 +1,49 @@
+/* Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef REDSHIFT_SCHED_CONTEXT_H
+#define REDSHIFT_SCHED_CONTEXT_H
+
+#include <redshift/kernel.h>
+
+/**
+ * Switch from one kernel context to another. Only the callee-saved registers are saved, on the current stack, so this
+ * must be called from C.
+ * \param prev Receives the stack pointer of the current context.
+ * \param next The stack pointer of the context to resume, saved by an earlier switch_context or made by context_init.
+ */
+void switch_context(uintptr_t* prev, uintptr_t next);
+
+/**
+ * Make a context on a new stack.
+ * \param stack_top The top of the stack.
+ * \param start The function the first switch_context to the context calls. It must not return.
+ * \return The stack pointer to pass to switch_context.
+ */
+uintptr_t context_init(uintptr_t stack_top, void (*start)(void));
+
+/**
+ * Enter user mode. Interrupts are enabled, and the kernel stack is reset when the process next enters the kernel.
+ * \param eip The user mode entry point.
+ * \param esp The user mode stack pointer.
+ */
+void __noreturn enter_user_mode(uintptr_t eip, uintptr_t esp);
+
+#endif /* ! REDSHIFT_SCHED_CONTEXT_H */
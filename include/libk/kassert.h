@@ -157,7 +157,7 @@
 # define ASSERT_EQUAL_CHAR(A,      B)    __KASSERT_CHECK_EQUAL("assertion",  A, B, char,      "%c")
 # define ASSERT_EQUAL_STRING(A,    B)    __KASSERT_CHECK_STRING("assertion", A, B)
 #else
-# define DEBUG_ASSERT(X) ((void)X)
+# define DEBUG_ASSERT(X) ((void)(X))
 # define ASSERT_EQUAL_INT8_T(A,    B)    do { UNUSED(A); UNUSED(B); } while (0)
 # define ASSERT_EQUAL_INT16_T(A,   B)    do { UNUSED(A); UNUSED(B); } while (0)
 # define ASSERT_EQUAL_INT32_T(A,   B)    do { UNUSED(A); UNUSED(B); } while (0)
@@ -57,4 +57,26 @@ extern void* kextern_dynamic_allocate(size_t size);
  */
 extern void kextern_dynamic_free(void* ptr);
 
+/**
+ * Function to call to create a cache of fixed-size objects.
+ * \param name The name of the cache.
+ * \param size The size of each object.
+ * \return A handle to the cache.
+ */
+extern void* kextern_object_cache_create(const char* name, size_t size);
+
+/**
+ * Function to call to allocate an object from a cache.
+ * \param cache The cache handle.
+ * \return A pointer to the allocated object on success; otherwise NULL.
+ */
+extern void* kextern_object_cache_alloc(void* cache);
+
+/**
+ * Function to call to return an object to a cache.
+ * \param cache The cache handle.
+ * \param ptr A pointer to the object to be freed.
+ */
+extern void kextern_object_cache_free(void* cache, void* ptr);
+
 #endif /* ! REDSHIFT_LIBK_KEXTERN_H */
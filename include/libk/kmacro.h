@@ -65,6 +65,11 @@
 # define __packed                   __attribute__((packed))
 #endif
 
+/** Align a type or variable to N bytes. */
+#ifndef __aligned
+# define __aligned(N)               __attribute__((aligned(N)))
+#endif
+
 /** Mark a function as using printf-like formatting. */
 #ifndef __printf
 # define __printf(FMT, ARGS)        __attribute__((format(printf, FMT, ARGS)))
@@ -88,11 +93,15 @@
 /** Mark a function as non-reentrant. */
 #define __non_reentrant
 
+/** Place a function in the .init.text section, which is freed at the end of boot. */
+#define __init_text                 __attribute__((section(".init.text")))
+
 /**
- * Mark a function as a constructor. Constructors are called in sequence during boot, before the scheduler is started.
+ * Mark a function as a constructor. Constructors are called in sequence during boot, before the scheduler is started,
+ * and are freed afterwards.
  * \param PRIORITY Controls the order in which constructors are called (smallest first).
  */
-#define __init(PRIORITY)            __attribute__((constructor(PRIORITY)))
+#define __init(PRIORITY)            __attribute__((constructor(PRIORITY))) __init_text
 
 /**
  * Mark a function as a destructor. Destructor are called in sequence during shutdown.
@@ -0,0 +1,120 @@
+/* Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free_fn of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef REDSHIFT_LIBK_KTREE_H
+#define REDSHIFT_LIBK_KTREE_H
+
+#include <libk/ktypes.h>
+
+/**
+ * Intrusive AVL tree node. Nodes are embedded in the objects they index, so the tree never allocates memory. Each node
+ * has a key, by which the tree is ordered, and a weight. Every node also records the largest weight in its subtree, so
+ * the lowest-keyed node of at least a given weight can be found in logarithmic time.
+ */
+struct ktree_node {
+    struct ktree_node* left;       /**< Left child.                       */
+    struct ktree_node* right;      /**< Right child.                      */
+    struct ktree_node* parent;     /**< Parent node.                      */
+    uintptr_t          key;        /**< Key.                              */
+    size_t             weight;     /**< Weight.                           */
+    size_t             max_weight; /**< Largest weight in the subtree.    */
+    int                height;     /**< Height of the subtree.            */
+};
+
+/** Intrusive AVL tree. */
+struct ktree {
+    struct ktree_node* root;  /**< Root node.        */
+    size_t             count; /**< Number of nodes.  */
+};
+
+/**
+ * Initialise an empty tree.
+ * \param tree The tree.
+ */
+void ktree_init(struct ktree* tree);
+
+/**
+ * Insert a node into the tree.
+ * \param tree The tree.
+ * \param node The node to insert. Must not already be in a tree.
+ * \param key The node's key. Keys must be unique.
+ * \param weight The node's weight.
+ */
+void ktree_insert(struct ktree* tree, struct ktree_node* node, uintptr_t key, size_t weight);
+
+/**
+ * Remove a node from the tree.
+ * \param tree The tree.
+ * \param node The node to remove. Must be in the tree.
+ */
+void ktree_remove(struct ktree* tree, struct ktree_node* node);
+
+/**
+ * Find the node with a given key.
+ * \param tree The tree.
+ * \param key The key.
+ * \return The node with the given key, or NULL if there is no such node.
+ */
+struct ktree_node* ktree_find(const struct ktree* tree, uintptr_t key);
+
+/**
+ * Find the node with the lowest key whose weight is at least the given weight.
+ * \param tree The tree.
+ * \param weight The minimum weight.
+ * \return The node, or NULL if every node is lighter than weight.
+ */
+struct ktree_node* ktree_find_first_fit(const struct ktree* tree, size_t weight);
+
+/**
+ * Get the node with the lowest key.
+ * \param tree The tree.
+ * \return The node with the lowest key, or NULL if the tree is empty.
+ */
+struct ktree_node* ktree_first(const struct ktree* tree);
+
+/**
+ * Get the node with the highest key.
+ * \param tree The tree.
+ * \return The node with the highest key, or NULL if the tree is empty.
+ */
+struct ktree_node* ktree_last(const struct ktree* tree);
+
+/**
+ * Get the node with the next highest key.
+ * \param node The node.
+ * \return The next node, or NULL if node has the highest key.
+ */
+struct ktree_node* ktree_next(const struct ktree_node* node);
+
+/**
+ * Get the node with the next lowest key.
+ * \param node The node.
+ * \return The previous node, or NULL if node has the lowest key.
+ */
+struct ktree_node* ktree_previous(const struct ktree_node* node);
+
+/**
+ * Get the number of nodes in the tree.
+ * \param tree The tree.
+ * \return The number of nodes in the tree.
+ */
+size_t ktree_count(const struct ktree* tree);
+
+#endif /* ! REDSHIFT_LIBK_KTREE_H */
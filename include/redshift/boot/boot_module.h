@@ -34,12 +34,8 @@ struct boot_module {
 };
 
 /**
- * Discover boot modules.
- */
-void discover_boot_modules(struct multiboot2_tag* mb_tags);
-
-/**
- * Save boot modules.
+ * Save boot modules. The memory the modules occupy stays reserved until the end of boot, when it's freed; only the list
+ * itself (and the command-lines) remains valid after that.
  */
 void save_boot_modules(struct multiboot2_tag* mb_tags);
 
@@ -55,10 +51,4 @@ const struct boot_module* boot_modules_head(void);
  */
 size_t boot_modules_count(void);
 
-/**
- * Get the address of the end of the last boot module in memory. This is the first usable memory location.
- * \return The address of the end of the last boot module in memory.
- */
-uintptr_t boot_modules_end(void);
-
 #endif /* ! REDSHIFT_BOOT_MODULE_H */
@@ -40,7 +40,12 @@ typedef enum {
     MULTIBOOT2_TAG_TYPE_VBE,
     MULTIBOOT2_TAG_TYPE_FRAMEBUFFER,
     MULTIBOOT2_TAG_TYPE_ELF_SECTIONS,
-    MULTIBOOT2_TAG_TYPE_APM
+    MULTIBOOT2_TAG_TYPE_APM,
+    MULTIBOOT2_TAG_TYPE_EFI32,
+    MULTIBOOT2_TAG_TYPE_EFI64,
+    MULTIBOOT2_TAG_TYPE_SMBIOS,
+    MULTIBOOT2_TAG_TYPE_ACPI_OLD,
+    MULTIBOOT2_TAG_TYPE_ACPI_NEW
 } multiboot2_tag_type_t;
 
 struct multiboot2_tag {
@@ -177,6 +182,11 @@ struct multiboot2_tag_apm {
     uint16_t              cseg_16_len;
     uint16_t              dseg_len;
 };
+
+struct multiboot2_tag_acpi {
+    struct multiboot2_tag tag;
+    uint8_t               rsdp[]; /* Copy of the ACPI 1.0 (old) or 2.0 (new) RSDP. */
+};
 #endif /* ! __ASM_SOURCE__ */
 
 #endif /* ! REDSHIFT_BOOT_MULTIBOOT2_H */
@@ -21,10 +21,9 @@
 #define BOOT_SEQUENCE_SPLASH                1002
 #define BOOT_SEQUENCE_CHECK_BOOT_ENV        1003
 #define BOOT_SEQUENCE_INIT_INTERRUPT_SYSTEM 1004
-#define BOOT_SEQUENCE_INIT_BOOT_MODULES_1   1005
 #define BOOT_SEQUENCE_INIT_HAL              1006
 #define BOOT_SEQUENCE_INIT_MEMORY           1007
-#define BOOT_SEQUENCE_INIT_BOOT_MODULES_2   1008
+#define BOOT_SEQUENCE_INIT_BOOT_MODULES     1008
 #define BOOT_SEQUENCE_LOAD_INITRD           1009
 #define BOOT_SEQUENCE_LOAD_SYMBOL_TABLE     1010
 #define BOOT_SEQUENCE_INIT_DEVICES          1011
@@ -28,14 +28,20 @@
 #include <redshift/kernel/kmalloc.h>
 #include <redshift/kernel/panic.h>
 #include <redshift/kernel/printk.h>
+#include <redshift/kernel/spinlock.h>
 
 /**
- * Save interrupt state and disable interrupts. Can only be done once per function, ideally before doing anything else.
+ * Save interrupt state, disable interrupts and take the kernel lock, so that nothing else runs the critical section on
+ * this CPU or any other. Can only be done once per function, ideally before doing anything else.
  */
-#define SAVE_INTERRUPT_STATE        int __saved_interrupt_state__ = get_interrupt_state(); disable_interrupts()
+#define SAVE_INTERRUPT_STATE        int __saved_interrupt_state__ = get_interrupt_state(); disable_interrupts();\
+                                    kernel_lock()
 
-/** Restore previous interrupt state. Can only be done after SAVE_INTERRUPT_STATE. */
-#define RESTORE_INTERRUPT_STATE     do { if (__saved_interrupt_state__) { enable_interrupts(); } } while (0)
+/** Release the kernel lock and restore previous interrupt state. Can only be done after SAVE_INTERRUPT_STATE. */
+#define RESTORE_INTERRUPT_STATE     do {\
+                                        kernel_unlock();\
+                                        if (__saved_interrupt_state__) { enable_interrupts(); }\
+                                    } while (0)
 
 /** Stack size. */
 #define STACK_SIZE (size_t)((uintptr_t)__stack_top__ - (uintptr_t)__stack_bottom__)
@@ -43,6 +49,8 @@
 extern symbol_t __kernel_start__; /**< Start of kernel (linker script). */
 extern symbol_t __code_start__;   /**< Start of code section (linker script).           */
 extern symbol_t __code_end__;     /**< End of code section (linker script).             */
+extern symbol_t __init_start__;   /**< Start of boot code, freed after boot.            */
+extern symbol_t __init_end__;     /**< End of boot code (page-aligned).                 */
 extern symbol_t __data_start__;   /**< Start of data section (linker script).           */
 extern symbol_t __data_end__;     /**< End of data section (linker script).             */
 extern symbol_t __rodata_start__; /**< Start of read-only data section (linker script). */
@@ -45,4 +45,10 @@ void initrd_init(const char* initrd, size_t size);
  */
 const struct initrd_file* initrd_get_file_by_name(const char* path);
 
+/**
+ * Forget the initial ramdisk's files so that the memory it occupies can be freed. Anything which is still needed has to
+ * be copied out first.
+ */
+void initrd_fini(void);
+
 #endif /* ! REDSHIFT_KERNEL_INITRD_H */
@@ -21,16 +21,37 @@
 #define REDSHIFT_MEM_KMALLOC_H
 
 #include <redshift/kernel.h>
+#include <redshift/mem/common.h>
 
 /**
- * Allocate a block of dynamic memory on the kernel heap.
+ * Allocate a block of dynamic memory on the kernel heap. The block is aligned to a 16-byte boundary. Blocks of
+ * VMALLOC_THRESHOLD bytes or more are allocated with vmalloc instead, so they are only virtually contiguous.
  * \param size The size of the block to allocate.
- * \return A pointer to the allocated block if successful. Panics on failure.
+ * \return A pointer to the allocated block if successful, otherwise NULL (the heap couldn't grow or the vmalloc area is
+ * exhausted).
  */
 extern void*(* kmalloc)(size_t size);
 
 /**
- * Free a block of memory from the kernel heap.
+ * Allocate a block of dynamic memory on the kernel heap with a particular alignment. Large blocks are allocated with
+ * vmalloc, as with kmalloc.
+ * \param size The size of the block to allocate.
+ * \param alignment The alignment of the block. Must be a power of two. Alignments below 16 bytes are rounded up.
+ * \return A pointer to the allocated block if successful, otherwise NULL.
+ */
+void* kmalloc_aligned(size_t size, size_t alignment);
+
+/**
+ * Allocate a block of dynamic memory on the kernel heap.
+ * \param size The size of the block to allocate.
+ * \param flags Allocation flags. ALLOC_PAGE_ALIGN aligns the block to a page boundary, which should be reserved for
+ * memory which really needs it (e.g. stacks and page tables).
+ * \return A pointer to the allocated block if successful, otherwise NULL.
+ */
+void* kmalloc_flags(size_t size, alloc_flags_t flags);
+
+/**
+ * Free a block of memory allocated with kmalloc, kmalloc_aligned or kmalloc_flags.
  * \param ptr The memory block.
  */
 extern void(* kfree)(void* ptr);
@@ -39,4 +39,17 @@ void add_timer_event(const char* name, uint32_t period, void(* callback)(void*),
  */
 void process_timer_queue(uint32_t elapsed_time);
 
+/**
+ * Get the time since the timer started.
+ * \return The uptime (ms), to the nearest tick.
+ */
+uint64_t timer_uptime(void);
+
+/**
+ * Block the current process until at least msec milliseconds have passed. Other processes run in the meantime. Before
+ * the scheduler starts this waits for interrupts instead, as wait_on does.
+ * \param msec The time to sleep for (ms).
+ */
+void timer_sleep(uint64_t msec);
+
 #endif /* ! REDSHIFT_KERNEL_TIMER_H */
@@ -0,0 +1,77 @@
+/**
+ * \file mem/account.h
+ * Memory accounting. Charges heap usage to owners such as processes.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef REDSHIFT_MEM_ACCOUNT_H
+#define REDSHIFT_MEM_ACCOUNT_H 1
+
+#include <redshift/kernel.h>
+
+enum {
+    MEM_ACCOUNTS_MAX   = 256, /**< Largest number of accounts.                              */
+    MEM_ACCOUNT_KERNEL = 0    /**< Account charged for memory which has no other owner.     */
+};
+
+/** Account usage statistics. */
+struct mem_account_stats {
+    size_t   heap_bytes;  /**< Number of heap bytes currently charged to the account.  */
+    size_t   heap_peak;   /**< Largest number of heap bytes charged at once.           */
+    unsigned alloc_count; /**< Number of heap blocks allocated.                        */
+    unsigned free_count;  /**< Number of heap blocks freed.                            */
+};
+
+/**
+ * Create an account.
+ * \return The account is returned, or -1 if there are too many accounts.
+ */
+int mem_account_create(void);
+
+/**
+ * Set the account which new allocations are charged to. Called by the scheduler when it switches processes.
+ * \param account The account.
+ */
+void mem_account_switch(int account);
+
+/**
+ * Get the account which new allocations are charged to.
+ * \return The account.
+ */
+int mem_account_current(void);
+
+/**
+ * Charge a heap block (or a vmalloc allocation) to an account.
+ * \param account The account.
+ * \param size The size of the block.
+ */
+void mem_account_charge_heap(int account, size_t size);
+
+/**
+ * Remove the charge for a heap block (or a vmalloc allocation) from the account it was charged to.
+ * \param account The account.
+ * \param size The size of the block.
+ */
+void mem_account_uncharge_heap(int account, size_t size);
+
+/**
+ * Get an account's usage statistics.
+ * \param account The account.
+ * \param stats Receives the statistics.
+ */
+void mem_account_get_stats(int account, struct mem_account_stats* stats);
+
+#endif /* ! REDSHIFT_MEM_ACCOUNT_H */
@@ -0,0 +1,78 @@
+/**
+ * \file mem/memblock.h
+ * Early boot memory allocator.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef REDSHIFT_MEM_MEMBLOCK_H
+#define REDSHIFT_MEM_MEMBLOCK_H 1
+
+#include <redshift/boot/multiboot2.h>
+#include <redshift/hal/memory.h>
+#include <redshift/kernel.h>
+#include <redshift/mem/frame.h>
+
+/**
+ * Callback which receives a page-aligned range of free memory.
+ * \param start The start of the range.
+ * \param end The end of the range (exclusive).
+ */
+typedef void(* memblock_release_fn_t)(phys_addr_t start, phys_addr_t end);
+
+/**
+ * Initialise the early boot memory allocator from the multiboot2 memory map. The low 1 MiB, the kernel image, the boot
+ * modules and the multiboot2 tags are reserved, as is anything the firmware doesn't report as available.
+ * \param mb_tags The multiboot2 tags.
+ */
+void memblock_init(struct multiboot2_tag* mb_tags);
+
+/**
+ * Reserve a range of memory so that it isn't allocated or released.
+ * \param start The start of the range.
+ * \param size The size of the range.
+ */
+void memblock_reserve(uintptr_t start, size_t size);
+
+/**
+ * Allocate memory from the lowest available range which is big enough. The memory is below 4 GiB.
+ * \param size The amount of memory to allocate.
+ * \param alignment The alignment of the allocation, which must be a power of two.
+ * \return The address of the memory is returned, or zero if no range is big enough.
+ */
+uintptr_t memblock_alloc(size_t size, size_t alignment);
+
+/**
+ * Get the end of the memory reserved by the kernel, i.e. the kernel image, the boot modules and memblock allocations.
+ * \return The end of the highest kernel reservation, rounded up to a page boundary.
+ */
+uintptr_t memblock_reserved_end(void);
+
+/**
+ * Get the end of usable memory.
+ * \return The end of the highest available or reclaimable range.
+ */
+phys_addr_t memblock_limit(void);
+
+/**
+ * Pass the unreserved pages of every range of a given type to a callback.
+ * \param type MEMORY_TYPE_AVAILABLE or MEMORY_TYPE_RECLAIMABLE.
+ * \param release The callback.
+ * \return The number of bytes released is returned.
+ * \note Once available memory has been released, memblock_alloc can no longer be used.
+ */
+uint64_t memblock_release(memory_type_t type, memblock_release_fn_t release);
+
+#endif /* ! REDSHIFT_MEM_MEMBLOCK_H */
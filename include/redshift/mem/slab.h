@@ -0,0 +1,78 @@
+/**
+ * \file mem/slab.h
+ * Slab allocator. Caches fixed-size objects in pages taken from the kernel heap.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef REDSHIFT_MEM_SLAB_H
+#define REDSHIFT_MEM_SLAB_H 1
+
+#include <redshift/kernel.h>
+
+/* Forward declaration for struct kmem_cache (mem/slab.c). */
+struct kmem_cache;
+
+/** Object constructor. Called once for each object when the slab containing it is created. */
+typedef void(* kmem_ctor_fn_t)(void* object);
+
+/** Object cache usage statistics. */
+struct kmem_cache_stats {
+    size_t   object_size;   /**< Size of each object (including alignment padding). */
+    size_t   slab_count;    /**< Number of slabs owned by the cache.                */
+    size_t   object_count;  /**< Number of objects in all slabs.                    */
+    size_t   objects_used;  /**< Number of objects currently allocated.             */
+    uint64_t alloc_count;   /**< Number of times an object was allocated.           */
+    uint64_t free_count;    /**< Number of times an object was freed.               */
+};
+
+/**
+ * Create an object cache.
+ * \param name The name of the cache. Must remain valid for the lifetime of the cache.
+ * \param size The size of each object. Must be small enough for at least one object to fit in a slab.
+ * \param align The alignment of each object, or zero for the default alignment. Must be a power of two.
+ * \param ctor Optional. The object constructor.
+ * \return The cache is returned. Panics on failure.
+ */
+struct kmem_cache* kmem_cache_create(const char* name, size_t size, size_t align, kmem_ctor_fn_t ctor);
+
+/**
+ * Allocate an object from a cache.
+ * \param cache The cache.
+ * \return A pointer to the object if successful, otherwise NULL. If the cache has a constructor, the object is in its
+ * constructed state, or in whatever state it was freed in.
+ */
+void* kmem_cache_alloc(struct kmem_cache* cache);
+
+/**
+ * Return an object to the cache it was allocated from.
+ * \param cache The cache.
+ * \param ptr The object. May be NULL.
+ */
+void kmem_cache_free(struct kmem_cache* cache, void* ptr);
+
+/**
+ * Get a cache's usage statistics.
+ * \param cache The cache.
+ * \param stats Receives the statistics.
+ */
+void kmem_cache_get_stats(const struct kmem_cache* cache, struct kmem_cache_stats* stats);
+
+/**
+ * Print the usage statistics of every cache.
+ */
+void kmem_cache_print_stats(void);
+
+#endif /* ! REDSHIFT_MEM_SLAB_H */
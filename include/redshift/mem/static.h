@@ -23,11 +23,6 @@
 #include <redshift/mem/common.h>
 #include <redshift/kernel.h>
 
-/**
- * Initialise the static heap allocator.
- */
-void static_init(void);
-
 /**
  * Allocate static memory.
  * \param size Amount of memory to allocate.
@@ -44,4 +39,18 @@ uintptr_t static_alloc_base(size_t size, alloc_flags_t flags, uintptr_t* phys);
  */
 void* static_alloc(size_t size);
 
+/**
+ * Fix the amount of memory available for static allocations. Until this is called static memory comes from memblock;
+ * afterwards it comes from the reserved pool, and allocations which don't fit trigger a kernel panic.
+ * \param size The amount of memory to reserve for future static allocations.
+ */
+void static_reserve(size_t size);
+
+/**
+ * Give the unused part of the static memory pool to the frame allocator at the end of boot. Static allocations made
+ * after this come from the kernel heap.
+ * \return The number of bytes released is returned.
+ */
+size_t static_release(void);
+
 #endif /* ! REDSHIFT_MEM_STATIC_H */
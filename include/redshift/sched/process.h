@@ -21,7 +21,6 @@
 #ifndef REDSHIFT_SCHED_PROCESS_H
 #define REDSHIFT_SCHED_PROCESS_H
 
-#include <redshift/hal/cpu/state.h>
 #include <redshift/kernel.h>
 #include <redshift/kernel/interrupt.h>
 #include <redshift/mem/paging.h>
@@ -31,11 +30,21 @@
  */
 typedef enum {
     PROCESS_FLAGS_SUPERVISOR = 0,       /** Process runs in supervisor mode (ring 0). */
-    PROCESS_FLAGS_USER       = 1 << 0   /** Process runs in user mode (ring 3). */
+    PROCESS_FLAGS_USER       = 1 << 0,  /** Process runs in user mode (ring 3). */
+    PROCESS_FLAGS_PINNED     = 1 << 1   /** Process stays on the CPU which spawned it. */
 } process_flags_t;
 
 struct process;
 
+/** Memory used by a process. */
+struct process_memory_stats {
+    size_t resident_frames; /**< Frames mapped in the process' user space, including shared frames.     */
+    size_t heap_bytes;      /**< Heap bytes allocated by the process and not yet freed.                 */
+    size_t heap_peak;       /**< Largest number of heap bytes the process has had allocated at once.    */
+    size_t stack_size;      /**< Size of the process' stack.                                           */
+    size_t stack_peak;      /**< Deepest the process' stack has grown, or 0 if it isn't known.          */
+};
+
 typedef enum {
     PROCESS_PRIORITY_MIN  =  0,
     PROCESS_PRIORITY_LOW  =  3,
@@ -47,10 +56,14 @@ typedef enum {
 /**
  * Spawns a new process.
  * \param entry_point The entry point of the process.
- * \param page_dir The page directory.
+ * \param page_dir The page directory. If this is NULL, the process gets a copy-on-write copy of the current address
+ * space.
  * \param priority The process priority (0..PROCESS_PRIORITY_MAX).
  * \param stack_addr The address of the *bottom* of the process' stack. If this is zero, a new stack will be created.
+ * A user mode process also gets a kernel stack of its own.
  * \param stack_size The size of the process' stack.
+ * \param flags The process flags. Unless the process is pinned, it goes on the run queue of the CPU with the fewest
+ * ready processes, and can later be taken by an idle CPU.
  * \return The process ID is returned.
  */
  int process_spawn(
@@ -63,17 +76,30 @@ typedef enum {
 );
 
 /**
- * Switches to the next process.
- * \param regs If not NULL, points to a struct cpu_state instance which contains the updated register state of the
- * process which was interrupted.
+ * Switches to the next process on the current CPU's run queue. If the CPU has nothing but idle processes to run, it
+ * takes a process from the busiest CPU first. Returns when the calling process is next switched to, or straight away if
+ * it is still the one which should run.
+ */
+void __non_reentrant process_switch(void);
+
+/**
+ * Block a process, so it isn't picked to run until it's unblocked. A process which blocks itself should yield
+ * afterwards.
+ * \param process The process.
+ */
+void process_block(struct process* process);
+
+/**
+ * Unblock a process which was blocked by process_block.
+ * \param process The process.
  */
-void __non_reentrant process_switch(void* regs);
+void process_unblock(struct process* process);
 
 /**
  * Get a handle to the currently-executing process.
  * \return A handle to the currently-executing process.
  */
-const struct process* __non_reentrant get_current_process(void);
+struct process* __non_reentrant get_current_process(void);
 
 /**
  * Get the ID of a process.
@@ -88,14 +114,24 @@ int get_process_id(const struct process* process);
  */
 int __non_reentrant get_current_process_id(void);
 
+/**
+ * Get the memory used by a process.
+ * \param process The process.
+ * \param stats Receives the statistics.
+ */
+void process_get_memory_stats(const struct process* process, struct process_memory_stats* stats);
+
+/**
+ * Print the memory used by every process, followed by the frame allocator's statistics.
+ */
+void process_print_memory_stats(void);
+
 /**
  * Yield the timeslice of the current process.
  */
 __always_inline static inline void __non_reentrant process_yield(void)
 {
-    struct cpu_state regs;
-    get_cpu_state(&regs);
-    process_switch(&regs);
+    process_switch();
 }
 
 #endif /* ! REDSHIFT_SCHED_PROCESS_H */
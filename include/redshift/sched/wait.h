@@ -0,0 +1,89 @@
+/* Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef REDSHIFT_SCHED_WAIT_H
+#define REDSHIFT_SCHED_WAIT_H
+
+#include <redshift/kernel.h>
+#include <redshift/sched/process.h>
+
+/**
+ * A process waiting on a wait queue. Entries live on the waiting process' stack for as long as it is blocked.
+ */
+struct wait_entry {
+    struct process*    process; /**< The waiting process.     */
+    struct wait_entry* next;    /**< Next entry in the queue. */
+};
+
+/**
+ * A queue of processes waiting for something to happen. Processes are woken in the order they started waiting.
+ */
+struct wait_queue {
+    struct wait_entry* first; /**< Process which has waited longest. */
+    struct wait_entry* last;  /**< Process which started waiting last. */
+};
+
+/** Initialiser for a statically allocated wait queue. */
+#define WAIT_QUEUE_INIT {NULL, NULL}
+
+/**
+ * Initialise a wait queue.
+ * \param queue The wait queue.
+ */
+void wait_queue_init(struct wait_queue* queue);
+
+/**
+ * Block the current process on a wait queue until it's woken by wake_up, or unblocked some other way, in which case it
+ * is taken off the queue. Call with interrupts disabled, after checking the condition being waited for, or a wake-up
+ * in between can be missed; wait_event does this. Before the scheduler starts this just waits for the next interrupt.
+ * \param queue The wait queue.
+ */
+void wait_on(struct wait_queue* queue);
+
+/**
+ * Wake every process waiting on a wait queue.
+ * \param queue The wait queue.
+ * \return The number of processes woken.
+ */
+size_t wake_up(struct wait_queue* queue);
+
+/**
+ * Wake the process which has waited longest on a wait queue.
+ * \param queue The wait queue.
+ * \return Whether there was a process to wake.
+ */
+bool wake_up_one(struct wait_queue* queue);
+
+/**
+ * Block the current process on a wait queue until a condition is true. The condition is checked with interrupts
+ * disabled, and again every time the process is woken.
+ * \param QUEUE Pointer to the wait queue.
+ * \param CONDITION The condition.
+ */
+#define wait_event(QUEUE, CONDITION)   \
+    do {                               \
+        SAVE_INTERRUPT_STATE;          \
+        while (!(CONDITION)) {         \
+            wait_on(QUEUE);            \
+        }                              \
+        RESTORE_INTERRUPT_STATE;       \
+    } while (0)
+
+#endif /* ! REDSHIFT_SCHED_WAIT_H */
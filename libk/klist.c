@@ -36,6 +36,29 @@ struct klist {
     klist_flags_t      flags;
 };
 
+/* Object cache for dynamically allocated nodes. */
+static void* node_cache = NULL;
+
+/* Allocate a node from the node cache or static memory, depending on the list's flags. */
+static struct klist_node* allocate_node(const struct klist* list)
+{
+    if (!(TEST_FLAG(list->flags, KLIST_FLAGS_DYNAMIC))) {
+        return kextern_static_allocate(sizeof(struct klist_node));
+    }
+    if (node_cache == NULL) {
+        node_cache = kextern_object_cache_create("klist_node", sizeof(struct klist_node));
+    }
+    return kextern_object_cache_alloc(node_cache);
+}
+
+/* Free a node. Nodes in static lists can't be freed. */
+static void free_node(const struct klist* list, struct klist_node* node)
+{
+    if (TEST_FLAG(list->flags, KLIST_FLAGS_DYNAMIC)) {
+        kextern_object_cache_free(node_cache, node);
+    }
+}
+
 static struct klist_node* get_node_by_index(struct klist* list, size_t index)
 {
     if (index == 0) {
@@ -74,12 +97,7 @@ struct klist* klist_create(klist_flags_t flags, size_t size, void* data)
 struct klist* klist_append(struct klist* list, void* data)
 {
     DEBUG_ASSERT(list != NULL);
-    struct klist_node* node = NULL;
-    if (TEST_FLAG(list->flags, KLIST_FLAGS_DYNAMIC)) {
-        node = kextern_dynamic_allocate(sizeof(*node));
-    } else {
-        node = kextern_static_allocate(sizeof(*node));
-    }
+    struct klist_node* node = allocate_node(list);
     RUNTIME_CHECK(node != NULL);
     node->data = (void*)data;
     node->next = NULL;
@@ -96,12 +114,7 @@ struct klist* klist_append(struct klist* list, void* data)
 struct klist* klist_prepend(struct klist* list, void* data)
 {
     DEBUG_ASSERT(list != NULL);
-    struct klist_node* node = NULL;
-    if (TEST_FLAG(list->flags, KLIST_FLAGS_DYNAMIC)) {
-        node = kextern_dynamic_allocate(sizeof(*node));
-    } else {
-        node = kextern_static_allocate(sizeof(*node));
-    }
+    struct klist_node* node = allocate_node(list);
     RUNTIME_CHECK(node != NULL);
     node->data = (void*)data;
     node->next = list->head;
@@ -123,11 +136,7 @@ struct klist* klist_insert(struct klist* list, void* data, size_t index)
      */
     struct klist_node* node = get_node_by_index(list, index - 1);
     struct klist_node* next = node->next;
-    if (TEST_FLAG(list->flags, KLIST_FLAGS_DYNAMIC)) {
-        node->next = kextern_dynamic_allocate(sizeof(*node));
-    } else {
-        node->next = kextern_static_allocate(sizeof(*node));
-    }
+    node->next = allocate_node(list);
     RUNTIME_CHECK(node->next != NULL);
     node->next->data = (void*)data;
     node->next->next = next;
@@ -192,7 +201,7 @@ void* klist_pop(struct klist* list)
         DEBUG_ASSERT(list->size == 1);
         DEBUG_ASSERT(list->head == list->last);
         void* data = list->head->data;
-        kextern_dynamic_free(list->head);
+        free_node(list, list->head);
         list->head = NULL;
         list->last = NULL;
         return data;
@@ -207,7 +216,7 @@ void* klist_pop(struct klist* list)
     }
     node->next = NULL;
     list->last->data = NULL;
-    kextern_dynamic_free(list->last);
+    free_node(list, list->last);
     list->last = node;
     list->size -= 1;
     return data;
@@ -223,7 +232,7 @@ struct klist* klist_shallow_remove(struct klist* list, size_t index)
     struct klist_node* next = node->next->next;
     node->next->data = NULL;
     node->next->next = NULL;
-    kextern_dynamic_free(node->next);
+    free_node(list, node->next);
     node->next = next;
     list->size -= 1;
     return list;
@@ -240,7 +249,7 @@ struct klist* klist_deep_remove(struct klist* list, size_t index)
     node->next->next = NULL;
     kextern_dynamic_free(node->next->data);
     node->next->data = NULL;
-    kextern_dynamic_free(node->next);
+    free_node(list, node->next);
     node->next = next;
     list->size -= 1;
     return list;
@@ -256,7 +265,7 @@ void klist_shallow_free(struct klist* list)
             struct klist_node* next = node->next;
             node->data = NULL;
             node->next = NULL;
-            kextern_dynamic_free(node);
+            free_node(list, node);
             node = next;
         }
     }
@@ -277,7 +286,7 @@ void klist_deep_free(struct klist* list)
             node->next = NULL;
             kextern_dynamic_free(node->data);
             node->data = NULL;
-            kextern_dynamic_free(node);
+            free_node(list, node);
             node = next;
         }
     }
@@ -50,7 +50,7 @@ static inline void kfill8(uint8_t* ptr, uint8_t value, size_t n)
      */
     const uint16_t value16 = ((uint16_t)value   << 8)  | ((uint16_t)value   & 0xFF);
     const uint32_t value32 = ((uint32_t)value16 << 16) | ((uint32_t)value16 & 0xFFFF);
-    const uint32_t value64 = ((uint64_t)value32 << 32) | ((uint64_t)value32 & 0xFFFFFFFF);
+    const uint64_t value64 = ((uint64_t)value32 << 32) | ((uint64_t)value32 & 0xFFFFFFFF);
     /* Align to 4 bytes boundary.
      */
     for (uintptr_t address = (uintptr_t)ptr; (address & 3) != 0 && n > 0; ++address, ++ptr, --n) {
@@ -59,18 +59,15 @@ static inline void kfill8(uint8_t* ptr, uint8_t value, size_t n)
     /* Try to write 8, 4 and 2 bytes at a time.
      */
     if (n >= 8) {
-        n >>= 3;
-        kfill64((uint64_t**)&ptr, value64, n);
+        kfill64((uint64_t**)&ptr, value64, n >> 3);
         n &= 7;
     }
     if (n >= 4) {
-        n >>= 2;
-        kfill32((uint32_t**)&ptr, value32, n);
+        kfill32((uint32_t**)&ptr, value32, n >> 2);
         n &= 3;
     }
     if (n >= 2) {
-        n >>= 1;
-        kfill16((uint16_t**)&ptr, value16, n);
+        kfill16((uint16_t**)&ptr, value16, n >> 1);
         n &= 1;
     }
     /* Write any remaining bytes.
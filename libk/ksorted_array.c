@@ -64,7 +64,7 @@ struct ksorted_array* ksorted_array_create(size_t capacity, ksorted_array_flags_
     } else {
         address = kextern_static_allocate(size);
     }
-    DEBUG_ASSERT(address != NULL);
+    RUNTIME_CHECK(address != NULL);
     return ksorted_array_place(address, capacity, flags, predicate);
 }
 
@@ -82,7 +82,7 @@ struct ksorted_array* ksorted_array_place(void* address, size_t capacity, ksorte
         list->elements = kextern_static_allocate(count);
         list->freeable = 0;
     }
-    DEBUG_ASSERT(list->elements != NULL);
+    RUNTIME_CHECK(list->elements != NULL);
     if (sizeof(*(list->elements)) == 4) {
         kmemory_fill32(list->elements, 0UL, capacity);
     } else if (sizeof(*(list->elements)) == 2) {
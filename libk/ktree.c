@@ -0,0 +1,275 @@
+/* Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free_fn of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <libk/kassert.h>
+#include <libk/kmacro.h>
+#include <libk/ktree.h>
+
+/* Get the height of a (possibly empty) subtree. */
+static int get_height(const struct ktree_node* node)
+{
+    return node == NULL ? 0 : node->height;
+}
+
+/* Get the largest weight in a (possibly empty) subtree. */
+static size_t get_max_weight(const struct ktree_node* node)
+{
+    return node == NULL ? 0 : node->max_weight;
+}
+
+/* Get the difference between the heights of a node's left and right subtrees. */
+static int get_balance(const struct ktree_node* node)
+{
+    return get_height(node->left) - get_height(node->right);
+}
+
+/* Recompute a node's height and maximum weight from its children. */
+static void update(struct ktree_node* node)
+{
+    node->height     = 1 + MAX(get_height(node->left), get_height(node->right));
+    node->max_weight = MAX(node->weight, MAX(get_max_weight(node->left), get_max_weight(node->right)));
+}
+
+/* Point whatever referred to old_child (its parent or the root) at new_child. */
+static void replace_child(struct ktree* tree, struct ktree_node* parent, struct ktree_node* old_child, struct ktree_node* new_child)
+{
+    if (parent == NULL) {
+        tree->root = new_child;
+    } else if (parent->left == old_child) {
+        parent->left = new_child;
+    } else {
+        DEBUG_ASSERT(parent->right == old_child);
+        parent->right = new_child;
+    }
+    if (new_child != NULL) {
+        new_child->parent = parent;
+    }
+}
+
+/* Rotate a subtree left and return its new root. */
+static struct ktree_node* rotate_left(struct ktree* tree, struct ktree_node* node)
+{
+    struct ktree_node* pivot = node->right;
+    DEBUG_ASSERT(pivot != NULL);
+    replace_child(tree, node->parent, node, pivot);
+    node->right = pivot->left;
+    if (node->right != NULL) {
+        node->right->parent = node;
+    }
+    pivot->left  = node;
+    node->parent = pivot;
+    update(node);
+    update(pivot);
+    return pivot;
+}
+
+/* Rotate a subtree right and return its new root. */
+static struct ktree_node* rotate_right(struct ktree* tree, struct ktree_node* node)
+{
+    struct ktree_node* pivot = node->left;
+    DEBUG_ASSERT(pivot != NULL);
+    replace_child(tree, node->parent, node, pivot);
+    node->left = pivot->right;
+    if (node->left != NULL) {
+        node->left->parent = node;
+    }
+    pivot->right = node;
+    node->parent = pivot;
+    update(node);
+    update(pivot);
+    return pivot;
+}
+
+/* Walk from node to the root, updating and rebalancing each subtree. */
+static void rebalance(struct ktree* tree, struct ktree_node* node)
+{
+    while (node != NULL) {
+        update(node);
+        const int balance = get_balance(node);
+        if (balance > 1) {
+            if (get_balance(node->left) < 0) {
+                rotate_left(tree, node->left);
+            }
+            node = rotate_right(tree, node);
+        } else if (balance < -1) {
+            if (get_balance(node->right) > 0) {
+                rotate_right(tree, node->right);
+            }
+            node = rotate_left(tree, node);
+        }
+        node = node->parent;
+    }
+}
+
+/* Get the node with the lowest key in a subtree. */
+static struct ktree_node* get_leftmost(struct ktree_node* node)
+{
+    while (node != NULL && node->left != NULL) {
+        node = node->left;
+    }
+    return node;
+}
+
+/* Get the node with the highest key in a subtree. */
+static struct ktree_node* get_rightmost(struct ktree_node* node)
+{
+    while (node != NULL && node->right != NULL) {
+        node = node->right;
+    }
+    return node;
+}
+
+void ktree_init(struct ktree* tree)
+{
+    DEBUG_ASSERT(tree != NULL);
+    tree->root  = NULL;
+    tree->count = 0;
+}
+
+void ktree_insert(struct ktree* tree, struct ktree_node* node, uintptr_t key, size_t weight)
+{
+    DEBUG_ASSERT(tree != NULL);
+    DEBUG_ASSERT(node != NULL);
+    node->left   = NULL;
+    node->right  = NULL;
+    node->key    = key;
+    node->weight = weight;
+    /* Find the leaf to attach the node to.
+     */
+    struct ktree_node*  parent = NULL;
+    struct ktree_node** link   = &tree->root;
+    while (*link != NULL) {
+        parent = *link;
+        DEBUG_ASSERT(key != parent->key);
+        link = key < parent->key ? &parent->left : &parent->right;
+    }
+    *link        = node;
+    node->parent = parent;
+    tree->count++;
+    rebalance(tree, node);
+}
+
+void ktree_remove(struct ktree* tree, struct ktree_node* node)
+{
+    DEBUG_ASSERT(tree != NULL);
+    DEBUG_ASSERT(node != NULL);
+    DEBUG_ASSERT(tree->count > 0);
+    struct ktree_node* start = NULL; /* Lowest node whose subtree changed. */
+    if (node->left == NULL || node->right == NULL) {
+        /* At most one child: splice the node out.
+         */
+        struct ktree_node* child = node->left != NULL ? node->left : node->right;
+        start = node->parent;
+        replace_child(tree, node->parent, node, child);
+    } else {
+        /* Two children: replace the node with its successor, which has no left child.
+         */
+        struct ktree_node* successor = get_leftmost(node->right);
+        if (successor->parent == node) {
+            start = successor;
+        } else {
+            start = successor->parent;
+            replace_child(tree, successor->parent, successor, successor->right);
+            successor->right         = node->right;
+            successor->right->parent = successor;
+        }
+        replace_child(tree, node->parent, node, successor);
+        successor->left         = node->left;
+        successor->left->parent = successor;
+    }
+    node->left   = NULL;
+    node->right  = NULL;
+    node->parent = NULL;
+    tree->count--;
+    rebalance(tree, start);
+}
+
+struct ktree_node* ktree_find(const struct ktree* tree, uintptr_t key)
+{
+    DEBUG_ASSERT(tree != NULL);
+    struct ktree_node* node = tree->root;
+    while (node != NULL && node->key != key) {
+        node = key < node->key ? node->left : node->right;
+    }
+    return node;
+}
+
+struct ktree_node* ktree_find_first_fit(const struct ktree* tree, size_t weight)
+{
+    DEBUG_ASSERT(tree != NULL);
+    struct ktree_node* node = tree->root;
+    if (node == NULL || node->max_weight < weight) {
+        return NULL;
+    }
+    /* Invariant: node's subtree contains a node at least as heavy as weight. Prefer the left (lower) subtree.
+     */
+    for (;;) {
+        if (node->left != NULL && node->left->max_weight >= weight) {
+            node = node->left;
+        } else if (node->weight >= weight) {
+            return node;
+        } else {
+            DEBUG_ASSERT(get_max_weight(node->right) >= weight);
+            node = node->right;
+        }
+    }
+}
+
+struct ktree_node* ktree_first(const struct ktree* tree)
+{
+    DEBUG_ASSERT(tree != NULL);
+    return get_leftmost(tree->root);
+}
+
+struct ktree_node* ktree_last(const struct ktree* tree)
+{
+    DEBUG_ASSERT(tree != NULL);
+    return get_rightmost(tree->root);
+}
+
+struct ktree_node* ktree_next(const struct ktree_node* node)
+{
+    DEBUG_ASSERT(node != NULL);
+    if (node->right != NULL) {
+        return get_leftmost(node->right);
+    }
+    while (node->parent != NULL && node->parent->right == node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+struct ktree_node* ktree_previous(const struct ktree_node* node)
+{
+    DEBUG_ASSERT(node != NULL);
+    if (node->left != NULL) {
+        return get_rightmost(node->left);
+    }
+    while (node->parent != NULL && node->parent->left == node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+size_t ktree_count(const struct ktree* tree)
+{
+    DEBUG_ASSERT(tree != NULL);
+    return tree->count;
+}
@@ -26,63 +26,45 @@
 static struct {
     struct boot_module* head;
     size_t              count;
-    uintptr_t           end;
 } modules;
 
-void discover_boot_modules(struct multiboot2_tag* mb_tags)
+void __init_text save_boot_modules(struct multiboot2_tag* mb_tags)
 {
     SAVE_INTERRUPT_STATE;
     DEBUG_ASSERT(mb_tags != NULL);
+    struct boot_module* tail = NULL;
     for (struct multiboot2_tag* tag = (struct multiboot2_tag*)((uint8_t*)mb_tags + 8);
          tag->type != MULTIBOOT2_TAG_TYPE_END;
          tag = (struct multiboot2_tag*)((uint8_t*)tag + ((tag->size + 7) & ~7))) {
         switch (tag->type) {
             case MULTIBOOT2_TAG_TYPE_MODULE:
             {
-                struct multiboot2_tag_module* module = (struct multiboot2_tag_module*)tag;
-                if (module->end > modules.end) {
-                    modules.end = module->end;
-                }
-                break;
-            }
-            default:
-                break;
-        }
-    }
-    RESTORE_INTERRUPT_STATE;
-}
-
-void save_boot_modules(struct multiboot2_tag* mb_tags)
-{
-    SAVE_INTERRUPT_STATE;
-    DEBUG_ASSERT(mb_tags != NULL);
-    struct boot_module* modlist = static_alloc(sizeof(*modlist));
-    modules.head = modlist;
-    for (struct multiboot2_tag* tag = (struct multiboot2_tag*)((uint8_t*)mb_tags + 8);
-         tag->type != MULTIBOOT2_TAG_TYPE_END;
-         tag = (struct multiboot2_tag*)((uint8_t*)tag + ((tag->size + 7) & ~7))) {
-        switch (tag->type) {
-            case MULTIBOOT2_TAG_TYPE_MODULE:
-            {
-                /* Copy data.
+                /* Copy data. The command-line is copied out since the tags are freed at the end of boot.
                  */
                 struct multiboot2_tag_module* module = (struct multiboot2_tag_module*)tag;
-                modlist->start = module->start;
-                modlist->end   = module->end;
+                struct boot_module* modlist = static_alloc(sizeof(*modlist));
+                modlist->start   = module->start;
+                modlist->end     = module->end;
+                modlist->cmdline = NULL;
+                modlist->next    = NULL;
                 size_t length  = kstring_length(module->cmdline);
                 if (length > 0) {
-                    modlist->cmdline = static_alloc(length);
-                    kstring_copy((char*)(modlist->cmdline), module->cmdline, length); /* Ignore const modlist->cmdline; */
+                    char* cmdline = static_alloc(length + 1);
+                    kstring_copy(cmdline, module->cmdline, length);
+                    modlist->cmdline = cmdline;
                 }
                 printk(PRINTK_DEBUG "Module: <start=0x%08lX,end=0x%08lX,cmdline=\"%s\">\n",
                        modlist->start,
                        modlist->end,
                        modlist->cmdline);
-                /* Allocate next module and increment module count.
-                 * FIXME this will always allocate an extra entry. Move allocation to the start of the loop.
+                /* Append module and increment module count.
                  */
-                modlist->next = static_alloc(sizeof(*modlist));
-                modlist = (struct boot_module*)modlist->next; /* Ignore const modlist. */
+                if (tail == NULL) {
+                    modules.head = modlist;
+                } else {
+                    tail->next = modlist;
+                }
+                tail = modlist;
                 ++modules.count;
                 break;
             }
@@ -102,8 +84,3 @@ size_t boot_modules_count(void)
 {
     return modules.count;
 }
-
-uintptr_t boot_modules_end(void)
-{
-    return modules.end;
-}
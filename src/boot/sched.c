@@ -25,14 +25,22 @@
 #include <redshift/sched/idle.h>
 #include <redshift/sched/process.h>
 
-extern struct cpu_state cpu_state; /* cpu_state.asm */
-
 extern void kernel_main(void);
 
+/* Preempt the current process. The timer interrupt's register state stays on the process' kernel stack until it is
+ * switched back to.
+ */
+static void sched_tick(void* arg)
+{
+    UNUSED(arg);
+    process_switch();
+}
+
 int sched_init(void)
 {
     disable_interrupts();
-    /* Start main process, which uses the main kernel stack.
+    /* Start main process, which gets its own stack allocated by process_spawn. The boot stack is abandoned once the first
+     * process runs.
      */
     int main_id = process_spawn(
         (uintptr_t)kernel_main,
@@ -45,7 +53,8 @@ int sched_init(void)
     if (main_id < 0) {
         panic("unable to spawn main process");
     }
-    /* Start idle process, which gets its own stack allocated by process_spawn.
+    /* Start the boot CPU's idle process, which gets its own stack allocated by process_spawn. Every CPU has its own idle
+     * process, so it's pinned.
      */
     int idle_id = process_spawn(
         (uintptr_t)idle,
@@ -53,14 +62,13 @@ int sched_init(void)
         PROCESS_PRIORITY_MIN,
         0,
         STACK_SIZE,
-        PROCESS_FLAGS_SUPERVISOR
+        PROCESS_FLAGS_SUPERVISOR | PROCESS_FLAGS_PINNED
     );
     if (idle_id < 0) {
         panic("unable to spawn idle process");
     }
-    /* Add timer event and enable interrupts.
+    /* Add timer event. Interrupts are enabled once the other CPUs have been started.
      */
-    add_timer_event("sched", SCHED_PERIOD, process_switch, &cpu_state);
-    enable_interrupts();
+    add_timer_event("sched", SCHED_PERIOD, sched_tick, NULL);
     return 0;
 }
@@ -19,11 +19,12 @@
  */
 #include <redshift/kernel/initrd.h>
 #include <redshift/util/tar.h>
+#include <libk/kmemory.h>
 #include <libk/kstring.h>
 
 static struct initrd_file initrd_files[INITRD_MAX_FILES];
 
-void initrd_init(const char* initrd, size_t size)
+void __init_text initrd_init(const char* initrd, size_t size)
 {
     SAVE_INTERRUPT_STATE;
     tar_extract(initrd_files, INITRD_MAX_FILES, initrd, size);
@@ -36,9 +37,17 @@ const struct initrd_file* initrd_get_file_by_name(const char* path)
     uint32_t hash = kstring_hash32(path, INITRD_FILENAME_MAX);
     for (size_t i = 0; i < INITRD_MAX_FILES; ++i) {
         if (initrd_files[i].hash == hash) {
+            RESTORE_INTERRUPT_STATE;
             return initrd_files + i;
         }
     }
     RESTORE_INTERRUPT_STATE;
     return NULL;
 }
+
+void initrd_fini(void)
+{
+    SAVE_INTERRUPT_STATE;
+    kmemory_zero(initrd_files, sizeof(initrd_files));
+    RESTORE_INTERRUPT_STATE;
+}
@@ -20,6 +20,7 @@
  */
 #include <redshift/kernel/asm.h>
 #include <redshift/kernel/console.h>
+#include <redshift/hal/apic.h>
 #include <redshift/hal/cpu.h>
 #include <redshift/kernel/interrupt.h>
 #include <redshift/kernel.h>
@@ -96,7 +97,9 @@ static void handle_exception(const struct cpu_state* regs)
 
 void isr_handler(const struct cpu_state* regs)
 {
-    if (regs->interrupt < ARRAY_SIZE(isr_info)) {
+    /* Exceptions are fatal unless something has registered to handle them, like the FPU does for device-not-available.
+     */
+    if (regs->interrupt < ARRAY_SIZE(isr_info) && isr_handlers[regs->interrupt] == NULL) {
         handle_exception(regs);
     } else {
         call_interrupt_handler(regs);
@@ -105,9 +108,15 @@ void isr_handler(const struct cpu_state* regs)
 
 void irq_handler(const struct cpu_state* regs)
 {
-    if (regs->interrupt >= 40) {
-        io_outb(PIC_SLAVE_CMND, PIC_RESET);
+    /* Once the APICs are set up every IRQ comes through the local APIC, and before then through the PICs.
+     */
+    if (apic_enabled()) {
+        lapic_eoi();
+    } else {
+        if (regs->interrupt >= 40) {
+            io_outb(PIC_SLAVE_CMND, PIC_RESET);
+        }
+        io_outb(PIC_MASTER_CMND, PIC_RESET);
     }
-    io_outb(PIC_MASTER_CMND, PIC_RESET);
     call_interrupt_handler(regs);
 }
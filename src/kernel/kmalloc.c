@@ -20,6 +20,7 @@
 #include <redshift/kernel.h>
 #include <redshift/kernel/kmalloc.h>
 #include <redshift/mem/heap.h>
+#include <redshift/mem/vmalloc.h>
 
 /* Panics if kmalloc is called before the heap is initialised. */
 static void* pre_init_kmalloc(size_t ignored)
@@ -35,16 +36,23 @@ static void pre_init_kfree(void* ignored)
     UNUSED(ignored);
 }
 
-/* Real kmalloc implementation. */
+/* Real kmalloc implementation. Large allocations go to vmalloc so they don't fragment the heap. */
 static void* real_kmalloc(size_t size)
 {
-    void* p = heap_alloc(__kernel_heap__, size, true);
+    if (size >= VMALLOC_THRESHOLD) {
+        return vmalloc(size);
+    }
+    void* p = heap_alloc(__kernel_heap__, size, 0);
     return p;
 }
 
 /* Real kfree implementation. */
 static void real_kfree(void* ptr)
 {
+    if (is_vmalloc_address(ptr)) {
+        vfree(ptr);
+        return;
+    }
     heap_free(__kernel_heap__, ptr);
 }
 
@@ -56,6 +64,24 @@ void_ptr(* kmalloc)(size_t) = pre_init_kmalloc;
 void    (* kfree)(void*)    = pre_init_kfree;
 
 
+void* kmalloc_aligned(size_t size, size_t alignment)
+{
+    if (kmalloc == pre_init_kmalloc) {
+        panic("kmalloc called before heap initialised");
+    }
+    /* vmalloc memory is page-aligned, which covers any smaller alignment.
+     */
+    if (size >= VMALLOC_THRESHOLD && alignment <= PAGE_SIZE) {
+        return vmalloc(size);
+    }
+    return heap_alloc(__kernel_heap__, size, alignment);
+}
+
+void* kmalloc_flags(size_t size, alloc_flags_t flags)
+{
+    return kmalloc_aligned(size, TEST_FLAG(flags, ALLOC_PAGE_ALIGN) ? PAGE_SIZE : 0);
+}
+
 void enable_kmalloc(void)
 {
    kmalloc = real_kmalloc;
@@ -22,6 +22,7 @@
 #include <redshift/kernel.h>
 #include <redshift/kernel/console.h>
 #include <redshift/kernel/kmalloc.h>
+#include <redshift/mem/slab.h>
 #include <redshift/mem/static.h>
 
 void __noreturn kextern_abort(const char* fmt, ...)
@@ -51,3 +52,18 @@ void kextern_dynamic_free(void* ptr)
 {
     kfree(ptr);
 }
+
+void* kextern_object_cache_create(const char* name, size_t size)
+{
+    return kmem_cache_create(name, size, 0, NULL);
+}
+
+void* kextern_object_cache_alloc(void* cache)
+{
+    return kmem_cache_alloc(cache);
+}
+
+void kextern_object_cache_free(void* cache, void* ptr)
+{
+    kmem_cache_free(cache, ptr);
+}
@@ -29,9 +29,13 @@
 #include <redshift/kernel/panic.h>
 #include <redshift/kernel/printk.h>
 #include <redshift/kernel/sleep.h>
-#include <redshift/mem/static.h>
+
+enum {
+    PANIC_FORMAT_MAX = 512 /* Maximum length of a panic message format string. */
+};
 
 static bool in_panic = false;
+static char panic_format[PANIC_FORMAT_MAX];
 
 static void vpanic_common_start(const char* fmt, va_list ap)
 {
@@ -41,14 +45,13 @@ static void vpanic_common_start(const char* fmt, va_list ap)
     }
     in_panic = true;
     disable_interrupts();
-    const size_t fmt_len = kstring_length(fmt);
-    const size_t size    = ARRAY_SIZE(PRINTK_ERROR) + fmt_len;
-    char* buffer         = static_alloc(size + 1);
-    kmemory_zero(buffer, size + 1);
-    kstring_copy(buffer, PRINTK_ERROR, size);
-    kstring_concatenate(buffer, fmt, fmt_len);
+    /* Don't allocate memory here: the panic might have come from the allocator.
+     */
+    kmemory_zero(panic_format, sizeof(panic_format));
+    kstring_copy(panic_format, PRINTK_ERROR, sizeof(panic_format) - 1);
+    kstring_concatenate(panic_format, fmt, sizeof(panic_format) - 1 - kstring_length(panic_format));
     printk(PRINTK_ERROR "\n\aKernel panic - ");
-    vprintk(buffer, ap);
+    vprintk(panic_format, ap);
 }
 
 static void __noreturn vpanic_common_end(void)
@@ -84,6 +84,7 @@ int vprintk(const char* fmt, va_list ap)
     SAVE_INTERRUPT_STATE;
     int level = 0;
     if ((level = handle_printk_level(&fmt)) < MINIMUM_LOG_LEVEL) {
+        RESTORE_INTERRUPT_STATE;
         return 0;
     }
     console_color_t foreground, background;
@@ -17,8 +17,11 @@
  * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
  * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
+#include <redshift/boot/pit.h>
 #include <redshift/kernel.h>
 #include <redshift/kernel/sleep.h>
+#include <redshift/kernel/timer.h>
+#include <redshift/sched/process.h>
 
 void sleep(uint32_t sec)
 {
@@ -32,16 +35,17 @@ void msleep(uint64_t msec)
 
 void usleep(uint64_t usec)
 {
-    SAVE_INTERRUPT_STATE;
-    uint64_t ticks = 0;
-    for (ticks = usec*(uint64_t)TICK_RATE; ticks > 0ULL; ticks -= 1000000ULL) {
-        wait_for_interrupt();
-        disable_interrupts();
-        if (ticks > 0ULL && ticks < 1000000ULL) {
-            /* Prevent ticks underflowing.
-             */
-            ticks = 1000000ULL;
-        }
+    /* Block on the timer's sleep queue, so other processes get the CPU once the scheduler is running. Before then the
+     * timer waits for ticks, which needs interrupts; if the caller has them disabled (and so may hold the kernel lock)
+     * they stay disabled, and the PIT is polled instead.
+     */
+    if (get_current_process() != NULL || get_interrupt_state()) {
+        timer_sleep((usec + 999ULL)/1000ULL);
+        return;
+    }
+    while (usec > 0ULL) {
+        const uint32_t chunk = (uint32_t)MIN(usec, (uint64_t)UINT32_MAX);
+        pit_delay(chunk);
+        usec -= chunk;
     }
-    RESTORE_INTERRUPT_STATE;
 }
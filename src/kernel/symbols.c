@@ -24,6 +24,7 @@
 #include <libk/ksorted_array.h>
 #include <redshift/kernel.h>
 #include <redshift/kernel/symbols.h>
+#include <redshift/mem/slab.h>
 #include <redshift/mem/static.h>
 
 #define SYNTAX_ERROR(FMT, ...)     panic("syntax error in symbol table: %lu:%lu: " FMT, line, column, __VA_ARGS__)
@@ -41,6 +42,8 @@ struct symbol {
 
 static struct ksorted_array* symbol_table;
 
+static struct kmem_cache* symbol_cache;
+
 /* Sorting predicate for symbol_table. Sorts symbols by descending address. */
 static bool symbol_order_predicate(void* pa, void* pb)
 {
@@ -51,7 +54,7 @@ static bool symbol_order_predicate(void* pa, void* pb)
     return a->address < b->address;
 }
 
-static uintptr_t parse_address(const char* p, const char* q)
+static uintptr_t __init_text parse_address(const char* p, const char* q)
 {
     uintptr_t address = 0;
     for (; p < q; ++p) {
@@ -74,11 +77,12 @@ enum {
 
 enum { ADDRESS = 0, SYMBOL = 1 };
 
-void load_symbol_table(uintptr_t ptr, size_t size)
+void __init_text load_symbol_table(uintptr_t ptr, size_t size)
 {
     SAVE_INTERRUPT_STATE;
     DEBUG_ASSERT(ptr != 0);
     symbol_table = ksorted_array_create(MAX_SYMBOLS, KSORTED_ARRAY_STATIC, symbol_order_predicate);
+    symbol_cache = kmem_cache_create("symbol", sizeof(struct symbol), 0, NULL);
     const  char*   file   = (const char*)ptr;
     char address[ADDRESS_MAX];
     char name[SYM_NAME_MAX];
@@ -86,7 +90,7 @@ void load_symbol_table(uintptr_t ptr, size_t size)
     size_t column = 1;
     int    state  = ADDRESS;
     char*  p      = address;
-    struct symbol* symbol = kmalloc(sizeof(*symbol));
+    struct symbol* symbol = kmem_cache_alloc(symbol_cache);
     for (size_t i = 0; i < size && file[i] != 0; ++i, ++column) {
         if (kchar_is_space(file[i])) {
             if (file[i] == '\n') {
@@ -114,12 +118,15 @@ void load_symbol_table(uintptr_t ptr, size_t size)
                     }
                     size_t size = p - name;
                     symbol->name = kmalloc(size);
+                    if (symbol->name == NULL) {
+                        panic("%s: out of memory", __func__);
+                    }
                     kstring_copy(symbol->name, name, size);
                     printk(PRINTK_DEBUG "Symbol: <address=0x%08lX,name=%s>\n", symbol->address, symbol->name);
                     ksorted_array_add(symbol_table, symbol);
                     state  = ADDRESS;
                     p      = address;
-                    symbol = kmalloc(sizeof(*symbol));
+                    symbol = kmem_cache_alloc(symbol_cache);
                     break;
                 default:
                     UNREACHABLE("no switch case for state %d", state);
@@ -152,6 +159,7 @@ const void* get_symbol_address(const char* name)
     for (size_t i = 0; i < ksorted_array_count(symbol_table); ++i) {
         struct symbol* symbol = ksorted_array_get(symbol_table, i);
         if (kstring_compare(symbol->name, name, kstring_length(name)) == 0) {
+            RESTORE_INTERRUPT_STATE;
             return (const void*)(symbol->address);
         }
     }
@@ -161,7 +169,9 @@ const void* get_symbol_address(const char* name)
 
 const char* get_symbol_name(uintptr_t address)
 {
-    if (address < (uintptr_t)__code_start__ || address > (uintptr_t)__code_end__) {
+    const bool is_code = address >= (uintptr_t)__code_start__ && address <= (uintptr_t)__code_end__;
+    const bool is_init = address >= (uintptr_t)__init_start__ && address < (uintptr_t)__init_end__;
+    if (!(is_code || is_init)) {
         return NULL;
     }
     /* Find the symbol with the largest address which is below or equal to the given address. Since our symbol table is
@@ -21,7 +21,9 @@
 #include <redshift/kernel.h>
 #include <redshift/kernel/timer.h>
 #include <redshift/mem/heap.h>
-#include <libk/kstring.h>
+#include <redshift/mem/slab.h>
+#include <redshift/sched/process.h>
+#include <redshift/sched/wait.h>
 #include <libk/kstring.h>
 
 static struct timer_event {
@@ -34,13 +36,32 @@ static struct timer_event {
     struct timer_event* next;
 } * events;
 
+static struct kmem_cache* event_cache;
+
+/* A sleeping process. Entries live on the sleeping process' stack. */
+struct sleeper {
+    uint64_t          wake_time; /* Uptime to wake the process at (ms). */
+    struct wait_queue queue;     /* Where the process waits.             */
+    struct sleeper*   next;
+};
+
+/* Sleeping processes, sorted by wake time. */
+static struct sleeper* sleepers;
+
+/* Time since the timer started (ms). */
+static uint64_t uptime;
+
 void add_timer_event(const char* name, uint32_t period, void(* callback)(void*), void* arg)
 {
     SAVE_INTERRUPT_STATE;
     if (!(callback)) {
+        RESTORE_INTERRUPT_STATE;
         return;
     }
-    struct timer_event* event = kmalloc(sizeof(*events));
+    if (event_cache == NULL) {
+        event_cache = kmem_cache_create("timer_event", sizeof(struct timer_event), 0, NULL);
+    }
+    struct timer_event* event = kmem_cache_alloc(event_cache);
     if (event == NULL) {
         panic("%s: failed to allocate memory", __func__);
     }
@@ -54,10 +75,11 @@ void add_timer_event(const char* name, uint32_t period, void(* callback)(void*),
     if (events) {
         /* Append the event handler.
          */
-        while (events->next) {
-            events = events->next;
+        struct timer_event* last = events;
+        while (last->next) {
+            last = last->next;
         }
-        events->next = event;
+        last->next = event;
     } else {
         /* Initialise the list.
          */
@@ -69,6 +91,14 @@ void add_timer_event(const char* name, uint32_t period, void(* callback)(void*),
 void process_timer_queue(uint32_t elapsed_time)
 {
     SAVE_INTERRUPT_STATE;
+    /* Wake sleeping processes first, so they're ready to run if one of the events switches process.
+     */
+    uptime += elapsed_time;
+    while (sleepers != NULL && sleepers->wake_time <= uptime) {
+        struct sleeper* sleeper = sleepers;
+        sleepers = sleeper->next;
+        wake_up(&(sleeper->queue));
+    }
     struct timer_event* queue = events;
     /* Process queue.
      */
@@ -90,3 +120,30 @@ void process_timer_queue(uint32_t elapsed_time)
     }
     RESTORE_INTERRUPT_STATE;
 }
+
+uint64_t timer_uptime(void)
+{
+    SAVE_INTERRUPT_STATE;
+    const uint64_t time = uptime;
+    RESTORE_INTERRUPT_STATE;
+    return time;
+}
+
+void timer_sleep(uint64_t msec)
+{
+    SAVE_INTERRUPT_STATE;
+    /* Uptime only advances once a tick, so it may already be most of a tick behind. Add a tick to make sure we sleep for
+     * at least msec.
+     */
+    struct sleeper sleeper = {uptime + msec + 1000/TICK_RATE, WAIT_QUEUE_INIT, NULL};
+    struct sleeper** link = &sleepers;
+    while (*link != NULL && (*link)->wake_time <= sleeper.wake_time) {
+        link = &((*link)->next);
+    }
+    sleeper.next = *link;
+    *link        = &sleeper;
+    /* The sleeper is taken off the list when the wake time has passed, before it's woken.
+     */
+    wait_event(&(sleeper.queue), uptime >= sleeper.wake_time);
+    RESTORE_INTERRUPT_STATE;
+}
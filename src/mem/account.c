@@ -0,0 +1,86 @@
+/**
+ * \file mem/account.c
+ * \brief Memory accounting.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <libk/kmemory.h>
+#include <redshift/hal/smp.h>
+#include <redshift/kernel.h>
+#include <redshift/mem/account.h>
+
+/* Accounts are slots in a fixed table, so that a heap block can record its owner in the spare word of its header and
+ * be uncharged in constant time when it's freed, whoever frees it.
+ */
+struct mem_account {
+    bool                     used;  /* Whether the slot is in use. */
+    struct mem_account_stats stats; /* Usage statistics.           */
+};
+
+static struct mem_account accounts[MEM_ACCOUNTS_MAX] = {
+    [MEM_ACCOUNT_KERNEL] = {.used = true}
+};
+static int current_accounts[SMP_CPUS_MAX]; /* Account charged on each CPU, initially MEM_ACCOUNT_KERNEL. */
+
+int mem_account_create(void)
+{
+    SAVE_INTERRUPT_STATE;
+    for (int i = 0; i < MEM_ACCOUNTS_MAX; ++i) {
+        if (!(accounts[i].used)) {
+            kmemory_fill8(&(accounts[i]), 0, sizeof(accounts[i]));
+            accounts[i].used = true;
+            RESTORE_INTERRUPT_STATE;
+            return i;
+        }
+    }
+    RESTORE_INTERRUPT_STATE;
+    return -1;
+}
+
+void mem_account_switch(int account)
+{
+    DEBUG_ASSERT(account >= 0 && account < MEM_ACCOUNTS_MAX);
+    current_accounts[smp_cpu_index()] = account;
+}
+
+int mem_account_current(void)
+{
+    return current_accounts[smp_cpu_index()];
+}
+
+void mem_account_charge_heap(int account, size_t size)
+{
+    struct mem_account_stats* stats = &(accounts[account].stats);
+    stats->heap_bytes += size;
+    stats->heap_peak   = MAX(stats->heap_peak, stats->heap_bytes);
+    stats->alloc_count++;
+}
+
+void mem_account_uncharge_heap(int account, size_t size)
+{
+    struct mem_account_stats* stats = &(accounts[account].stats);
+    DEBUG_ASSERT(stats->heap_bytes >= size);
+    stats->heap_bytes -= size;
+    stats->free_count++;
+}
+
+void mem_account_get_stats(int account, struct mem_account_stats* stats)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(account >= 0 && account < MEM_ACCOUNTS_MAX);
+    kmemory_copy(stats, &(accounts[account].stats), sizeof(*stats));
+    RESTORE_INTERRUPT_STATE;
+}
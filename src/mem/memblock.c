@@ -0,0 +1,243 @@
+/**
+ * \file mem/memblock.c
+ * \brief Early boot memory allocator.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <redshift/kernel.h>
+#include <redshift/mem/common.h>
+#include <redshift/mem/memblock.h>
+
+/* The boot memory map is kept as two sorted lists of page ranges: the memory the firmware says is usable, and the
+ * memory which is in use. Allocations come from the lowest usable memory which isn't in use, and once the frame
+ * allocator has been set up everything else is handed over to it. None of this is needed after boot, so it all lives in
+ * .init.text.
+ */
+
+enum {
+    MEMBLOCK_REGIONS_MAX = 128,      /* Maximum number of ranges in a list.                         */
+    LOW_MEMORY_END       = 0x100000, /* The first 1 MiB holds the BIOS data area, VGA memory etc.  */
+    LOW_MEMORY_LIMIT     = 0xFFFFF000UL /* End of the memory which can be reached without paging.  */
+};
+
+struct memblock_region {
+    phys_addr_t   start; /* Start of range.             */
+    phys_addr_t   end;   /* End of range (exclusive).   */
+    memory_type_t type;  /* Memory type.                */
+};
+
+struct memblock_list {
+    struct memblock_region regions[MEMBLOCK_REGIONS_MAX];
+    size_t                 count;
+};
+
+static struct memblock_list memory;                /* Available and reclaimable memory.                    */
+static struct memblock_list reserved;              /* Memory in use.                                       */
+static uintptr_t            reserved_end = 0;      /* End of the highest kernel reservation.               */
+static bool                 released     = false;  /* Whether available memory has gone to the frame allocator. */
+
+/* Add [start, end) to a list, merging it with any ranges of the same type which it overlaps or touches. Ranges of
+ * different types are assumed not to overlap.
+ */
+static void __init_text region_add(struct memblock_list* list, phys_addr_t start, phys_addr_t end,
+                                   memory_type_t type)
+{
+    if (start >= end) {
+        return;
+    }
+    /* Skip the ranges below this one. A range which only touches it is skipped too unless the two can be merged.
+     */
+    size_t first = 0;
+    while (first < list->count && (list->regions[first].end < start ||
+                                   (list->regions[first].end == start && list->regions[first].type != type))) {
+        ++first;
+    }
+    size_t last = first;
+    while (last < list->count && list->regions[last].start <= end && list->regions[last].type == type) {
+        start = MIN(start, list->regions[last].start);
+        end   = MAX(end,   list->regions[last].end);
+        ++last;
+    }
+    DEBUG_ASSERT(last == list->count || list->regions[last].start >= end);
+    if (first == last) {
+        if (list->count == MEMBLOCK_REGIONS_MAX) {
+            panic("%s: too many memory ranges", __func__);
+        }
+        for (size_t i = list->count; i > first; --i) {
+            list->regions[i] = list->regions[i - 1];
+        }
+        ++list->count;
+    } else if (last - first > 1) {
+        for (size_t i = last; i < list->count; ++i) {
+            list->regions[first + 1 + i - last] = list->regions[i];
+        }
+        list->count -= last - first - 1;
+    }
+    list->regions[first].start = start;
+    list->regions[first].end   = end;
+    list->regions[first].type  = type;
+}
+
+/* Add a firmware memory range. Usable ranges are shrunk to page boundaries, everything else is reserved. */
+static void __init_text memory_add(uint64_t start, uint64_t end, memory_type_t type)
+{
+    if (start >= PHYS_ADDR_LIMIT) {
+        return;
+    }
+    end = MIN(end, (uint64_t)PHYS_ADDR_LIMIT);
+    if (type == MEMORY_TYPE_AVAILABLE || type == MEMORY_TYPE_RECLAIMABLE) {
+        start = (start + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+        end   = end & ~(uint64_t)(PAGE_SIZE - 1);
+        region_add(&memory, (phys_addr_t)start, (phys_addr_t)end, type);
+    } else {
+        region_add(&reserved, (phys_addr_t)start, (phys_addr_t)end, MEMORY_TYPE_RESERVED);
+    }
+}
+
+/* Reserve a range without counting it towards reserved_end. */
+static void __init_text reserve(uintptr_t start, uintptr_t end)
+{
+    region_add(&reserved, start, end, MEMORY_TYPE_RESERVED);
+}
+
+void __init_text memblock_init(struct multiboot2_tag* mb_tags)
+{
+    SAVE_INTERRUPT_STATE;
+    const uint32_t total_size = *(uint32_t*)mb_tags;
+    reserve(0, LOW_MEMORY_END);
+    memblock_reserve((uintptr_t)__kernel_start__, (uintptr_t)__kernel_end__ - (uintptr_t)__kernel_start__);
+    memblock_reserve((uintptr_t)mb_tags, total_size);
+    for (struct multiboot2_tag* tag = (struct multiboot2_tag*)((uint8_t*)mb_tags + 8);
+         tag->type != MULTIBOOT2_TAG_TYPE_END;
+         tag = (struct multiboot2_tag*)((uint8_t*)tag + ((tag->size + 7) & ~7))) {
+        if (tag->type == MULTIBOOT2_TAG_TYPE_MODULE) {
+            const struct multiboot2_tag_module* module = (const struct multiboot2_tag_module*)tag;
+            memblock_reserve(module->start, module->end - module->start);
+        } else if (tag->type == MULTIBOOT2_TAG_TYPE_MMAP) {
+            const struct multiboot2_tag_mmap* mmap = (const struct multiboot2_tag_mmap*)tag;
+            for (const struct multiboot2_mmap_entry* entry = mmap->entries;
+                 (const uint8_t*)entry < (const uint8_t*)tag + tag->size;
+                 entry = (const struct multiboot2_mmap_entry*)((const uint8_t*)entry + mmap->entry_size)) {
+                memory_add(entry->addr, entry->addr + entry->len, entry->type);
+            }
+        }
+    }
+    printk(
+        PRINTK_DEBUG "Memblock: <memory=%lu,reserved=%lu,reserved_end=0x%08lX,limit=0x%09llX>\n",
+        memory.count,
+        reserved.count,
+        memblock_reserved_end(),
+        (uint64_t)memblock_limit()
+    );
+    RESTORE_INTERRUPT_STATE;
+}
+
+void __init_text memblock_reserve(uintptr_t start, size_t size)
+{
+    SAVE_INTERRUPT_STATE;
+    reserve(start, start + size);
+    reserved_end = MAX(reserved_end, start + size);
+    RESTORE_INTERRUPT_STATE;
+}
+
+uintptr_t __init_text memblock_alloc(size_t size, size_t alignment)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(!released);
+    DEBUG_ASSERT(size > 0);
+    alignment = MAX(alignment, 1);
+    DEBUG_ASSERT((alignment & (alignment - 1)) == 0);
+    /* First fit: try the start of each available range, and move past each reservation which gets in the way. Boot
+     * memory is used before paging is enabled, so it has to be below 4 GiB.
+     */
+    for (size_t i = 0; i < memory.count; ++i) {
+        const struct memblock_region* region = &memory.regions[i];
+        if (region->type != MEMORY_TYPE_AVAILABLE || region->start >= LOW_MEMORY_LIMIT) {
+            continue;
+        }
+        const phys_addr_t end   = MIN(region->end, (phys_addr_t)LOW_MEMORY_LIMIT);
+        uintptr_t         start = region->start;
+        MAKE_ALIGNED(start, alignment);
+        for (size_t j = 0; j < reserved.count && start < end; ++j) {
+            if (reserved.regions[j].end <= start) {
+                continue;
+            }
+            if (reserved.regions[j].start >= start + size) {
+                break;
+            }
+            start = reserved.regions[j].end;
+            MAKE_ALIGNED(start, alignment);
+        }
+        if (start < end && end - start >= size) {
+            memblock_reserve(start, size);
+            RESTORE_INTERRUPT_STATE;
+            return start;
+        }
+    }
+    RESTORE_INTERRUPT_STATE;
+    return 0;
+}
+
+uintptr_t __init_text memblock_reserved_end(void)
+{
+    uintptr_t end = reserved_end;
+    MAKE_PAGE_ALIGNED(end);
+    return end;
+}
+
+phys_addr_t __init_text memblock_limit(void)
+{
+    return memory.count > 0 ? memory.regions[memory.count - 1].end : 0;
+}
+
+uint64_t __init_text memblock_release(memory_type_t type, memblock_release_fn_t release)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(type == MEMORY_TYPE_AVAILABLE || type == MEMORY_TYPE_RECLAIMABLE);
+    /* Release the gaps between reservations. Reservations needn't be page-aligned, so the gaps are shrunk to whole
+     * pages.
+     */
+    uint64_t total = 0;
+    for (size_t i = 0; i < memory.count; ++i) {
+        const struct memblock_region* region = &memory.regions[i];
+        if (region->type != type) {
+            continue;
+        }
+        phys_addr_t start = region->start;
+        for (size_t j = 0; j <= reserved.count && start < region->end; ++j) {
+            phys_addr_t end = region->end;
+            if (j < reserved.count) {
+                if (reserved.regions[j].end <= start) {
+                    continue;
+                }
+                end = MIN(end, reserved.regions[j].start);
+            }
+            end &= ~(phys_addr_t)(PAGE_SIZE - 1);
+            if (start < end) {
+                release(start, end);
+                total += end - start;
+            }
+            if (j < reserved.count) {
+                start = (reserved.regions[j].end + PAGE_SIZE - 1) & ~(phys_addr_t)(PAGE_SIZE - 1);
+            }
+        }
+    }
+    if (type == MEMORY_TYPE_AVAILABLE) {
+        released = true;
+    }
+    RESTORE_INTERRUPT_STATE;
+    return total;
+}
@@ -0,0 +1,270 @@
+/**
+ * \file mem/slab.c
+ * \brief Slab allocator.
+ * \author Chris Swinchatt <c.swinchatt@sussex.ac.uk>
+ * \copyright Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <libk/kmemory.h>
+#include <redshift/kernel.h>
+#include <redshift/mem/common.h>
+#include <redshift/mem/heap.h>
+#include <redshift/mem/slab.h>
+
+/* Each slab is one page taken from the kernel heap. The slab header sits at the start of the page and the objects fill
+ * the rest of it, so the slab an object belongs to is found by rounding the object's address down to a page boundary.
+ * Free objects are linked through a word stored after each object, so that constructed state survives being freed.
+ */
+struct slab {
+    struct kmem_cache* cache; /* Cache which owns the slab. */
+    struct slab*       prev;  /* Previous slab in list.     */
+    struct slab*       next;  /* Next slab in list.         */
+    void*              free;  /* First free object.         */
+    size_t             used;  /* Number of objects in use.  */
+};
+
+struct kmem_cache {
+    const char*        name;             /* Cache name.                                 */
+    size_t             object_size;      /* Object size, including the free list link.  */
+    size_t             link_offset;      /* Offset of the free list link in an object.  */
+    size_t             first_offset;     /* Offset of the first object in a slab.       */
+    size_t             objects_per_slab; /* Number of objects which fit in a slab.      */
+    kmem_ctor_fn_t     ctor;             /* Object constructor.                         */
+    struct slab*       partial;          /* Slabs with some objects in use.             */
+    struct slab*       full;             /* Slabs with every object in use.             */
+    struct slab*       empty;            /* Slab with no objects in use (at most one).  */
+    size_t             slab_count;       /* Number of slabs.                            */
+    size_t             objects_used;     /* Number of objects in use.                   */
+    uint64_t           alloc_count;      /* Number of allocations.                      */
+    uint64_t           free_count;       /* Number of frees.                            */
+    struct kmem_cache* next;             /* Next cache.                                 */
+};
+
+enum {
+    SLAB_SIZE               = PAGE_SIZE,
+    KMEM_CACHE_DEFAULT_ALIGN = 8
+};
+
+static struct kmem_cache* caches = NULL;
+
+/* Add a slab to the front of a list. */
+static void slab_list_add(struct slab** list, struct slab* slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (slab->next != NULL) {
+        slab->next->prev = slab;
+    }
+    *list = slab;
+}
+
+/* Remove a slab from a list. */
+static void slab_list_remove(struct slab** list, struct slab* slab)
+{
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        DEBUG_ASSERT(*list == slab);
+        *list = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+/* Get the slab an object belongs to. */
+static struct slab* get_slab(const void* ptr)
+{
+    return (struct slab*)((uintptr_t)ptr & ~(SLAB_SIZE - 1));
+}
+
+/* Get the free list link of an object. */
+static void** get_link(const struct kmem_cache* cache, void* object)
+{
+    return (void**)((uintptr_t)object + cache->link_offset);
+}
+
+/* Allocate a new slab, build its free list and construct its objects. */
+static struct slab* create_slab(struct kmem_cache* cache)
+{
+    struct slab* slab = heap_alloc(__kernel_heap__, SLAB_SIZE, SLAB_SIZE);
+    if (slab == NULL) {
+        return NULL;
+    }
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(slab));
+    slab->cache = cache;
+    slab->prev  = NULL;
+    slab->next  = NULL;
+    slab->free  = NULL;
+    slab->used  = 0;
+    /* Link the objects in reverse so that they are handed out in address order.
+     */
+    for (size_t i = cache->objects_per_slab; i-- > 0;) {
+        void* object = (void*)((uintptr_t)slab + cache->first_offset + i*cache->object_size);
+        if (cache->ctor != NULL) {
+            cache->ctor(object);
+        }
+        *get_link(cache, object) = slab->free;
+        slab->free = object;
+    }
+    cache->slab_count++;
+    return slab;
+}
+
+/* Give a slab's page back to the heap. */
+static void destroy_slab(struct kmem_cache* cache, struct slab* slab)
+{
+    DEBUG_ASSERT(slab->used == 0);
+    DEBUG_ASSERT(cache->slab_count > 0);
+    cache->slab_count--;
+    heap_free(__kernel_heap__, slab);
+}
+
+struct kmem_cache* kmem_cache_create(const char* name, size_t size, size_t align, kmem_ctor_fn_t ctor)
+{
+    DEBUG_ASSERT(name != NULL);
+    DEBUG_ASSERT(size != 0);
+    if (align == 0) {
+        align = KMEM_CACHE_DEFAULT_ALIGN;
+    }
+    DEBUG_ASSERT((align & (align - 1)) == 0);
+    struct kmem_cache* cache = kmalloc(sizeof(*cache));
+    if (cache == NULL) {
+        panic("%s: failed to allocate memory", __func__);
+    }
+    kmemory_fill8(cache, 0, sizeof(*cache));
+    cache->name         = name;
+    cache->link_offset  = size;
+    cache->first_offset = sizeof(struct slab);
+    cache->ctor         = ctor;
+    MAKE_ALIGNED(cache->link_offset,  sizeof(void*));
+    cache->object_size  = cache->link_offset + sizeof(void*);
+    MAKE_ALIGNED(cache->object_size,  align);
+    MAKE_ALIGNED(cache->first_offset, align);
+    if (cache->first_offset + cache->object_size > SLAB_SIZE) {
+        panic("%s: object size too large for cache %s (%lu bytes)", __func__, name, size);
+    }
+    cache->objects_per_slab = (SLAB_SIZE - cache->first_offset)/cache->object_size;
+    SAVE_INTERRUPT_STATE;
+    cache->next = caches;
+    caches      = cache;
+    RESTORE_INTERRUPT_STATE;
+    printk(
+        PRINTK_DEBUG "Created object cache: <name=%s,size=%lu,objects_per_slab=%lu>\n",
+        name,
+        cache->object_size,
+        cache->objects_per_slab
+    );
+    return cache;
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(cache != NULL);
+    /* Take an object from a partially used slab if possible, then the empty slab, then a new slab.
+     */
+    struct slab* slab = cache->partial;
+    if (slab == NULL) {
+        slab = cache->empty;
+        if (slab != NULL) {
+            cache->empty = NULL;
+        } else if ((slab = create_slab(cache)) == NULL) {
+            RESTORE_INTERRUPT_STATE;
+            return NULL;
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+    void* object = slab->free;
+    DEBUG_ASSERT(object != NULL);
+    slab->free = *get_link(cache, object);
+    slab->used++;
+    if (slab->free == NULL) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+    cache->objects_used++;
+    cache->alloc_count++;
+    RESTORE_INTERRUPT_STATE;
+    return object;
+}
+
+void kmem_cache_free(struct kmem_cache* cache, void* ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(cache != NULL);
+    struct slab* slab = get_slab(ptr);
+    DEBUG_ASSERT(slab->cache == cache);
+    DEBUG_ASSERT(slab->used > 0);
+    DEBUG_ASSERT(((uintptr_t)ptr - (uintptr_t)slab - cache->first_offset) % cache->object_size == 0);
+    if (slab->free == NULL) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+    *get_link(cache, ptr) = slab->free;
+    slab->free   = ptr;
+    slab->used--;
+    if (slab->used == 0) {
+        /* Keep one empty slab around so that a cache which is alternately allocated from and freed to doesn't keep
+         * going back to the heap.
+         */
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty == NULL) {
+            cache->empty = slab;
+        } else {
+            destroy_slab(cache, slab);
+        }
+    }
+    cache->objects_used--;
+    cache->free_count++;
+    RESTORE_INTERRUPT_STATE;
+}
+
+void kmem_cache_get_stats(const struct kmem_cache* cache, struct kmem_cache_stats* stats)
+{
+    DEBUG_ASSERT(cache != NULL);
+    DEBUG_ASSERT(stats != NULL);
+    SAVE_INTERRUPT_STATE;
+    stats->object_size  = cache->object_size;
+    stats->slab_count   = cache->slab_count;
+    stats->object_count = cache->slab_count*cache->objects_per_slab;
+    stats->objects_used = cache->objects_used;
+    stats->alloc_count  = cache->alloc_count;
+    stats->free_count   = cache->free_count;
+    RESTORE_INTERRUPT_STATE;
+}
+
+void kmem_cache_print_stats(void)
+{
+    for (const struct kmem_cache* cache = caches; cache != NULL; cache = cache->next) {
+        struct kmem_cache_stats stats;
+        kmem_cache_get_stats(cache, &stats);
+        printk(
+            PRINTK_DEBUG "Object cache: <name=%s,size=%lu,slabs=%lu,objects=%lu/%lu,allocs=%llu,frees=%llu>\n",
+            cache->name,
+            stats.object_size,
+            stats.slab_count,
+            stats.objects_used,
+            stats.object_count,
+            stats.alloc_count,
+            stats.free_count
+        );
+    }
+}
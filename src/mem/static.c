@@ -17,38 +17,68 @@
  * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
  * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
-#include <redshift/boot/boot_module.h>
 #include <redshift/kernel.h>
+#include <redshift/kernel/kmalloc.h>
 #include <redshift/mem/common.h>
-#include <redshift/mem/heap.h>
+#include <redshift/mem/frame.h>
+#include <redshift/mem/memblock.h>
+#include <redshift/mem/paging.h>
 #include <redshift/mem/static.h>
 
-uintptr_t heap_addr = 0;
+/* Static memory comes straight from memblock until the frame allocator takes over the free memory, after which it comes
+ * from a fixed pool. Once boot is over the unused part of the pool is released and static allocations fall back to the
+ * kernel heap.
+ */
+
+static uintptr_t static_next     = 0;     /* Next free address in the pool.                                */
+static uintptr_t static_end      = 0;     /* End of the pool, or zero if the pool hasn't been reserved yet. */
+static bool      static_released = false; /* Whether the unused part of the pool has been released.        */
 
-void static_init(void)
+/* Get the alignment for a static allocation. */
+static size_t static_alignment(size_t size, alloc_flags_t flags)
 {
-    SAVE_INTERRUPT_STATE;
-    heap_addr = MAX((uintptr_t)__kernel_end__, boot_modules_end());
-    MAKE_PAGE_ALIGNED(heap_addr);
-    RESTORE_INTERRUPT_STATE;
+    /* Align to page boundary if required. Otherwise, align according to the requirements of the object to be allocated.
+     */
+    uintptr_t alignment = 1;
+    if (TEST_FLAG(flags, ALLOC_PAGE_ALIGN)) {
+        alignment = PAGE_SIZE;
+    } else {
+        MAKE_ALLOC_ALIGNED(alignment, size);
+    }
+    return alignment;
 }
 
 uintptr_t static_alloc_base(size_t size, alloc_flags_t flags, uintptr_t* phys)
 {
     SAVE_INTERRUPT_STATE;
-    DEBUG_ASSERT(heap_addr >= (uintptr_t)__kernel_end__);
     DEBUG_ASSERT(size > 0);
-    /* Align to page boundary if required. Otherwise, align according to the requirements of the object to be allocated.
-     */
-    if (TEST_FLAG(flags, ALLOC_PAGE_ALIGN)) {
-        MAKE_PAGE_ALIGNED(heap_addr);
+    const size_t alignment = static_alignment(size, flags);
+    uintptr_t addr;
+    if (static_released) {
+        addr = (uintptr_t)kmalloc_aligned(size, alignment);
+        if (addr == 0) {
+            panic("%s: out of memory", __func__);
+        }
+        if (phys != NULL) {
+            *phys = virt_to_phys(addr);
+        }
+        RESTORE_INTERRUPT_STATE;
+        return addr;
+    }
+    if (static_end == 0) {
+        addr = memblock_alloc(size, alignment);
+        if (addr == 0) {
+            panic("%s: out of boot memory", __func__);
+        }
     } else {
-        MAKE_ALLOC_ALIGNED(heap_addr, size);
-     }
-    /* Advance heap address. In debug mode, also test that we haven't overwritten the dynamic heap.
-     */
-    uintptr_t addr = heap_addr;
-    heap_addr += size;
+        MAKE_ALIGNED(static_next, alignment);
+        addr         = static_next;
+        static_next += size;
+        if (static_next > static_end) {
+            panic("%s: out of static memory", __func__);
+        }
+    }
+    /* Static memory is identity mapped. */
     if (phys != NULL) {
         *phys = addr;
     }
@@ -60,3 +90,29 @@ void* static_alloc(size_t size)
 {
     return (void*)static_alloc_base(size, ALLOC_SIZE_ALIGN, NULL);
 }
+
+void __init_text static_reserve(size_t size)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(static_end == 0);
+    MAKE_PAGE_ALIGNED(size);
+    static_next = memblock_alloc(size, PAGE_SIZE);
+    if (static_next == 0) {
+        panic("%s: can't reserve %lu bytes of static memory", __func__, size);
+    }
+    static_end = static_next + size;
+    RESTORE_INTERRUPT_STATE;
+}
+
+size_t __init_text static_release(void)
+{
+    SAVE_INTERRUPT_STATE;
+    DEBUG_ASSERT(static_end != 0 && !static_released);
+    uintptr_t start = static_next;
+    MAKE_PAGE_ALIGNED(start);
+    const size_t size = static_end > start ? frame_free_boot_range(start, static_end) : 0;
+    static_end      = start;
+    static_released = true;
+    RESTORE_INTERRUPT_STATE;
+    return size;
+}
@@ -19,14 +19,22 @@
  * SOFTWARE.
  */
 #include <redshift/kernel.h>
+#include <redshift/mem/paging.h>
 #include <redshift/sched/process.h>
 
+enum {
+    IDLE_ZERO_BATCH = 16 /* Frames zeroed per time-slice. */
+};
+
 void __noreturn idle(void)
 {
-    /* Yield time-slice.
+    /* Zero free frames in the background so that allocations which need zeroed memory don't have to, then yield
+     * time-slice. Once the pool is full, halt until an interrupt comes along which might have made something ready.
      */
     while (true) {
-        printk(PRINTK_INFO "Idle\n");
+        if (zero_pool_fill(IDLE_ZERO_BATCH) == 0) {
+            wait_for_interrupt();
+        }
         process_yield();
     }
 }
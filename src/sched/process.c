@@ -20,38 +20,155 @@
  */
 #include <libk/kstring.h>
 #include <libk/kmemory.h>
-#include <redshift/hal/cpu/state.h>
+#include <redshift/boot/tss.h>
+#include <redshift/hal/cpu/fpu.h>
+#include <redshift/hal/smp.h>
 #include <redshift/kernel.h>
+#include <redshift/mem/account.h>
+#include <redshift/mem/frame.h>
 #include <redshift/mem/heap.h>
 #include <redshift/mem/paging.h>
+#include <redshift/mem/slab.h>
+#include <redshift/mem/stack.h>
+#include <redshift/sched/context.h>
 #include <redshift/sched/process.h>
 
+enum {
+    KERNEL_STACK_SIZE = 0x4000 /* Size of the kernel stack of a user mode process. */
+};
+
 /**
  * Process table entry.
  */
 struct process {
-    int                    id;         /** Process ID.                                  */
-    bool                   blocked;    /** Whether the process is blocked e.g. for I/O. */
-    struct page_directory* page_dir;   /** Process' page directory.                     */
-    struct cpu_state       state;      /** Process register state.                      */
-    uint8_t*               stack;      /** Process stack (bottom).                      */
-    size_t                 stack_size; /** Stack size.                                  */
-    process_flags_t        flags;      /** Process flags.                               */
-    struct process*        next;       /** Next process in the queue.                   */
+    int                    id;          /** Process ID.                                  */
+    bool                   blocked;     /** Whether the process is blocked e.g. for I/O. */
+    struct page_directory* page_dir;    /** Process' page directory.                     */
+    uintptr_t              context;     /** Saved kernel stack pointer.                  */
+    uintptr_t              entry_point; /** Entry point.                                 */
+    uint8_t*               stack;       /** Process stack (bottom).                      */
+    size_t                 stack_size;  /** Stack size.                                  */
+    uint8_t*               kstack_top;  /** Top of the process' kernel stack.            */
+    struct fpu_state*      fpu;         /** FPU state, or NULL until the FPU is used.    */
+    process_flags_t        flags;       /** Process flags.                               */
+    int                    account;     /** Memory account charged for heap allocations. */
+    process_priority_t     priority;    /** Process priority.                            */
+    unsigned               cpu;         /** CPU whose run queue has the process.         */
+    struct process*        prev;        /** Previous process in the list.                */
+    struct process*        next;        /** Next process in the list.                    */
 };
 
 /**
- * Process queue.
+ * Circular list of processes. The process after `last` is the first one.
  */
-static struct process_queue {
+struct process_list {
     struct process* last;
-} processes[PROCESS_PRIORITY_MAX + 1];
+};
 
-/** The currently executing process. */
-static struct process* current_process;
+/* Each CPU has its own run queue. Each priority has a list of processes which are ready to run and a list of blocked
+ * processes, so blocked processes are never looked at when picking the next process. Bit i of ready_bitmap is set while
+ * ready[i] is non-empty, so the highest priority with a ready process is found with a single bit scan.
+ */
+struct run_queue {
+    struct process_list ready[PROCESS_PRIORITY_MAX + 1];
+    struct process_list blocked[PROCESS_PRIORITY_MAX + 1];
+    uint16_t            ready_bitmap;
+    unsigned            ready_count;  /* Number of ready processes, including the running one.              */
+    struct process*     current;      /* The process the CPU is executing.                                 */
+    uintptr_t           boot_context; /* Stack pointer of the CPU's boot thread, which is never resumed.   */
+};
+
+static struct run_queue run_queues[SMP_CPUS_MAX];
 
 static uint32_t num_processes;
 
+/** Process table entry cache. */
+static struct kmem_cache* process_cache;
+
+/* Add a process to the end of a list. */
+static void list_append(struct process_list* list, struct process* process)
+{
+    if (list->last == NULL) {
+        process->prev = process;
+        process->next = process;
+    } else {
+        process->prev       = list->last;
+        process->next       = list->last->next;
+        process->next->prev = process;
+        list->last->next    = process;
+    }
+    list->last = process;
+}
+
+/* Remove a process from a list. */
+static void list_remove(struct process_list* list, struct process* process)
+{
+    if (process->next == process) {
+        list->last = NULL;
+    } else {
+        process->prev->next = process->next;
+        process->next->prev = process->prev;
+        if (list->last == process) {
+            list->last = process->prev;
+        }
+    }
+    process->prev = NULL;
+    process->next = NULL;
+}
+
+/* Get the current CPU's run queue. */
+static struct run_queue* this_queue(void)
+{
+    return &(run_queues[smp_cpu_index()]);
+}
+
+/* Add a process to the end of its ready list. */
+static void ready_append(struct process* process)
+{
+    struct run_queue* queue = &(run_queues[process->cpu]);
+    list_append(&(queue->ready[process->priority]), process);
+    queue->ready_bitmap |= 1U << process->priority;
+    ++queue->ready_count;
+}
+
+/* Remove a process from its ready list. */
+static void ready_remove(struct process* process)
+{
+    struct run_queue* queue = &(run_queues[process->cpu]);
+    list_remove(&(queue->ready[process->priority]), process);
+    if (queue->ready[process->priority].last == NULL) {
+        queue->ready_bitmap &= ~(1U << process->priority);
+    }
+    --queue->ready_count;
+}
+
+/* Find the running CPU with the fewest ready processes. */
+static unsigned least_loaded_cpu(void)
+{
+    unsigned best = 0;
+    for (unsigned cpu = 1; cpu < smp_cpu_count(); ++cpu) {
+        if (run_queues[cpu].ready_count < run_queues[best].ready_count) {
+            best = cpu;
+        }
+    }
+    return best;
+}
+
+/* Run a new process. The first switch to a process returns here, with interrupts disabled by process_switch and the
+ * kernel lock held on its behalf.
+ */
+static void __noreturn process_start(void)
+{
+    struct process* process = this_queue()->current;
+    kernel_lock_set_depth(0);
+    if (TEST_FLAG(process->flags, PROCESS_FLAGS_USER)) {
+        enter_user_mode(process->entry_point, (uintptr_t)process->stack + process->stack_size);
+    }
+    enable_interrupts();
+    ((void (*)(void))process->entry_point)();
+    panic("process %d returned from its entry point", process->id);
+}
+
 int process_spawn(
     uintptr_t              entry_point,
     struct page_directory* page_dir,
@@ -65,117 +182,207 @@ int process_spawn(
     DEBUG_ASSERT(stack_size > 0);
     if (priority > PROCESS_PRIORITY_MAX) {
         printk(PRINTK_ERROR "Invalid process priority: %u\n", priority);
+        RESTORE_INTERRUPT_STATE;
         return -1;
     }
-    struct process_queue* queue = &(processes[priority]);
+    /* Without a page directory the process gets a copy-on-write copy of the caller's address space.
+     */
+    if (page_dir == NULL) {
+        page_dir = page_directory_clone(page_directory_current());
+        if (page_dir == NULL) {
+            printk(PRINTK_ERROR "Unable to clone address space for new process\n");
+            RESTORE_INTERRUPT_STATE;
+            return -1;
+        }
+    }
     /* Create the new process.
      */
-    struct process* process = kmalloc(sizeof(*process));
+    if (process_cache == NULL) {
+        process_cache = kmem_cache_create("process", sizeof(struct process), 0, NULL);
+    }
+    struct process* process = kmem_cache_alloc(process_cache);
     if (!(process)) {
         panic("failed to create process: out of memory");
     }
     kmemory_fill8(process, 0, sizeof(*process));
-    kmemory_fill8(&(process->state), 0, sizeof(process->state));
     process->id       = num_processes++;
     process->blocked  = false;
     process->page_dir = page_dir;
     process->flags    = flags;
+    process->priority = priority;
+    process->cpu      = TEST_FLAG(flags, PROCESS_FLAGS_PINNED) ? smp_cpu_index() : least_loaded_cpu();
+    /* Charge the process for its own allocations, or lump it in with the kernel if there are no accounts left.
+     */
+    process->account  = mem_account_create();
+    if (process->account < 0) {
+        process->account = MEM_ACCOUNT_KERNEL;
+    }
     /* Set up the process' stack.
      */
     if (stack_addr == 0) {
-        process->stack = kmalloc(stack_size);
+        process->stack = stack_alloc(stack_size);
         if (!(process->stack)) {
-            panic("failed to create stack: out of memory");
+            panic("failed to create stack: no free stack slots");
         }
     } else {
         process->stack = (uint8_t*)stack_addr;
     }
     process->stack_size = stack_size;
-    /* Set up process registers.
+    /* A user mode process runs on the stack it was given and gets a separate kernel stack for when it enters the
+     * kernel. A supervisor process just uses the one stack.
      */
-    if (TEST_FLAG(process->flags, PROCESS_FLAGS_SUPERVISOR)) {
-        process->state.cs = 0x08;
-        process->state.ds = 0x10;
-        process->state.es = 0x10;
-        process->state.fs = 0x10;
-        process->state.gs = 0x10;
-        process->state.ss = 0x10;
+    if (TEST_FLAG(process->flags, PROCESS_FLAGS_USER)) {
+        uint8_t* kstack = stack_alloc(KERNEL_STACK_SIZE);
+        if (!(kstack)) {
+            panic("failed to create kernel stack: no free stack slots");
+        }
+        process->kstack_top = kstack + KERNEL_STACK_SIZE;
     } else {
-        process->state.cs = 0x1B;
-        process->state.ds = 0x23;
-        process->state.es = 0x23;
-        process->state.fs = 0x23;
-        process->state.gs = 0x23;
-        process->state.ss = 0x23;
-    }
-    process->state.eip = entry_point;
-    process->state.esp = (uintptr_t)process->stack + process->stack_size; /* Top of the stack. */
-    /* Add the process to its queue.
+        process->kstack_top = process->stack + process->stack_size;
+    }
+    /* The first switch to the process pops the context made here and returns into process_start.
      */
-    if (queue->last == NULL) {
-        /* Initialise the queue with the process.
-         */
-        queue->last     = process;
-        process->next   = process;
-        current_process = process;
-    } else {
-        /* Add the process after whatever executed last, then set it to be last in the queue.
-         */
-        process->next     = queue->last->next;
-        queue->last->next = process;
-        queue->last       = process;
+    process->entry_point = entry_point;
+    process->context     = context_init((uintptr_t)process->kstack_top, process_start);
+    ready_append(process);
+    if (process->cpu != smp_cpu_index()) {
+        smp_reschedule(process->cpu);
     }
-    printk(PRINTK_DEBUG "Spawned process: <id=%d,priority=%d,entry_point=0x%08lX>\n", process->id, priority, entry_point);
+    printk(
+        PRINTK_DEBUG "Spawned process: <id=%d,priority=%d,entry_point=0x%08lX,cpu=%u>\n",
+        process->id,
+        priority,
+        entry_point,
+        process->cpu
+    );
     RESTORE_INTERRUPT_STATE;
     return process->id;
 }
 
-extern void __noreturn set_state_and_jump(const struct cpu_state* regs);
-
-static void __noreturn switch_to(struct process* process)
+/* Switch from the current process to another one. Only the callee-saved registers are saved here: everything else
+ * the process was doing is on its kernel stack, including the interrupt frame if it was preempted.
+ */
+static void switch_to(struct run_queue* queue, struct process* process)
 {
-    printk(PRINTK_DEBUG "Switching process: <id=%d,eip=0x%08lX>\n", process->id, process->state.eip);
-    page_directory_load(process->page_dir);
-    set_state_and_jump(&(process->state));
+    uintptr_t* prev = queue->current != NULL ? &(queue->current->context) : &(queue->boot_context);
+    /* Reloading CR3 flushes the TLB, so only do it if the process is in a different address space.
+     */
+    if (process->page_dir != page_directory_current()) {
+        page_directory_load(process->page_dir);
+    }
+    mem_account_switch(process->account);
+    tss_set_kernel_stack((uintptr_t)process->kstack_top);
+    fpu_switch(&(process->fpu));
+    queue->current = process;
+    /* The kernel lock stays held across the switch, and the process we switch back to takes it over at the depth it
+     * had. By then we may be on another CPU, so the queue mustn't be touched after switch_context.
+     */
+    const unsigned depth = kernel_lock_depth();
+    switch_context(prev, process->context);
+    kernel_lock_set_depth(depth);
 }
 
-void __non_reentrant process_switch(void* regs)
+/* Move a process from the busiest other CPU's run queue to this CPU's. Processes which are running, pinned, or whose
+ * registers are loaded in their CPU's FPU are left where they are.
+ */
+static void steal(unsigned cpu)
 {
-    SAVE_INTERRUPT_STATE;
-    /* Update the register state of the process we just switched from.
-     */
-    if (regs != NULL && current_process != NULL) {
-        kmemory_copy(&(current_process->state), regs, sizeof(current_process->state));
+    struct run_queue* busiest = NULL;
+    for (unsigned i = 0; i < smp_cpu_count(); ++i) {
+        if (i != cpu && run_queues[i].ready_count > 1 &&
+            (busiest == NULL || run_queues[i].ready_count > busiest->ready_count)) {
+            busiest = &(run_queues[i]);
+        }
     }
-    /* Select a process queue, starting at the highest.
-     */
-    for (int priority = (int)PROCESS_PRIORITY_MAX; priority >= 0; --priority) {
-        struct process_queue* queue = &(processes[priority]);
-        struct process* process = queue->last;
+    if (busiest == NULL) {
+        return;
+    }
+    for (int priority = (int)PROCESS_PRIORITY_MAX; priority >= (int)PROCESS_PRIORITY_MIN; --priority) {
+        const struct process_list* list    = &(busiest->ready[priority]);
+        struct process*            process = list->last;
         if (process == NULL) {
-            /* Queue is empty - skip.
-             */
             continue;
         }
-        /* Go through the queue until we find a process which isn't blocked, then switch to it. If we get back to
-         * queue->last without switching, move on to the next queue.
-         */
         do {
             process = process->next;
-            if (!(process->blocked)) {
-                queue->last     = process;
-                current_process = process;
-                switch_to(process);
-                UNREACHABLE("switch to process %d returned", process->id);
+            if (process != busiest->current && !(TEST_FLAG(process->flags, PROCESS_FLAGS_PINNED)) &&
+                !(fpu_loaded(process->fpu))) {
+                ready_remove(process);
+                process->cpu = cpu;
+                ready_append(process);
+                return;
             }
-        } while (process != queue->last);
+        } while (process != list->last);
+    }
+}
+
+void __non_reentrant process_switch(void)
+{
+    SAVE_INTERRUPT_STATE;
+    const unsigned    cpu   = smp_cpu_index();
+    struct run_queue* queue = &(run_queues[cpu]);
+    /* A CPU with nothing but idle processes to run takes work from the others.
+     */
+    if ((queue->ready_bitmap >> (PROCESS_PRIORITY_MIN + 1)) == 0) {
+        steal(cpu);
+    }
+    if (queue->ready_bitmap == 0) {
+        /* Nothing is ready to run.
+         */
+        RESTORE_INTERRUPT_STATE;
+        return;
     }
+    /* Take the first process from the highest priority ready list (bsr finds the list), and make it the last so that
+     * processes of the same priority take turns.
+     */
+    struct process_list* list    = &(queue->ready[31 - __builtin_clz(queue->ready_bitmap)]);
+    struct process*      process = list->last->next;
+    list->last = process;
+    if (process != queue->current) {
+        switch_to(queue, process);
+    }
+    /* We're back in whichever process called process_switch, after some other process switched to it.
+     */
     RESTORE_INTERRUPT_STATE;
 }
 
-const struct process* __non_reentrant get_current_process(void)
+void process_block(struct process* process)
 {
-    return current_process;
+    SAVE_INTERRUPT_STATE;
+    if (!(process->blocked)) {
+        ready_remove(process);
+        list_append(&(run_queues[process->cpu].blocked[process->priority]), process);
+        process->blocked = true;
+    }
+    RESTORE_INTERRUPT_STATE;
+}
+
+void process_unblock(struct process* process)
+{
+    SAVE_INTERRUPT_STATE;
+    if (process->blocked) {
+        list_remove(&(run_queues[process->cpu].blocked[process->priority]), process);
+        ready_append(process);
+        process->blocked = false;
+        if (process->cpu != smp_cpu_index()) {
+            smp_reschedule(process->cpu);
+        }
+    }
+    RESTORE_INTERRUPT_STATE;
+}
+
+struct process* __non_reentrant get_current_process(void)
+{
+    /* Interrupts are disabled so the caller can't be preempted and moved to another CPU half way through. This doesn't
+     * need the kernel lock: only the CPU itself changes its current process.
+     */
+    const int state = get_interrupt_state();
+    disable_interrupts();
+    struct process* process = this_queue()->current;
+    if (state) {
+        enable_interrupts();
+    }
+    return process;
 }
 
 int get_process_id(const struct process* process)
@@ -185,5 +392,54 @@ int get_process_id(const struct process* process)
 
 int __non_reentrant get_current_process_id(void)
 {
-    return current_process->id;
+    return get_current_process()->id;
+}
+
+void process_get_memory_stats(const struct process* process, struct process_memory_stats* stats)
+{
+    SAVE_INTERRUPT_STATE;
+    struct mem_account_stats account;
+    mem_account_get_stats(process->account, &account);
+    stats->resident_frames = page_directory_resident(process->page_dir);
+    stats->heap_bytes      = account.heap_bytes;
+    stats->heap_peak       = account.heap_peak;
+    stats->stack_size      = process->stack_size;
+    stats->stack_peak      = stack_high_water(process->stack);
+    RESTORE_INTERRUPT_STATE;
+}
+
+/* Print the memory used by each process in a list. */
+static void print_list_memory_stats(const struct process_list* list)
+{
+    const struct process* process = list->last;
+    if (process == NULL) {
+        return;
+    }
+    do {
+        process = process->next;
+        struct process_memory_stats stats;
+        process_get_memory_stats(process, &stats);
+        printk(
+            PRINTK_DEBUG "Process memory: <id=%d,resident=%luK,heap=%luK,heap_peak=%luK,stack_peak=%luK/%luK>\n",
+            process->id,
+            stats.resident_frames*(PAGE_SIZE/1024),
+            stats.heap_bytes/1024,
+            stats.heap_peak/1024,
+            stats.stack_peak/1024,
+            stats.stack_size/1024
+        );
+    } while (process != list->last);
+}
+
+void process_print_memory_stats(void)
+{
+    SAVE_INTERRUPT_STATE;
+    for (unsigned cpu = 0; cpu < smp_cpu_count(); ++cpu) {
+        for (int priority = (int)PROCESS_PRIORITY_MAX; priority >= 0; --priority) {
+            print_list_memory_stats(&(run_queues[cpu].ready[priority]));
+            print_list_memory_stats(&(run_queues[cpu].blocked[priority]));
+        }
+    }
+    frame_print_stats();
+    RESTORE_INTERRUPT_STATE;
 }
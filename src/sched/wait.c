@@ -0,0 +1,110 @@
+/* Copyright (c) 2012-2018 Chris Swinchatt.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <redshift/kernel.h>
+#include <redshift/kernel/spinlock.h>
+#include <redshift/sched/process.h>
+#include <redshift/sched/wait.h>
+
+void wait_queue_init(struct wait_queue* queue)
+{
+    queue->first = NULL;
+    queue->last  = NULL;
+}
+
+/* Take an entry off a wait queue if it's still on it. */
+static void wait_queue_remove(struct wait_queue* queue, struct wait_entry* entry)
+{
+    struct wait_entry* prev = NULL;
+    for (struct wait_entry* it = queue->first; it != NULL; prev = it, it = it->next) {
+        if (it != entry) {
+            continue;
+        }
+        if (prev == NULL) {
+            queue->first = entry->next;
+        } else {
+            prev->next = entry->next;
+        }
+        if (queue->last == entry) {
+            queue->last = prev;
+        }
+        return;
+    }
+}
+
+void wait_on(struct wait_queue* queue)
+{
+    SAVE_INTERRUPT_STATE;
+    struct process* process = get_current_process();
+    if (process == NULL) {
+        /* There's nothing to switch to yet, so just let interrupts happen and come back to check again. The kernel lock
+         * is let go meanwhile, as it would be by a process switch, so the other CPUs aren't held up.
+         */
+        const unsigned depth = kernel_lock_depth();
+        kernel_lock_set_depth(0);
+        wait_for_interrupt();
+        disable_interrupts();
+        kernel_lock_set_depth(depth);
+        RESTORE_INTERRUPT_STATE;
+        return;
+    }
+    struct wait_entry entry = {process, NULL};
+    if (queue->last == NULL) {
+        queue->first = &entry;
+    } else {
+        queue->last->next = &entry;
+    }
+    queue->last = &entry;
+    /* Blocking takes the process off the ready list, so process_switch only returns once we've been unblocked. That
+     * needn't have been by wake_up, so the entry may still be queued, and it's about to go out of scope.
+     */
+    process_block(process);
+    process_switch();
+    wait_queue_remove(queue, &entry);
+    RESTORE_INTERRUPT_STATE;
+}
+
+bool wake_up_one(struct wait_queue* queue)
+{
+    SAVE_INTERRUPT_STATE;
+    struct wait_entry* entry = queue->first;
+    if (entry == NULL) {
+        RESTORE_INTERRUPT_STATE;
+        return false;
+    }
+    queue->first = entry->next;
+    if (queue->first == NULL) {
+        queue->last = NULL;
+    }
+    process_unblock(entry->process);
+    RESTORE_INTERRUPT_STATE;
+    return true;
+}
+
+size_t wake_up(struct wait_queue* queue)
+{
+    SAVE_INTERRUPT_STATE;
+    size_t count = 0;
+    while (wake_up_one(queue)) {
+        ++count;
+    }
+    RESTORE_INTERRUPT_STATE;
+    return count;
+}
@@ -106,6 +106,8 @@
         }                                                       \
     } while (0)
 
+/* libk/kassert.h has an ASSERT_EQUAL_PTR too, for tests which include kernel headers. */
+#undef ASSERT_EQUAL_PTR
 #define ASSERT_EQUAL_PTR(A, B)                                  \
     do {                                                        \
         if (strcmp(A, B) != 0) {                                \
@@ -178,6 +180,8 @@ void* static_alloc(size_t size)
     return malloc(size);
 }
 
+/* Tests which include the kernel's kmalloc.h get its kmalloc and kfree pointers instead. */
+#ifndef REDSHIFT_MEM_KMALLOC_H
 void* kmalloc(size_t size)
 {
     return malloc(size);
@@ -187,5 +191,6 @@ void kfree(void* ptr)
 {
     return free(ptr);
 }
+#endif
 
 #endif /* ! REDSHIFT_TESTS_UNIT_TEST_H */
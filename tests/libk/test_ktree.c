@@ -0,0 +1,128 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <libk/kmacro.h>
+#include <libk/ktree.h>
+
+#include "test.h"
+
+enum {
+    NODE_COUNT = 1000
+};
+
+static struct ktree      tree;
+static struct ktree_node nodes[NODE_COUNT];
+
+void __noreturn kextern_abort(const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    abort();
+}
+
+/* Check the AVL and max-weight invariants of a subtree and return its height, or -1 if they don't hold. */
+static int check_subtree(const struct ktree_node* node, uintptr_t low, uintptr_t high)
+{
+    if (node == NULL) {
+        return 0;
+    }
+    if (node->key < low || node->key > high) {
+        return -1;
+    }
+    if ((node->left != NULL && node->left->parent != node) || (node->right != NULL && node->right->parent != node)) {
+        return -1;
+    }
+    const int left  = check_subtree(node->left,  low, node->key - 1);
+    const int right = check_subtree(node->right, node->key + 1, high);
+    if (left < 0 || right < 0 || left - right > 1 || right - left > 1 || node->height != 1 + MAX(left, right)) {
+        return -1;
+    }
+    size_t max_weight = node->weight;
+    max_weight = node->left  != NULL ? MAX(max_weight, node->left->max_weight)  : max_weight;
+    max_weight = node->right != NULL ? MAX(max_weight, node->right->max_weight) : max_weight;
+    return max_weight == node->max_weight ? node->height : -1;
+}
+
+/* Weight of the node with key i. */
+static size_t weight_of(size_t i)
+{
+    return (i*7919) % 1021;
+}
+
+BEGIN_TEST(ktree_insert)
+    ktree_init(&tree);
+    /* Insert in a scrambled order so that every rotation is exercised.
+     */
+    for (size_t i = 0; i < NODE_COUNT; ++i) {
+        const size_t j = (i*389) % NODE_COUNT;
+        ktree_insert(&tree, &nodes[j], j*16, weight_of(j));
+    }
+    ASSERT_EQUAL_ULONG((size_t)NODE_COUNT, ktree_count(&tree));
+    ASSERT(check_subtree(tree.root, 0, UINTPTR_MAX) > 0);
+END_TEST
+
+BEGIN_TEST(ktree_iterate)
+    size_t count = 0;
+    uintptr_t last = 0;
+    for (struct ktree_node* node = ktree_first(&tree); node != NULL; node = ktree_next(node), ++count) {
+        ASSERT(count == 0 || node->key > last);
+        last = node->key;
+    }
+    ASSERT_EQUAL_ULONG((size_t)NODE_COUNT, count);
+    ASSERT(ktree_last(&tree) == &nodes[NODE_COUNT - 1]);
+    ASSERT(ktree_previous(&nodes[1]) == &nodes[0]);
+    ASSERT(ktree_previous(&nodes[0]) == NULL);
+END_TEST
+
+BEGIN_TEST(ktree_find)
+    ASSERT(ktree_find(&tree, 16*123) == &nodes[123]);
+    ASSERT(ktree_find(&tree, 16*123 + 1) == NULL);
+END_TEST
+
+BEGIN_TEST(ktree_find_first_fit)
+    for (size_t weight = 0; weight <= 1021; weight += 17) {
+        struct ktree_node* expected = NULL;
+        for (size_t i = 0; i < NODE_COUNT; ++i) {
+            if (weight_of(i) >= weight) {
+                expected = &nodes[i];
+                break;
+            }
+        }
+        ASSERT(ktree_find_first_fit(&tree, weight) == expected);
+    }
+END_TEST
+
+BEGIN_TEST(ktree_remove)
+    /* Remove every other node, then the rest.
+     */
+    for (size_t i = 0; i < NODE_COUNT; i += 2) {
+        ktree_remove(&tree, &nodes[i]);
+    }
+    ASSERT_EQUAL_ULONG((size_t)NODE_COUNT/2, ktree_count(&tree));
+    ASSERT(check_subtree(tree.root, 0, UINTPTR_MAX) > 0);
+    ASSERT(ktree_find(&tree, 0) == NULL);
+    ASSERT(ktree_first(&tree) == &nodes[1]);
+    for (size_t i = 1; i < NODE_COUNT; i += 2) {
+        ktree_remove(&tree, &nodes[i]);
+    }
+    ASSERT_EQUAL_ULONG(0UL, ktree_count(&tree));
+    ASSERT(tree.root == NULL);
+END_TEST
+
+#define TEST_LIST(F)                \
+    F(ktree_insert);                \
+    F(ktree_iterate);               \
+    F(ktree_find);                  \
+    F(ktree_find_first_fit);        \
+    F(ktree_remove);
+
+int main(void)
+{
+    SETUP(NULL);
+    TEST_LIST(RUN_TEST)
+    CLEANUP(NULL);
+}
+
+#undef TEST_LIST
@@ -0,0 +1,168 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <redshift/kernel.h>
+#include <redshift/mem/heap.h>
+#include <redshift/mem/paging.h>
+
+/* Host stubs for the kernel functions the heap depends on. Memory is "mapped" by the host, so paging is a no-op.
+ */
+struct page_directory* kernel_directory = NULL;
+
+int  get_interrupt_state(void) { return 0; }
+void disable_interrupts(void)  { }
+void enable_interrupts(void)   { }
+void kernel_lock(void)         { }
+void kernel_unlock(void)       { }
+void enable_kmalloc(void)      { }
+
+int map_range_alloc(struct page_directory* dir, uintptr_t virtual_address, size_t size, page_flags_t flags)
+{
+    (void)dir;
+    (void)virtual_address;
+    (void)size;
+    (void)flags;
+    return 0;
+}
+
+page_flags_t kernel_page_flags(page_flags_t flags)
+{
+    return flags;
+}
+
+void unmap_range(struct page_directory* dir, uintptr_t virtual_address, size_t size, bool free)
+{
+    (void)dir;
+    (void)virtual_address;
+    (void)size;
+    (void)free;
+}
+
+int  mem_account_current(void)                        { return 0; }
+void mem_account_charge_heap(int account, size_t size)   { (void)account; (void)size; }
+void mem_account_uncharge_heap(int account, size_t size) { (void)account; (void)size; }
+
+uint64_t memory_size_available(void) { return 0; }
+size_t   memory_size_total(void)     { return 0; }
+
+void kmemory_fill8(void* ptr, uint8_t value, size_t n)
+{
+    memset(ptr, value, n);
+}
+
+void* static_alloc(size_t size)
+{
+    return calloc(1, size);
+}
+
+int printk(const char* fmt, ...)
+{
+    (void)fmt;
+    return 0;
+}
+
+void __noreturn panic(const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    abort();
+}
+
+void __noreturn kextern_abort(const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    abort();
+}
+
+enum {
+    REGION_SIZE  = 64*1024*1024, /* Size of the memory the heap can grow into.  */
+    INITIAL_SIZE = 1024*1024,    /* Initial heap size.                          */
+    MAX_LIVE     = 16384,        /* Largest number of live allocations.         */
+    MAX_ALLOC    = 512,          /* Largest allocation size.                    */
+    ITERATIONS   = 1000000       /* Number of free/alloc pairs per run.         */
+};
+
+static uint32_t rng_state = 0x2545F491;
+
+/* xorshift32 */
+static uint32_t next_random(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec*1e9 + (double)ts.tv_nsec;
+}
+
+/* Allocate a random size in [1, MAX_ALLOC] (and occasionally page-aligned). */
+static void* random_alloc(struct heap* heap)
+{
+    const size_t size       = 1 + next_random() % MAX_ALLOC;
+    const size_t alignment  = (next_random() & 15) == 0 ? 0x1000 : 0;
+    void* ptr = heap_alloc(heap, size, alignment);
+    if (ptr == NULL) {
+        panic("heap exhausted: size=%zu\n", size);
+    }
+    return ptr;
+}
+
+/* Fill the heap with live blocks then repeatedly free and reallocate random ones. */
+static void run(uint8_t* region, size_t live_blocks)
+{
+    static void* live[MAX_LIVE];
+    const uintptr_t start = (uintptr_t)region;
+    struct heap* heap = create_heap(start, start + INITIAL_SIZE, REGION_SIZE, HEAP_FLAGS_WRITEABLE);
+    const struct heap_policy policy = {
+        .initial_size = INITIAL_SIZE,
+        .min_size     = INITIAL_SIZE,
+        .max_size     = REGION_SIZE,
+        .grow_chunk   = 256*1024,
+        .shrink_chunk = 1024*1024
+    };
+    heap_set_policy(heap, &policy);
+    for (size_t i = 0; i < live_blocks; ++i) {
+        live[i] = random_alloc(heap);
+    }
+    const double begin = now_ns();
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        const size_t index = next_random() % live_blocks;
+        heap_free(heap, live[index]);
+        live[index] = random_alloc(heap);
+    }
+    const double elapsed = now_ns() - begin;
+    for (size_t i = 0; i < live_blocks; ++i) {
+        heap_free(heap, live[i]);
+    }
+    printf("  %6zu live blocks %8.1f ns/op\n", live_blocks, elapsed/(2.0*ITERATIONS));
+    free(heap);
+}
+
+int main(void)
+{
+    uint8_t* region = aligned_alloc(0x1000, REGION_SIZE);
+    if (region == NULL) {
+        perror("aligned_alloc");
+        return EXIT_FAILURE;
+    }
+    printf("heap_alloc/heap_free churn (sizes 1..%d, %d iterations):\n", MAX_ALLOC, ITERATIONS);
+    for (size_t live_blocks = 16; live_blocks <= MAX_LIVE; live_blocks *= 4) {
+        run(region, live_blocks);
+    }
+    free(region);
+    return EXIT_SUCCESS;
+}
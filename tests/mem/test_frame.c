@@ -0,0 +1,181 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <redshift/kernel.h>
+#include <redshift/mem/frame.h>
+#include <redshift/mem/memblock.h>
+#include <redshift/mem/static.h>
+#include <libk/kmemory.h>
+
+#include "../libk/test.h"
+
+/* Host stubs for the kernel functions the frame allocator depends on. The machine has MEMORY_SIZE bytes of available
+ * memory, of which the frames below RESERVED_END are in use by the kernel.
+ */
+enum {
+    MEMORY_SIZE  = 0x800000,            /* Amount of memory: 2048 frames.         */
+    RESERVED_END = 0x3000,              /* End of the memory the kernel reserves. */
+    FRAMES       = MEMORY_SIZE/PAGE_SIZE,
+    FREE_FRAMES  = (MEMORY_SIZE - RESERVED_END)/PAGE_SIZE
+};
+
+int  get_interrupt_state(void) { return 0; }
+void disable_interrupts(void)  { }
+void enable_interrupts(void)   { }
+void kernel_lock(void)         { }
+void kernel_unlock(void)       { }
+
+phys_addr_t memblock_limit(void)
+{
+    return MEMORY_SIZE;
+}
+
+uintptr_t memblock_reserved_end(void)
+{
+    return RESERVED_END;
+}
+
+uint64_t memblock_release(memory_type_t type, memblock_release_fn_t release)
+{
+    if (type != MEMORY_TYPE_AVAILABLE) {
+        return 0;
+    }
+    release(RESERVED_END, MEMORY_SIZE);
+    return MEMORY_SIZE - RESERVED_END;
+}
+
+void static_reserve(size_t size)
+{
+    (void)size;
+}
+
+size_t static_release(void)
+{
+    return 0;
+}
+
+void kmemory_fill8(void* ptr, uint8_t value, size_t n)
+{
+    memset(ptr, value, n);
+}
+
+void __noreturn kextern_abort(const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    abort();
+}
+
+static void init(void)
+{
+    frame_init(0);
+}
+
+BEGIN_TEST(frame_alloc_free)
+    ASSERT_EQUAL_ULONG((unsigned long)FREE_FRAMES, (unsigned long)frame_count_free());
+    const phys_addr_t frame = frame_alloc_order(0);
+    ASSERT(frame >= RESERVED_END && frame < MEMORY_SIZE);
+    ASSERT(IS_PAGE_ALIGNED(frame));
+    ASSERT_EQUAL_ULONG((unsigned long)(FREE_FRAMES - 1), (unsigned long)frame_count_free());
+    /* A block is aligned to its own size.
+     */
+    const phys_addr_t block = frame_alloc_order(3);
+    ASSERT(block != 0);
+    ASSERT(IS_ALIGNED(block, PAGE_SIZE << 3));
+    ASSERT(block + (PAGE_SIZE << 3) <= frame || frame + PAGE_SIZE <= block);
+    ASSERT_EQUAL_ULONG((unsigned long)(FREE_FRAMES - 9), (unsigned long)frame_count_free());
+    frame_free_order(block, 3);
+    frame_free_order(frame, 0);
+    ASSERT_EQUAL_ULONG((unsigned long)FREE_FRAMES, (unsigned long)frame_count_free());
+END_TEST
+
+BEGIN_TEST(frame_merge_buddies)
+    /* Splitting a maximum-order block and freeing the halves in any order merges them back into one block.
+     */
+    phys_addr_t blocks[1UL << 4];
+    for (size_t i = 0; i < ARRAY_SIZE(blocks); ++i) {
+        blocks[i] = frame_alloc_order(FRAME_ORDER_MAX - 4);
+        ASSERT(blocks[i] != 0);
+    }
+    ASSERT(frame_alloc_order(FRAME_ORDER_MAX) == 0);
+    for (size_t i = 0; i < ARRAY_SIZE(blocks); i += 2) {
+        frame_free_order(blocks[i], FRAME_ORDER_MAX - 4);
+    }
+    ASSERT(frame_alloc_order(FRAME_ORDER_MAX) == 0);
+    for (size_t i = 1; i < ARRAY_SIZE(blocks); i += 2) {
+        frame_free_order(blocks[i], FRAME_ORDER_MAX - 4);
+    }
+    const phys_addr_t block = frame_alloc_order(FRAME_ORDER_MAX);
+    ASSERT(block != 0);
+    ASSERT(IS_ALIGNED(block, PAGE_SIZE << FRAME_ORDER_MAX));
+    frame_free_order(block, FRAME_ORDER_MAX);
+    ASSERT_EQUAL_ULONG((unsigned long)FREE_FRAMES, (unsigned long)frame_count_free());
+END_TEST
+
+BEGIN_TEST(frame_exhaust)
+    /* Every free frame is handed out exactly once, and none of them is frame 0.
+     */
+    phys_addr_t* frames = malloc(FREE_FRAMES*sizeof(*frames));
+    uint8_t*     seen   = calloc(FRAMES, 1);
+    for (size_t i = 0; i < FREE_FRAMES; ++i) {
+        frames[i] = frame_alloc_order(0);
+        ASSERT(frames[i] >= RESERVED_END && frames[i] < MEMORY_SIZE);
+        ASSERT(!(seen[frames[i]/PAGE_SIZE]));
+        seen[frames[i]/PAGE_SIZE] = 1;
+    }
+    ASSERT(frame_alloc_order(0) == 0);
+    ASSERT_EQUAL_ULONG(0UL, (unsigned long)frame_count_free());
+    for (size_t i = 0; i < FREE_FRAMES; ++i) {
+        frame_free_order(frames[i], 0);
+    }
+    ASSERT_EQUAL_ULONG((unsigned long)FREE_FRAMES, (unsigned long)frame_count_free());
+    const phys_addr_t block = frame_alloc_order(FRAME_ORDER_MAX);
+    ASSERT(block != 0);
+    frame_free_order(block, FRAME_ORDER_MAX);
+    free(seen);
+    free(frames);
+END_TEST
+
+BEGIN_TEST(frame_free_range)
+    /* A block can be freed a frame at a time, and still merges back together.
+     */
+    const phys_addr_t block = frame_alloc_order(FRAME_ORDER_MAX);
+    ASSERT(block != 0);
+    frame_free_range(block + PAGE_SIZE, (1UL << FRAME_ORDER_MAX) - 1);
+    frame_free_range(block, 1);
+    ASSERT(frame_alloc_order(FRAME_ORDER_MAX) == block);
+    frame_free_order(block, FRAME_ORDER_MAX);
+END_TEST
+
+BEGIN_TEST(frame_share_unshare)
+    const phys_addr_t frame = frame_alloc_order(0);
+    ASSERT(!(frame_unshare(frame)));
+    ASSERT_EQUAL_INT(0, frame_share(frame));
+    ASSERT_EQUAL_INT(0, frame_share(frame));
+    ASSERT(frame_unshare(frame));
+    ASSERT(frame_unshare(frame));
+    ASSERT(!(frame_unshare(frame)));
+    frame_free_order(frame, 0);
+    ASSERT_EQUAL_ULONG((unsigned long)FREE_FRAMES, (unsigned long)frame_count_free());
+END_TEST
+
+#define TEST_LIST(F)                \
+    F(frame_alloc_free);            \
+    F(frame_merge_buddies);         \
+    F(frame_exhaust);               \
+    F(frame_free_range);            \
+    F(frame_share_unshare);
+
+int main(void)
+{
+    SETUP(init);
+    TEST_LIST(RUN_TEST)
+    CLEANUP(NULL);
+}
+
+#undef TEST_LIST
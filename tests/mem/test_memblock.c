@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <redshift/kernel.h>
+#include <redshift/boot/multiboot2.h>
+#include <redshift/mem/memblock.h>
+
+#include "../libk/test.h"
+
+/* Host stubs for the kernel functions memblock depends on. The multiboot2 tags are put in low memory, which memblock
+ * reserves anyway, and the kernel image symbols are placed there by the Makefile, so none of the host's own addresses
+ * end up in the memory map.
+ */
+int  get_interrupt_state(void) { return 0; }
+void disable_interrupts(void)  { }
+void enable_interrupts(void)   { }
+void kernel_lock(void)         { }
+void kernel_unlock(void)       { }
+
+void __noreturn kextern_abort(const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    abort();
+}
+
+enum {
+    TAGS_ADDRESS = 0x80000, /* Where the multiboot2 tags are put. */
+    RANGES_MAX   = 16       /* Largest number of released ranges. */
+};
+
+/* The firmware memory map. Reclaimable ranges touch available ones on both sides, and are listed in both orders. */
+static const struct multiboot2_mmap_entry mmap_entries[] = {
+    {0x00000000, 0x0009F000, MULTIBOOT2_MEMORY_AVAILABLE,   0},
+    {0x00200000, 0x00100000, MULTIBOOT2_MEMORY_RECLAIMABLE, 0},
+    {0x00100000, 0x00100000, MULTIBOOT2_MEMORY_AVAILABLE,   0},
+    {0x00300000, 0x07CE0000, MULTIBOOT2_MEMORY_AVAILABLE,   0},
+    {0x07FE0000, 0x00010000, MULTIBOOT2_MEMORY_RECLAIMABLE, 0},
+    {0x07FF0000, 0x00010000, MULTIBOOT2_MEMORY_RESERVED,    0},
+    {0x08000000, 0x00100000, MULTIBOOT2_MEMORY_AVAILABLE,   0},
+    {0x08100000, 0x00100000, MULTIBOOT2_MEMORY_AVAILABLE,   0}
+};
+
+static struct range {
+    phys_addr_t start;
+    phys_addr_t end;
+} ranges[RANGES_MAX];
+
+static size_t range_count;
+
+static void release(phys_addr_t start, phys_addr_t end)
+{
+    if (range_count < RANGES_MAX) {
+        ranges[range_count].start = start;
+        ranges[range_count].end   = end;
+    }
+    ++range_count;
+}
+
+/* Build the multiboot2 tags: a memory map and the end tag. */
+static void setup(void)
+{
+    uint8_t* tags = mmap((void*)TAGS_ADDRESS, PAGE_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (tags != (uint8_t*)TAGS_ADDRESS) {
+        perror("mmap");
+        exit(1);
+    }
+    struct multiboot2_tag_mmap* mmap_tag = (struct multiboot2_tag_mmap*)(tags + 8);
+    mmap_tag->tag.type      = MULTIBOOT2_TAG_TYPE_MMAP;
+    mmap_tag->tag.size      = sizeof(*mmap_tag) + sizeof(mmap_entries);
+    mmap_tag->entry_size    = sizeof(*mmap_entries);
+    mmap_tag->entry_version = 0;
+    memcpy(mmap_tag->entries, mmap_entries, sizeof(mmap_entries));
+    struct multiboot2_tag* end = (struct multiboot2_tag*)((uint8_t*)mmap_tag + ((mmap_tag->tag.size + 7) & ~7));
+    end->type = MULTIBOOT2_TAG_TYPE_END;
+    end->size = 8;
+    *(uint32_t*)tags = (uint32_t)((uint8_t*)end + end->size - tags);
+    memblock_init((struct multiboot2_tag*)tags);
+}
+
+/* The tests share memblock's state, so they run in order: allocation has to come before available memory is released.
+ */
+BEGIN_TEST(memblock_limit)
+    ASSERT_EQUAL_ULONG(0x08200000UL, (unsigned long)memblock_limit());
+END_TEST
+
+BEGIN_TEST(memblock_alloc)
+    /* The lowest available memory above the low 1 MiB, which is reserved along with the kernel and the tags.
+     */
+    ASSERT_EQUAL_ULONG(0x00100000UL, (unsigned long)memblock_alloc(PAGE_SIZE, PAGE_SIZE));
+    ASSERT_EQUAL_ULONG(0x00101000UL, (unsigned long)memblock_alloc(1, PAGE_SIZE));
+END_TEST
+
+BEGIN_TEST(memblock_release_available)
+    range_count = 0;
+    ASSERT_EQUAL_ULONG(0x07FDE000UL, (unsigned long)memblock_release(MEMORY_TYPE_AVAILABLE, release));
+    ASSERT_EQUAL_ULONG(3UL, (unsigned long)range_count);
+    ASSERT_EQUAL_ULONG(0x00102000UL, (unsigned long)ranges[0].start);
+    ASSERT_EQUAL_ULONG(0x00200000UL, (unsigned long)ranges[0].end);
+    ASSERT_EQUAL_ULONG(0x00300000UL, (unsigned long)ranges[1].start);
+    ASSERT_EQUAL_ULONG(0x07FE0000UL, (unsigned long)ranges[1].end);
+    ASSERT_EQUAL_ULONG(0x08000000UL, (unsigned long)ranges[2].start);
+    ASSERT_EQUAL_ULONG(0x08200000UL, (unsigned long)ranges[2].end);
+END_TEST
+
+BEGIN_TEST(memblock_release_reclaimable)
+    range_count = 0;
+    ASSERT_EQUAL_ULONG(0x00110000UL, (unsigned long)memblock_release(MEMORY_TYPE_RECLAIMABLE, release));
+    ASSERT_EQUAL_ULONG(2UL, (unsigned long)range_count);
+    ASSERT_EQUAL_ULONG(0x00200000UL, (unsigned long)ranges[0].start);
+    ASSERT_EQUAL_ULONG(0x00300000UL, (unsigned long)ranges[0].end);
+    ASSERT_EQUAL_ULONG(0x07FE0000UL, (unsigned long)ranges[1].start);
+    ASSERT_EQUAL_ULONG(0x07FF0000UL, (unsigned long)ranges[1].end);
+END_TEST
+
+#define TEST_LIST(F)                    \
+    F(memblock_limit);                  \
+    F(memblock_alloc);                  \
+    F(memblock_release_available);      \
+    F(memblock_release_reclaimable);
+
+int main(void)
+{
+    SETUP(setup);
+    TEST_LIST(RUN_TEST)
+    CLEANUP(NULL);
+}
+
+#undef TEST_LIST
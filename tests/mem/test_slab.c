@@ -0,0 +1,178 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <redshift/kernel.h>
+#include <redshift/mem/heap.h>
+#include <redshift/mem/slab.h>
+#include <libk/kmemory.h>
+
+#include "../libk/test.h"
+
+/* Host stubs for the kernel functions the slab layer depends on. Slabs come from the host's aligned_alloc, and the
+ * number of them which haven't been given back is counted, so that the tests can see when a slab is released.
+ */
+struct heap* __kernel_heap__ = NULL;
+
+static size_t live_slabs;
+
+void*(* kmalloc)(size_t size) = malloc;
+
+int  get_interrupt_state(void) { return 0; }
+void disable_interrupts(void)  { }
+void enable_interrupts(void)   { }
+void kernel_lock(void)         { }
+void kernel_unlock(void)       { }
+
+void* heap_alloc(struct heap* heap, size_t size, size_t alignment)
+{
+    (void)heap;
+    ++live_slabs;
+    return aligned_alloc(alignment, size);
+}
+
+void heap_free(struct heap* heap, void* ptr)
+{
+    (void)heap;
+    --live_slabs;
+    free(ptr);
+}
+
+void kmemory_fill8(void* ptr, uint8_t value, size_t n)
+{
+    memset(ptr, value, n);
+}
+
+void __noreturn kextern_abort(const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    abort();
+}
+
+enum {
+    OBJECT_SIZE  = 100,       /* Size of the test objects.                */
+    OBJECT_MAGIC = 0x5AB5AB5A /* Value the test constructor writes first. */
+};
+
+static unsigned ctor_calls;
+
+/* Mark an object as constructed. */
+static void object_ctor(void* object)
+{
+    ++ctor_calls;
+    *(uint32_t*)object = OBJECT_MAGIC;
+}
+
+/* Get the number of objects which fit in one slab, by making a new cache create its first slab. */
+static size_t objects_per_slab(struct kmem_cache* cache)
+{
+    struct kmem_cache_stats stats;
+    void* object = kmem_cache_alloc(cache);
+    kmem_cache_get_stats(cache, &stats);
+    kmem_cache_free(cache, object);
+    return stats.object_count;
+}
+
+BEGIN_TEST(slab_alloc_free)
+    live_slabs = 0;
+    struct kmem_cache* cache = kmem_cache_create("test_alloc", OBJECT_SIZE, 0, NULL);
+    uint8_t* first  = kmem_cache_alloc(cache);
+    uint8_t* second = kmem_cache_alloc(cache);
+    ASSERT(first != NULL && second != NULL);
+    ASSERT(first != second);
+    ASSERT(((uintptr_t)first & 7) == 0 && ((uintptr_t)second & 7) == 0);
+    ASSERT_EQUAL_ULONG(1UL, (unsigned long)live_slabs);
+    /* Objects don't overlap, and writing a whole object doesn't disturb its neighbour.
+     */
+    memset(first,  0xAA, OBJECT_SIZE);
+    memset(second, 0xBB, OBJECT_SIZE);
+    for (size_t i = 0; i < OBJECT_SIZE; ++i) {
+        ASSERT_EQUAL_UINT(0xAAU, (unsigned)first[i]);
+    }
+    struct kmem_cache_stats stats;
+    kmem_cache_get_stats(cache, &stats);
+    ASSERT(stats.object_size >= OBJECT_SIZE);
+    ASSERT_EQUAL_ULONG(2UL, (unsigned long)stats.objects_used);
+    kmem_cache_free(cache, first);
+    kmem_cache_free(cache, NULL);
+    /* The most recently freed object is handed out first.
+     */
+    ASSERT(kmem_cache_alloc(cache) == first);
+    kmem_cache_free(cache, first);
+    kmem_cache_free(cache, second);
+    kmem_cache_get_stats(cache, &stats);
+    ASSERT_EQUAL_ULONG(0UL, (unsigned long)stats.objects_used);
+    ASSERT_EQUAL_ULONG(3UL, (unsigned long)stats.alloc_count);
+    ASSERT_EQUAL_ULONG(3UL, (unsigned long)stats.free_count);
+END_TEST
+
+BEGIN_TEST(slab_constructor_reuse)
+    /* Objects are constructed once, when their slab is created, and keep their state across a free.
+     */
+    ctor_calls = 0;
+    struct kmem_cache* cache = kmem_cache_create("test_ctor", OBJECT_SIZE, 0, object_ctor);
+    const size_t per_slab = objects_per_slab(cache);
+    ASSERT_EQUAL_ULONG((unsigned long)per_slab, (unsigned long)ctor_calls);
+    uint32_t* object = kmem_cache_alloc(cache);
+    ASSERT_EQUAL_UINT(OBJECT_MAGIC, *object);
+    object[1] = 1234;
+    kmem_cache_free(cache, object);
+    uint32_t* again = kmem_cache_alloc(cache);
+    ASSERT(again == object);
+    ASSERT_EQUAL_UINT(OBJECT_MAGIC, *again);
+    ASSERT_EQUAL_UINT(1234U, again[1]);
+    ASSERT_EQUAL_ULONG((unsigned long)per_slab, (unsigned long)ctor_calls);
+    kmem_cache_free(cache, again);
+END_TEST
+
+BEGIN_TEST(slab_release_empty)
+    /* Filling two slabs and then freeing everything gives one slab back to the heap and keeps the other.
+     */
+    live_slabs = 0;
+    struct kmem_cache* cache = kmem_cache_create("test_release", OBJECT_SIZE, 0, NULL);
+    const size_t per_slab = objects_per_slab(cache);
+    const size_t count    = 2*per_slab;
+    void** objects = malloc(count*sizeof(*objects));
+    for (size_t i = 0; i < count; ++i) {
+        objects[i] = kmem_cache_alloc(cache);
+        ASSERT(objects[i] != NULL);
+    }
+    ASSERT_EQUAL_ULONG(2UL, (unsigned long)live_slabs);
+    struct kmem_cache_stats stats;
+    kmem_cache_get_stats(cache, &stats);
+    ASSERT_EQUAL_ULONG(2UL, (unsigned long)stats.slab_count);
+    ASSERT_EQUAL_ULONG((unsigned long)count, (unsigned long)stats.object_count);
+    for (size_t i = 0; i < count; ++i) {
+        kmem_cache_free(cache, objects[i]);
+    }
+    ASSERT_EQUAL_ULONG(1UL, (unsigned long)live_slabs);
+    kmem_cache_get_stats(cache, &stats);
+    ASSERT_EQUAL_ULONG(1UL, (unsigned long)stats.slab_count);
+    ASSERT_EQUAL_ULONG(0UL, (unsigned long)stats.objects_used);
+    /* The slab which was kept is used again rather than a new one.
+     */
+    void* object = kmem_cache_alloc(cache);
+    ASSERT_EQUAL_ULONG(1UL, (unsigned long)live_slabs);
+    kmem_cache_free(cache, object);
+    ASSERT_EQUAL_ULONG(1UL, (unsigned long)live_slabs);
+    free(objects);
+END_TEST
+
+#define TEST_LIST(F)                \
+    F(slab_alloc_free);             \
+    F(slab_constructor_reuse);      \
+    F(slab_release_empty);
+
+int main(void)
+{
+    SETUP(NULL);
+    TEST_LIST(RUN_TEST)
+    CLEANUP(NULL);
+}
+
+#undef TEST_LIST
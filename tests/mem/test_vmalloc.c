@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <redshift/kernel.h>
+#include <redshift/mem/account.h>
+#include <redshift/mem/paging.h>
+#include <redshift/mem/vmalloc.h>
+
+#include "../libk/test.h"
+
+/* Host stubs for the kernel functions vmalloc depends on. The vmalloc area is mapped into the host process at its
+ * kernel address, and pages which would be mapped not-present are mapped inaccessible, so touching one faults just as
+ * it would in the kernel.
+ */
+struct page_directory* kernel_directory = NULL;
+
+static page_flags_t last_flags;
+static int          current_account = MEM_ACCOUNT_KERNEL;
+static size_t       charged[2];
+
+int  get_interrupt_state(void) { return 0; }
+void disable_interrupts(void)  { }
+void enable_interrupts(void)   { }
+void kernel_lock(void)         { }
+void kernel_unlock(void)       { }
+
+int mem_account_current(void)
+{
+    return current_account;
+}
+
+void mem_account_charge_heap(int account, size_t size)
+{
+    charged[account] += size;
+}
+
+void mem_account_uncharge_heap(int account, size_t size)
+{
+    charged[account] -= size;
+}
+
+page_flags_t kernel_page_flags(page_flags_t flags)
+{
+    return flags;
+}
+
+int map_range_alloc(struct page_directory* dir, uintptr_t virtual_address, size_t size, page_flags_t flags)
+{
+    (void)dir;
+    last_flags = flags;
+    int prot = PROT_NONE;
+    if (TEST_FLAG(flags, PAGE_FLAGS_PRESENT)) {
+        prot = TEST_FLAG(flags, PAGE_FLAGS_WRITEABLE) ? PROT_READ | PROT_WRITE : PROT_READ;
+    }
+    void* address = mmap((void*)virtual_address, size, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    return address == (void*)virtual_address ? 0 : -1;
+}
+
+void unmap_range(struct page_directory* dir, uintptr_t virtual_address, size_t size, bool free)
+{
+    (void)dir;
+    (void)free;
+    munmap((void*)virtual_address, size);
+}
+
+void __noreturn kextern_abort(const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    abort();
+}
+
+enum {
+    BUFFER_SIZE = 3*PAGE_SIZE + 123 /* Size of the test buffer, which isn't a whole number of pages. */
+};
+
+BEGIN_TEST(vmalloc_mapping)
+    uint8_t* buffer = vmalloc(BUFFER_SIZE);
+    ASSERT(buffer != NULL);
+    ASSERT(is_vmalloc_address(buffer));
+    ASSERT(TEST_FLAG(last_flags, PAGE_FLAGS_PRESENT));
+    ASSERT(TEST_FLAG(last_flags, PAGE_FLAGS_WRITEABLE));
+    vfree(buffer);
+END_TEST
+
+BEGIN_TEST(vmalloc_write)
+    uint8_t* buffer = vmalloc(BUFFER_SIZE);
+    ASSERT(buffer != NULL);
+    /* Only write through the buffer if it was mapped present: otherwise this would fault rather than fail.
+     */
+    ASSERT(TEST_FLAG(last_flags, PAGE_FLAGS_PRESENT));
+    for (size_t i = 0; i < BUFFER_SIZE; ++i) {
+        buffer[i] = (uint8_t)i;
+    }
+    for (size_t i = 0; i < BUFFER_SIZE; ++i) {
+        ASSERT_EQUAL_UINT((unsigned)(uint8_t)i, (unsigned)buffer[i]);
+    }
+    vfree(buffer);
+END_TEST
+
+BEGIN_TEST(vmalloc_reuse)
+    /* A freed range, along with its guard page, is handed out again.
+     */
+    uint8_t* first = vmalloc(BUFFER_SIZE);
+    vfree(first);
+    uint8_t* second = vmalloc(BUFFER_SIZE);
+    ASSERT(first == second);
+    uint8_t* third = vmalloc(PAGE_SIZE);
+    ASSERT(third >= second + 5*PAGE_SIZE);
+    third[PAGE_SIZE - 1] = 1;
+    vfree(third);
+    vfree(second);
+END_TEST
+
+BEGIN_TEST(vmalloc_accounting)
+    /* Pages are charged to the account which was current when they were allocated, and credited back to it on free
+     * whichever account is current then.
+     */
+    current_account = 1;
+    uint8_t* buffer = vmalloc(BUFFER_SIZE);
+    current_account = MEM_ACCOUNT_KERNEL;
+    ASSERT_EQUAL_ULONG((unsigned long)(4*PAGE_SIZE), (unsigned long)charged[1]);
+    ASSERT_EQUAL_ULONG(0UL, (unsigned long)charged[MEM_ACCOUNT_KERNEL]);
+    vfree(buffer);
+    ASSERT_EQUAL_ULONG(0UL, (unsigned long)charged[1]);
+    ASSERT_EQUAL_ULONG(0UL, (unsigned long)charged[MEM_ACCOUNT_KERNEL]);
+END_TEST
+
+#define TEST_LIST(F)                \
+    F(vmalloc_mapping);             \
+    F(vmalloc_write);               \
+    F(vmalloc_reuse);               \
+    F(vmalloc_accounting);
+
+int main(void)
+{
+    SETUP(NULL);
+    TEST_LIST(RUN_TEST)
+    CLEANUP(NULL);
+}
+
+#undef TEST_LIST
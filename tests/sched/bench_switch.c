@@ -0,0 +1,187 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <redshift/hal/cpu/fpu.h>
+#include <redshift/kernel.h>
+#include <redshift/mem/account.h>
+#include <redshift/mem/paging.h>
+#include <redshift/mem/slab.h>
+#include <redshift/sched/context.h>
+#include <redshift/sched/process.h>
+
+/* The kernel's switch_context is i686 assembly and the host build is x86_64, so this is a port of it which saves the
+ * x86_64 callee-saved registers instead. The rest of the yield path is the kernel's own process.c.
+ */
+__asm__(
+    ".text\n"
+    ".global switch_context\n"
+    "switch_context:\n"
+    "    push %rbp\n"
+    "    push %rbx\n"
+    "    push %r12\n"
+    "    push %r13\n"
+    "    push %r14\n"
+    "    push %r15\n"
+    "    mov  %rsp, (%rdi)\n"
+    "    mov  %rsi, %rsp\n"
+    "    pop  %r15\n"
+    "    pop  %r14\n"
+    "    pop  %r13\n"
+    "    pop  %r12\n"
+    "    pop  %rbx\n"
+    "    pop  %rbp\n"
+    "    ret\n"
+);
+
+uintptr_t context_init(uintptr_t stack_top, void (*start)(void))
+{
+    uintptr_t* sp = (uintptr_t*)(stack_top & ~(uintptr_t)15);
+    *--sp = 0;                  /* start's return address. */
+    *--sp = (uintptr_t)start;
+    for (int i = 0; i < 6; ++i) {
+        *--sp = 0;              /* Callee-saved registers. */
+    }
+    return (uintptr_t)sp;
+}
+
+void enter_user_mode(uintptr_t eip, uintptr_t esp)
+{
+    (void)eip;
+    (void)esp;
+    abort();
+}
+
+/* Host stubs for the kernel functions the scheduler depends on.
+ */
+struct page_directory* kernel_directory = (struct page_directory*)1;
+
+int  get_interrupt_state(void) { return 0; }
+void disable_interrupts(void)  { }
+void enable_interrupts(void)   { }
+
+void     kernel_lock(void)                    { }
+void     kernel_unlock(void)                  { }
+unsigned kernel_lock_depth(void)              { return 0; }
+void     kernel_lock_set_depth(unsigned depth) { (void)depth; }
+
+unsigned smp_cpu_index(void)           { return 0; }
+unsigned smp_cpu_count(void)           { return 1; }
+void     smp_reschedule(unsigned cpu)  { (void)cpu; }
+
+void tss_set_kernel_stack(uintptr_t esp0)       { (void)esp0; }
+void fpu_switch(struct fpu_state** state)        { (void)state; }
+bool fpu_loaded(const struct fpu_state* state)   { (void)state; return false; }
+
+struct page_directory* page_directory_current(void)                        { return kernel_directory; }
+struct page_directory* page_directory_clone(struct page_directory* dir)   { return dir; }
+void                   page_directory_load(struct page_directory* dir)    { (void)dir; }
+size_t                 page_directory_resident(struct page_directory* dir) { (void)dir; return 0; }
+
+int  mem_account_create(void)        { return MEM_ACCOUNT_KERNEL; }
+void mem_account_switch(int account) { (void)account; }
+
+void mem_account_get_stats(int account, struct mem_account_stats* stats)
+{
+    (void)account;
+    memset(stats, 0, sizeof(*stats));
+}
+
+struct kmem_cache* kmem_cache_create(const char* name, size_t size, size_t align, kmem_ctor_fn_t ctor)
+{
+    (void)name;
+    (void)align;
+    (void)ctor;
+    return (struct kmem_cache*)(uintptr_t)size;
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache)
+{
+    return malloc((size_t)(uintptr_t)cache);
+}
+
+void* stack_alloc(size_t size)
+{
+    return aligned_alloc(0x1000, size);
+}
+
+size_t stack_high_water(const void* stack)
+{
+    (void)stack;
+    return 0;
+}
+
+void frame_print_stats(void) { }
+
+void kmemory_fill8(void* ptr, uint8_t value, size_t n)
+{
+    memset(ptr, value, n);
+}
+
+int printk(const char* fmt, ...)
+{
+    (void)fmt;
+    return 0;
+}
+
+void __noreturn panic(const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    abort();
+}
+
+void __noreturn kextern_abort(const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    abort();
+}
+
+enum {
+    STACK_BYTES = 64*1024, /* Size of each process' stack.          */
+    ITERATIONS  = 10000000 /* Number of round trips between the two. */
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec*1e9 + (double)ts.tv_nsec;
+}
+
+/* Yield to pong and back ITERATIONS times, then report. Nothing switches back to main, so this exits. */
+static void ping(void)
+{
+    const double begin = now_ns();
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        process_yield();
+    }
+    const double elapsed  = now_ns() - begin;
+    const double switches = 2.0*ITERATIONS;
+    printf("  %.0f switches/s %8.1f ns/switch\n", switches/(elapsed*1e-9), elapsed/switches);
+    exit(EXIT_SUCCESS);
+}
+
+static void pong(void)
+{
+    while (true) {
+        process_yield();
+    }
+}
+
+int main(void)
+{
+    printf("process_yield ping-pong between two processes (%d round trips):\n", ITERATIONS);
+    process_spawn((uintptr_t)ping, kernel_directory, PROCESS_PRIORITY_AVG, 0, STACK_BYTES, PROCESS_FLAGS_SUPERVISOR);
+    process_spawn((uintptr_t)pong, kernel_directory, PROCESS_PRIORITY_AVG, 0, STACK_BYTES, PROCESS_FLAGS_SUPERVISOR);
+    process_yield();
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,213 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <redshift/kernel.h>
+#include <redshift/kernel/timer.h>
+#include <redshift/mem/slab.h>
+#include <redshift/sched/process.h>
+#include <redshift/sched/wait.h>
+#include <libk/kstring.h>
+
+#include "../libk/test.h"
+
+/* Host stubs for the kernel functions wait queues and the timer depend on. There's only one process, so "switching"
+ * away from it runs on_switch in its place, which stands in for whatever the other processes and interrupts would do
+ * while it's blocked.
+ */
+static char            process_storage;
+static struct process* current;
+static bool            blocked;
+static unsigned        switches;
+static unsigned        unblocks;
+static void(*          on_switch)(void);
+
+int  get_interrupt_state(void) { return 0; }
+void disable_interrupts(void)  { }
+void enable_interrupts(void)   { }
+void kernel_lock(void)         { }
+void kernel_unlock(void)       { }
+
+unsigned kernel_lock_depth(void)               { return 0; }
+void     kernel_lock_set_depth(unsigned depth) { (void)depth; }
+
+struct process* get_current_process(void)
+{
+    return current;
+}
+
+void process_block(struct process* process)
+{
+    (void)process;
+    blocked = true;
+}
+
+void process_unblock(struct process* process)
+{
+    (void)process;
+    blocked = false;
+    ++unblocks;
+}
+
+void process_switch(void)
+{
+    ++switches;
+    while (blocked) {
+        on_switch();
+    }
+}
+
+/* Interrupts arrive once a tick. */
+void wait_for_interrupt(void)
+{
+    process_timer_queue(1000/TICK_RATE);
+}
+
+struct kmem_cache* kmem_cache_create(const char* name, size_t size, size_t align, kmem_ctor_fn_t ctor)
+{
+    (void)name;
+    (void)align;
+    (void)ctor;
+    return (struct kmem_cache*)(uintptr_t)size;
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache)
+{
+    return malloc((size_t)(uintptr_t)cache);
+}
+
+char* kstring_duplicate(const char* s)
+{
+    return strdup(s);
+}
+
+size_t kstring_length(const char* s)
+{
+    return strlen(s);
+}
+
+uint32_t kstring_hash32(const char* s, size_t n)
+{
+    (void)s;
+    return (uint32_t)n;
+}
+
+static struct wait_queue queue = WAIT_QUEUE_INIT;
+static bool              condition;
+
+/* Wake the queue, as another process would. */
+static void wake_queue(void)
+{
+    wake_up(&queue);
+}
+
+/* Make the condition true on the second wake-up. */
+static void wake_queue_twice(void)
+{
+    condition = switches >= 2;
+    wake_up(&queue);
+}
+
+/* Unblock the process without waking the queue, as a timeout or a signal would. */
+static void unblock_directly(void)
+{
+    process_unblock(current);
+}
+
+/* Let a tick pass. */
+static void tick(void)
+{
+    process_timer_queue(1000/TICK_RATE);
+}
+
+static void reset(void)
+{
+    current   = (struct process*)&process_storage;
+    blocked   = false;
+    switches  = 0;
+    unblocks  = 0;
+    condition = false;
+    wait_queue_init(&queue);
+}
+
+BEGIN_TEST(wait_on_blocks_until_woken)
+    reset();
+    on_switch = wake_queue;
+    wait_on(&queue);
+    ASSERT(!(blocked));
+    ASSERT_EQUAL_UINT(1U, switches);
+    ASSERT_EQUAL_UINT(1U, unblocks);
+    ASSERT(queue.first == NULL && queue.last == NULL);
+END_TEST
+
+BEGIN_TEST(wait_on_unblocked_externally)
+    reset();
+    on_switch = unblock_directly;
+    wait_on(&queue);
+    ASSERT(!(blocked));
+    ASSERT(queue.first == NULL && queue.last == NULL);
+    ASSERT_EQUAL_ULONG(0UL, wake_up(&queue));
+END_TEST
+
+BEGIN_TEST(wake_up_empty_queue)
+    reset();
+    ASSERT(!(wake_up_one(&queue)));
+    ASSERT_EQUAL_ULONG(0UL, wake_up(&queue));
+    ASSERT_EQUAL_UINT(0U, unblocks);
+END_TEST
+
+BEGIN_TEST(wait_event_rechecks_condition)
+    reset();
+    on_switch = wake_queue_twice;
+    wait_event(&queue, condition);
+    ASSERT(condition);
+    ASSERT_EQUAL_UINT(2U, switches);
+    ASSERT_EQUAL_UINT(2U, unblocks);
+END_TEST
+
+BEGIN_TEST(wait_event_true_condition)
+    reset();
+    condition = true;
+    wait_event(&queue, condition);
+    ASSERT_EQUAL_UINT(0U, switches);
+END_TEST
+
+BEGIN_TEST(timer_sleep_wakes_after_timeout)
+    reset();
+    on_switch = tick;
+    const uint64_t start = timer_uptime();
+    timer_sleep(50);
+    ASSERT(timer_uptime() >= start + 50);
+    ASSERT(timer_uptime() <= start + 50 + 2*1000/TICK_RATE);
+    ASSERT_EQUAL_UINT(1U, switches);
+    ASSERT_EQUAL_UINT(1U, unblocks);
+END_TEST
+
+BEGIN_TEST(timer_sleep_before_scheduler)
+    reset();
+    current = NULL;
+    const uint64_t start = timer_uptime();
+    timer_sleep(50);
+    ASSERT(timer_uptime() >= start + 50);
+    ASSERT_EQUAL_UINT(0U, switches);
+END_TEST
+
+#define TEST_LIST(F)                        \
+    F(wait_on_blocks_until_woken);          \
+    F(wait_on_unblocked_externally);        \
+    F(wake_up_empty_queue);                 \
+    F(wait_event_rechecks_condition);       \
+    F(wait_event_true_condition);           \
+    F(timer_sleep_wakes_after_timeout);     \
+    F(timer_sleep_before_scheduler);
+
+int main(void)
+{
+    SETUP(NULL);
+    TEST_LIST(RUN_TEST)
+    CLEANUP(NULL);
+}
+
+#undef TEST_LIST